@@ -0,0 +1,47 @@
+#!/bin/sh
+# Ahead-of-time compilation against the interpreter and the JIT: every
+# bench/roms.sh workload is translated with --compile, built with
+# $AOT_CFLAGS, and run next to the interpreter and a -DVM_JIT build.
+# Prints the median M instr/s of each, and how long the host compiler
+# took over the generated C.
+#
+# usage: bench/aot.sh [runs]
+
+set -e
+
+RUNS=${1:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+AOT_CFLAGS=${AOT_CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -o "$WORK/interp" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_JIT -o "$WORK/jit" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/stats" "$ROOT"/with-safety/*.c
+$CC -O2 -o "$WORK/measure" "$ROOT"/bench/measure.c
+
+for w in $("$ROOT"/bench/roms.sh "$WORK"); do
+    [ -f "$WORK/$w.txt" ] || : > "$WORK/$w.txt"
+    count=$("$WORK/stats" "$WORK/$w.asm" < "$WORK/$w.txt" 2>&1 > /dev/null \
+        | awk '{ for (i = 1; i < NF; i++) if ($(i + 1) == "instructions") print $i }')
+
+    "$WORK/interp" --compile "$WORK/$w.c" "$WORK/$w.asm"
+    start=$(date +%s%N)
+    $CC $AOT_CFLAGS -o "$WORK/$w-aot" "$WORK/$w.c"
+    end=$(date +%s%N)
+    echo "$w: $count instructions, $(grep -c '^ ' "$WORK/$w.c") lines of C compiled in $(( (end - start) / 1000000 )) ms"
+
+    for engine in interp jit aot; do
+        if [ $engine = aot ]; then set -- "$WORK/$w-aot"; else set -- "$WORK/$engine" "$WORK/$w.asm"; fi
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            "$WORK/measure" "$WORK/$w.txt" "$WORK/out" "$@"
+            i=$((i + 1))
+        done | sort -g | awk -v n="$RUNS" -v c="$count" -v e=$engine 'NR == int((n + 1) / 2) {
+            printf "  %-6s %9.1f M instr/s (median of %d)\n", e, c / $1 / 1e6, n
+        }'
+    done
+done
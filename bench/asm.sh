@@ -0,0 +1,55 @@
+#!/bin/sh
+# Assembler throughput: generate a commented, label-heavy source of about
+# [source KB] (forward and backward jumps, IMM8 and IMM16 operands) and
+# time `--assemble` on it, load and verify included. Reports ms and MB/s.
+# The default stays under the 64 KB a ROM can hold.
+#
+# usage: bench/asm.sh [runs] [source KB]
+
+set -e
+
+RUNS=${1:-3}
+KB=${2:-1024}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/simple-cpu" "$ROOT"/with-safety/*.c
+
+# blocks of ~17 bytes of code in ~450 bytes of source until KB is reached
+awk -v bytes=$((KB * 1024)) 'BEGIN {
+    n = 0
+    total = 0
+    while (total < bytes) {
+        s = sprintf("; ------------------------------------------------------------\n")
+        s = s sprintf("; block %d: bump the counter and leave when it reaches the limit\n", n)
+        s = s sprintf("; ------------------------------------------------------------\n")
+        s = s sprintf("block_%d:\n", n)
+        s = s sprintf("    LOAD A, [0x%04X]      ; fetch this block'"'"'s counter\n", 4096 + n % 1024)
+        s = s sprintf("    ADD A, %d             ; small step, IMM8\n", n % 200 + 1)
+        s = s sprintf("    SUB B, %d           ; large step, IMM16\n", 1000 + n % 9000)
+        s = s sprintf("    STORE A, [0x%04X]     ; and put it back\n", 4096 + n % 1024)
+        s = s sprintf("    CMP A, %d            ; limit\n", 100 + n % 100)
+        s = s sprintf("    JZ block_%d          ; forward: resolved by backpatching\n", n + 1)
+        if (n > 0)
+            s = s sprintf("    JNZ block_%d         ; backward: already known\n", n - 1)
+        printf "%s", s
+        total += length(s)
+        n++
+    }
+    printf "block_%d:\n    HALT\n", n
+}' > "$WORK/big.asm"
+
+SIZE=$(wc -c < "$WORK/big.asm")
+i=0
+while [ $i -lt "$RUNS" ]; do
+    "$WORK/simple-cpu" --assemble "$WORK/big.rom" "$WORK/big.asm" 2>&1 \
+        | awk -v size="$SIZE" '/^assembled/ {
+            printf "asm: %.2f MB source, %d bytes of code: %.3f ms (%.0f MB/s)\n",
+                size / 1048576, $2, $5, size / 1048576 / ($5 / 1000)
+        }'
+    i=$((i + 1))
+done
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Batch mode scaling: run the same manifest of small jobs through
+# `--batch -j N` for N = 1 up to the number of CPUs (or [max threads])
+# and report jobs/second for each. The jobs share 4 ROMs and each reads
+# its loop count from its own input file.
+#
+# usage: bench/batch.sh [runs] [jobs] [max threads]
+
+set -e
+
+RUNS=${1:-3}
+JOBS=${2:-400}
+MAX=${3:-$(getconf _NPROCESSORS_ONLN)}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/simple-cpu" "$ROOT"/with-safety/*.c
+
+# 0000: IN_DECIMAL          30         ; A = loop count
+# 0001: PRINT_DECIMAL       2E
+# 0002: STORE A, [0x1000]   28 00 10
+# 0005: MOV A, 1            1D 01 00   ; outer:
+# 0008: INC A               08         ; inner:
+# 0009: CMP A, 0            21 00 00
+# 000C: JNZ inner           23 08 00
+# 000F: LOAD A, [0x1000]    24 00 10
+# 0012: DEC A               0C
+# 0013: STORE A, [0x1000]   28 00 10
+# 0016: CMP A, 0            21 00 00
+# 0019: JNZ outer           23 05 00
+# 001C: MOV A, '\n'         10 0A
+# 001E: PRINT_ASCII         2C
+# 001F: HALT                FF
+for r in 0 1 2 3; do
+    echo "30 2E 280010 1D0100 08 210000 230800 240010 0C 280010 210000 230500 100A 2C FF" \
+        | xxd -r -p > "$WORK/job$r.rom"
+done
+
+i=0
+while [ $i -lt "$JOBS" ]; do
+    echo $((i % 4 + 5)) > "$WORK/in$i.txt"
+    echo "$WORK/job$((i % 4)).rom $WORK/in$i.txt" >> "$WORK/manifest.txt"
+    i=$((i + 1))
+done
+
+j=1
+while [ $j -le "$MAX" ]; do
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$WORK/simple-cpu" --batch "$WORK/manifest.txt" -j $j 2>&1 >/dev/null
+        i=$((i + 1))
+    done
+    if [ $j -lt "$MAX" ] && [ $((j * 2)) -gt "$MAX" ]; then
+        j=$MAX
+    else
+        j=$((j * 2))
+    fi
+done
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Compare switch dispatch, threaded dispatch and threaded dispatch with the
+# x86-64 JIT in with-safety/.
+# Reports instructions/second for the countdown test program and for a
+# long register/RAM loop (~83M instructions).
+#
+# usage: bench/dispatch.sh [runs]
+
+set -e
+
+RUNS=${1:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/threaded" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_STATS -DNO_THREADED_DISPATCH -o "$WORK/switch" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_STATS -DVM_JIT -o "$WORK/jit" "$ROOT"/with-safety/*.c
+
+# hex column of the listing in test_program.txt
+sed -n 's/^\(\([0-9A-F][0-9A-F] \)\{1,\}\).*/\1/p' "$ROOT/test_program.txt" \
+    | xxd -r -p > "$WORK/countdown.rom"
+
+# 0000: MOV A, 255          10 FF
+# 0002: STORE A, [0x1000]   28 00 10
+# 0005: MOV A, 1            1D 01 00   ; outer:
+# 0008: INC A               08         ; inner:
+# 0009: ADD B, 3            01 03
+# 000B: DEC C               0E
+# 000C: CMP A, 0            21 00 00
+# 000F: JNZ inner           23 08 00
+# 0012: LOAD A, [0x1000]    24 00 10
+# 0015: DEC A               0C
+# 0016: STORE A, [0x1000]   28 00 10
+# 0019: CMP A, 0            21 00 00
+# 001C: JNZ outer           23 05 00
+# 001F: HALT                FF
+echo "10FF 280010 1D0100 08 0103 0E 210000 230800 240010 0C 280010 210000 230500 FF" \
+    | xxd -r -p > "$WORK/long_loop.rom"
+
+for rom in countdown long_loop; do
+    for engine in switch threaded jit; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            "$WORK/$engine" "$WORK/$rom.rom" 2>&1 >/dev/null \
+                | sed -n "s/^/$rom: /p"
+            i=$((i + 1))
+        done
+    done
+done
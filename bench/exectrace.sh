@@ -0,0 +1,52 @@
+#!/bin/sh
+# Execution trace overhead: every bench/roms.sh workload untraced, in
+# the default build and in the plain interpreter (-DNO_FUSION
+# -DNO_LOOP_IDIOMS, without superinstructions or loop idioms), and with
+# --exec-trace. Wall time, so the writer thread's work counts, and
+# on one CPU it shares the core with the interpreter. Reports the traced
+# time against the plain one, the trace size per instruction, and checks
+# that --dump-trace can seek into the middle of each trace.
+#
+# usage: bench/exectrace.sh [runs]
+
+set -e
+
+RUNS=${1:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/default" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_STATS -DNO_FUSION -DNO_LOOP_IDIOMS -o "$WORK/plain" "$ROOT"/with-safety/*.c
+WORKLOADS=$("$ROOT"/bench/roms.sh "$WORK")
+
+# milliseconds for one run of "$@", stdin from the workload's input
+wall() {
+    start=$(date +%s%N)
+    "$@" < "$input" > /dev/null 2> "$WORK/stats"
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+for w in $WORKLOADS; do
+    input=/dev/null
+    [ -f "$WORK/$w.txt" ] && input="$WORK/$w.txt"
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        default=$(wall "$WORK/default" "$WORK/$w.asm")
+        plain=$(wall "$WORK/plain" "$WORK/$w.asm")
+        traced=$(wall "$WORK/default" --exec-trace "$WORK/$w.xt" "$WORK/$w.asm")
+        n=$(sed -n 's/^.*dispatch[^:]*: \([0-9]*\) instructions.*$/\1/p' "$WORK/stats")
+        size=$(wc -c < "$WORK/$w.xt")
+        echo "$w: $n instructions; untraced $default ms, plain $plain ms, traced $traced ms" \
+            "($(echo "$traced $plain" | awk '{ printf "%.2f", $1 / ($2 ? $2 : 1) }')x plain);" \
+            "trace $size bytes, $(echo "$size $n" | awk '{ printf "%.4f", $1 / $2 }') bytes/instr"
+        i=$((i + 1))
+    done
+    mid=$((n / 2))
+    "$WORK/default" --dump-trace "$WORK/$w.xt" --seek $mid --count 1 > "$WORK/dump"
+    grep -q "^ *$mid  " "$WORK/dump" || { echo "$w: --dump-trace --seek $mid failed"; cat "$WORK/dump"; exit 1; }
+done
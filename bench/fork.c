@@ -0,0 +1,97 @@
+/*
+ * Fan-out memory cost: warm up one vm until all 16 pages of its RAM hold
+ * data, capture it, and start n forks that each run a short piece of work
+ * storing to one page, all kept alive. Reports memory per fork.
+ * `copy` mode dirties every page of each fork right after vm_fork(), which
+ * is what giving each instance its own 64 KB RAM costs.
+ *
+ * usage: fork cow|copy [forks]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../with-safety/vm.h"
+
+static const char source[] =
+    "    MOV A, 0x5A\n"
+    "    STORE A, [0x0000]\n    STORE A, [0x1000]\n    STORE A, [0x2000]\n"
+    "    STORE A, [0x3000]\n    STORE A, [0x4000]\n    STORE A, [0x5000]\n"
+    "    STORE A, [0x6000]\n    STORE A, [0x7000]\n    STORE A, [0x8000]\n"
+    "    STORE A, [0x9000]\n    STORE A, [0xA000]\n    STORE A, [0xB000]\n"
+    "    STORE A, [0xC000]\n    STORE A, [0xD000]\n    STORE A, [0xE000]\n"
+    "    STORE A, [0xF000]\n"
+    "work:                   ; 0x0032\n"
+    "    LOAD B, [0x8000]\n"
+    "    INC B\n"
+    "    STORE B, [0x8001]\n"
+    "    HALT\n";
+
+#define WORK_PC 0x32
+
+/*
+ * Proportional set size: a page mapped n times counts 1/n per mapping.
+ * Plain RSS would count a shared page once for every fork mapping it.
+ */
+static long pss_kb(void) {
+    char line[256];
+    long kb = 0;
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Pss: %ld kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || (strcmp(argv[1], "cow") != 0 && strcmp(argv[1], "copy") != 0)) {
+        fprintf(stderr, "usage: %s cow|copy [forks]\n", argv[0]);
+        return 2;
+    }
+    int copy = strcmp(argv[1], "copy") == 0;
+    long n = argc > 2 ? atol(argv[2]) : 10000;
+
+    vm* parent = vm_create();
+    if (!parent || vm_load_asm_source(parent, source, sizeof(source) - 1, 0, NULL, NULL) != VM_OK
+        || vm_set_breakpoint(parent, WORK_PC) != VM_OK || vm_run(parent, 0) != VM_BREAKPOINT) {
+        fprintf(stderr, "warm-up failed\n");
+        return 1;
+    }
+    vm_clear_breakpoint(parent);
+    vm_image* image = vm_capture(parent);
+    if (!image) {
+        perror("vm_capture");
+        return 1;
+    }
+
+    vm** forks = malloc(n * sizeof(*forks));
+    long before = pss_kb();
+    for (long i = 0; i < n; i++) {
+        forks[i] = vm_fork(image);
+        if (!forks[i]) {
+            fprintf(stderr, "vm_fork failed after %ld forks\n", i);
+            return 1;
+        }
+        if (copy) {
+            volatile uint8_t* ram = vm_ram(forks[i]);
+            for (size_t a = 0; a < RAM_SIZE; a += 4096) ram[a] = ram[a];
+        }
+        if (vm_run(forks[i], 0) != VM_HALTED || vm_ram(forks[i])[0x8001] != 0x5B) {
+            fprintf(stderr, "fork %ld went wrong\n", i);
+            return 1;
+        }
+    }
+    long after = pss_kb();
+
+    double per = (double)(after - before) / n;
+    printf("%s: %ld forks, %.1f KB each, %.0f instances/GB\n",
+           argv[1], n, per, 1024.0 * 1024.0 / per);
+
+    for (long i = 0; i < n; i++) vm_destroy(forks[i]);
+    free(forks);
+    vm_image_destroy(image);
+    vm_destroy(parent);
+    return 0;
+}
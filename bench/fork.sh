@@ -0,0 +1,28 @@
+#!/bin/sh
+# Fan-out: memory per instance when many vms start from one warmed-up
+# state. Forks from vm_capture() share the state's RAM pages copy-on-write;
+# copy mode gives every instance a private copy of all 64 KB instead.
+#
+# usage: bench/fork.sh [runs] [forks]
+
+set -e
+
+RUNS=${1:-3}
+N=${2:-10000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+# the library without its CLI
+$CC $CFLAGS -pthread -o "$WORK/fork" "$ROOT/bench/fork.c" \
+    $(ls "$ROOT"/with-safety/*.c | grep -v '/main\.c$')
+
+i=0
+while [ $i -lt "$RUNS" ]; do
+    "$WORK/fork" copy "$N"
+    "$WORK/fork" cow "$N"
+    i=$((i + 1))
+done
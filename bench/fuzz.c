@@ -0,0 +1,689 @@
+/*
+ * Differential fuzzing across the execution engines. A test case is a
+ * byte string, as libFuzzer hands it over, decoded into a ROM and up to
+ * FUZZ_STREAMS input streams: mostly real instructions with jumps to
+ * instruction boundaries, counting loops and IN/PRINT, now and then a
+ * raw byte or a jump anywhere. Every stream runs capped at the same
+ * instruction count on the baseline interpreter (bench/baseline.c, the
+ * first commit's main.c) and then, whole and in random slices, on every
+ * engine of the library, the plain switch with no fusion and no loop
+ * idioms included. The status, registers, Z, PC, instruction count, a hash
+ * of RAM and the bytes printed have to match exactly. Streams that stop
+ * under the cap also run as lockstep lanes (no RAM to compare there),
+ * and with -a, ahead of time through the host compiler, where only the
+ * output and the exit status are seen.
+ *
+ * This file is both halves. Built with -DFUZZ_ENGINE it runs cases on
+ * the engine it is linked with; bench/fuzz.sh compiles that with the
+ * library once per engine, each with its own flags, and with
+ * bench/baseline.c and -DFUZZ_BASELINE once more, then renames every
+ * global symbol of each result to <engine>_<symbol>, so all of them link
+ * into the one driver built from the rest of this file.
+ *
+ * usage: fuzz [-n cases] [-s seed] [-c cap] [-a every] [case files]
+ *
+ * Without files it runs random cases and writes each one that differs to
+ * fuzz-crash-<seed>-<case>; with files it runs those. Built with
+ * -DFUZZ_LIBFUZZER (and -fsanitize=fuzzer) main() is left to libFuzzer,
+ * and a difference aborts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "../with-safety/vm.h"
+
+#define FUZZ_STREAMS 4      // input streams per case, so lockstep has lanes to split
+#define FUZZ_INPUT 64       // bytes per stream at most
+#define FUZZ_INSTRUCTIONS 1024
+#define FUZZ_CAP 10000      // default instructions per stream
+#define FUZZ_SLICE 400      // the longest random slice
+
+typedef struct {
+    uint8_t rom[ROM_MAX_SIZE];
+    size_t size;     // image bytes
+    size_t rom_size; // 0: the loader's default, padded to ROM_DEFAULT_SIZE
+    uint8_t input[FUZZ_STREAMS][FUZZ_INPUT];
+    size_t input_size[FUZZ_STREAMS];
+    size_t streams;
+    uint64_t cap;
+    uint64_t seed; // slice sizes
+} fuzz_case;
+
+typedef struct {
+    vm_status status;
+    cpu_state cpu;
+    uint64_t instructions;
+    uint64_t ram;      // hash of all of RAM
+    uint64_t out;      // hash of the bytes printed
+    uint64_t out_size; // and how many
+} fuzz_result;
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t fnv(uint64_t h, uint8_t byte) {
+    return (h ^ byte) * FNV_PRIME;
+}
+
+static uint64_t next(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s >> 32;
+}
+
+// the engine half, each symbol renamed by bench/fuzz.sh
+vm_status fuzz_load(const fuzz_case* c);
+void fuzz_run(const fuzz_case* c, size_t stream, bool sliced, fuzz_result* r);
+bool fuzz_lockstep(const fuzz_case* c, fuzz_result* r);
+bool fuzz_compile(FILE* out);
+
+// a word at a time; RAM is hashed after every run of every engine
+static inline uint64_t ram_hash(const uint8_t* ram) {
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < RAM_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, ram + i, 8);
+        h = (h ^ word) * FNV_PRIME;
+    }
+    return h;
+}
+
+#if defined(FUZZ_ENGINE) && defined(FUZZ_BASELINE)
+
+#include <unistd.h>
+
+/*
+ * The engine half for bench/baseline.c: baseline_main() on the ROM
+ * written to a file, with stdin, stdout and stderr swapped for the
+ * stream. Its status comes from how it returned. It cannot pause, so
+ * it is only ever run whole. Off the end of ROM it is put in the
+ * library's terms: PC is the end of ROM however far a jump went, and
+ * getting there counts as an instruction, the OP_END entry's.
+ */
+typedef struct {
+    uint16_t A, B, C, D;
+    size_t PC;
+    bool Z;
+} baseline_cpu; // cpu_state in bench/baseline.c
+
+extern uint8_t rom[];
+extern uint8_t ram[];
+extern baseline_cpu cpu;
+extern size_t rom_size;
+extern uint64_t cap, instructions;
+int baseline_main(int argc, char** argv);
+
+static int rom_fd = -1;
+static char rom_path[32];
+
+// an unlinked file, so nothing is left behind
+vm_status fuzz_load(const fuzz_case* c) {
+    if (rom_fd < 0) {
+        char path[] = "/tmp/fuzz-baseline-XXXXXX";
+        if ((rom_fd = mkstemp(path)) < 0) return VM_ERR_OPEN;
+        unlink(path);
+        snprintf(rom_path, sizeof(rom_path), "/proc/self/fd/%d", rom_fd);
+    }
+    if (ftruncate(rom_fd, 0) != 0 || pwrite(rom_fd, c->rom, c->size, 0) != (ssize_t)c->size) return VM_ERR_OPEN;
+    rom_size = c->rom_size ? c->rom_size : ROM_DEFAULT_SIZE;
+    return VM_OK;
+}
+
+void fuzz_run(const fuzz_case* c, size_t s, bool sliced, fuzz_result* r) {
+    FILE* saved_in = stdin;
+    FILE* saved_out = stdout;
+    FILE* saved_err = stderr;
+    char* out = NULL;
+    char* err = NULL;
+    size_t out_size = 0, err_size = 0;
+    char* argv[] = { "baseline", rom_path, NULL };
+
+    (void)sliced;
+    stdin = c->input_size[s] ? fmemopen((void*)c->input[s], c->input_size[s], "r") : fopen("/dev/null", "r");
+    stdout = open_memstream(&out, &out_size);
+    stderr = open_memstream(&err, &err_size);
+    if (!stdin || !stdout || !stderr) abort();
+    memset(ram, 0, RAM_SIZE);
+    cap = c->cap;
+    instructions = 0;
+    int exit_status = baseline_main(2, argv);
+    fclose(stdin);
+    fclose(stdout);
+    fclose(stderr);
+    stdin = saved_in;
+    stdout = saved_out;
+    stderr = saved_err;
+
+    // "Loaded n bytes" comes first and is not the program's
+    const char* printed = memchr(out, '\n', out_size);
+    size_t from = printed ? (size_t)(printed + 1 - out) : out_size;
+    if (exit_status == -1) r->status = VM_STEP_LIMIT;
+    else if (exit_status == EXIT_SUCCESS) r->status = cpu.PC < rom_size ? VM_HALTED : VM_END_OF_ROM;
+    else if (err_size) r->status = VM_ERR_TRUNCATED;
+    else {
+        // and "Unknown opcode" last
+        r->status = VM_ERR_UNKNOWN_OPCODE;
+        int n = snprintf(NULL, 0, "Unknown opcode: 0x%02X at PC=%zu\n", rom[cpu.PC], cpu.PC);
+        if (n > 0 && (size_t)n <= out_size - from) out_size -= (size_t)n;
+    }
+    r->cpu = (cpu_state){ .A = cpu.A, .B = cpu.B, .C = cpu.C, .D = cpu.D, .PC = (uint32_t)cpu.PC, .Z = cpu.Z };
+    r->instructions = instructions;
+    if (r->status == VM_END_OF_ROM) {
+        r->cpu.PC = (uint32_t)rom_size;
+        r->instructions++;
+    }
+    r->ram = ram_hash(ram);
+    r->out = FNV_OFFSET;
+    r->out_size = out_size - from;
+    for (size_t i = from; i < out_size; i++) r->out = fnv(r->out, (uint8_t)out[i]);
+    free(out);
+    free(err);
+}
+
+const char* vm_engine(void) {
+    return "first commit's main.c";
+}
+
+#elif defined(FUZZ_ENGINE)
+
+#include "../with-safety/aot.h"
+#include "../with-safety/input.h"
+#include "../with-safety/lockstep.h"
+
+static vm* m;         // reloaded for every case
+static lockstep* ls;
+
+typedef struct {
+    in_reader in;
+    fuzz_result* r;
+} stream_io;
+
+static void put(fuzz_result* r, uint8_t c) {
+    r->out = fnv(r->out, c);
+    r->out_size++;
+}
+
+// the same bytes as output.c
+static void print_ascii(void* ctx, uint8_t c) {
+    put(((stream_io*)ctx)->r, c);
+}
+
+static void print_decimal(void* ctx, uint16_t value) {
+    char digits[5];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) put(((stream_io*)ctx)->r, digits[--n]);
+}
+
+static void print_bits(void* ctx, uint8_t value) {
+    for (int i = 7; i >= 0; i--) put(((stream_io*)ctx)->r, (value >> i) & 1 ? '1' : '0');
+    put(((stream_io*)ctx)->r, '\n');
+}
+
+static uint8_t read_byte(void* ctx) {
+    return (uint8_t)in_read_byte(&((stream_io*)ctx)->in);
+}
+
+static uint8_t read_decimal(void* ctx) {
+    return (uint8_t)in_read_decimal(&((stream_io*)ctx)->in);
+}
+
+static uint8_t read_binary(void* ctx) {
+    return (uint8_t)in_read_binary(&((stream_io*)ctx)->in);
+}
+
+// stream s of c, from memory, its output into r
+static vm_io stream_callbacks(const fuzz_case* c, size_t s, stream_io* io, fuzz_result* r) {
+    io->in = (in_reader){ .cur = c->input[s], .end = c->input[s] + c->input_size[s], .fd = -1, .at_eof = true };
+    io->r = r;
+    r->out = FNV_OFFSET;
+    r->out_size = 0;
+    vm_io callbacks = {
+        io, print_ascii, print_decimal, print_bits,
+        read_byte, read_decimal, read_binary, NULL,
+    };
+    return callbacks;
+}
+
+vm_status fuzz_load(const fuzz_case* c) {
+    if (!m && !(m = vm_create())) return VM_ERR_NO_MEMORY;
+    return vm_load_image(m, c->rom, c->size, c->rom_size, NULL);
+}
+
+// stream s of the case fuzz_load() loaded, from reset, in one vm_run() or in slices
+void fuzz_run(const fuzz_case* c, size_t s, bool sliced, fuzz_result* r) {
+    stream_io io;
+    vm_io callbacks = stream_callbacks(c, s, &io, r);
+    uint64_t slicing = c->seed;
+
+    vm_reset(m);
+    vm_set_io(m, &callbacks);
+    if (!sliced) r->status = vm_run(m, c->cap);
+    else {
+        do {
+            uint64_t left = c->cap - vm_instructions(m), slice = 1 + next(&slicing) % FUZZ_SLICE;
+            r->status = vm_run(m, slice < left ? slice : left);
+        } while (r->status == VM_STEP_LIMIT && vm_instructions(m) < c->cap);
+    }
+    r->cpu = *vm_cpu(m);
+    r->instructions = vm_instructions(m);
+    r->ram = ram_hash(vm_ram(m));
+}
+
+// every stream as a lane; lockstep has no step limit, so only for cases that stop
+bool fuzz_lockstep(const fuzz_case* c, fuzz_result* r) {
+    stream_io io[FUZZ_STREAMS];
+    vm_io callbacks[FUZZ_STREAMS];
+
+    if (!ls && !(ls = lockstep_create())) return false;
+    for (size_t s = 0; s < c->streams; s++) callbacks[s] = stream_callbacks(c, s, &io[s], &r[s]);
+    lockstep_run(ls, m, c->streams, callbacks);
+    for (size_t s = 0; s < c->streams; s++) {
+        r[s].status = lockstep_status(ls, s);
+        r[s].cpu = lockstep_cpu(ls, s);
+        r[s].instructions = lockstep_instructions(ls, s);
+        r[s].ram = 0;
+    }
+    return true;
+}
+
+bool fuzz_compile(FILE* out) {
+    return aot_compile(m, "fuzz", out);
+}
+
+#else // the driver
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * The engines bench/fuzz.sh builds, by symbol prefix, and whether they
+ * can stop and go on, to run in slices too; the first is the reference.
+ * That is the baseline, except at -DVM_SAFETY=0, where operands cut off
+ * by the end of ROM read as zero, and 3, where bad jumps trap: there the
+ * library means to differ from it, and the plain switch is the
+ * reference. Lockstep and the ahead-of-time compiler run from the
+ * default build, whose decode they would get in use.
+ */
+#if defined(VM_SAFETY) && (VM_SAFETY == 0 || VM_SAFETY == 3)
+#define BASELINE
+#else
+#define BASELINE X(base, "baseline", false)
+#endif
+#define ENGINES                   \
+    BASELINE                      \
+    X(plain, "plain", true)       \
+    X(sw, "switch", true)         \
+    X(threaded, "threaded", true) \
+    X(compact, "compact", true)   \
+    X(jit, "jit", true)
+
+#define X(e, name, slices)                                                             \
+    vm_status e##_fuzz_load(const fuzz_case* c);                                       \
+    void e##_fuzz_run(const fuzz_case* c, size_t stream, bool sliced, fuzz_result* r); \
+    const char* e##_vm_engine(void);
+ENGINES
+#undef X
+bool threaded_fuzz_lockstep(const fuzz_case* c, fuzz_result* r);
+bool threaded_fuzz_compile(FILE* out);
+const char* plain_vm_status_string(vm_status status);
+
+typedef struct {
+    const char* name;
+    vm_status (*load)(const fuzz_case* c);
+    void (*run)(const fuzz_case* c, size_t stream, bool sliced, fuzz_result* r);
+    const char* (*engine)(void);
+    bool slices;
+    uint64_t instructions;
+    double seconds;
+} engine;
+
+static engine engines[] = {
+#define X(e, name, slices) { name, e##_fuzz_load, e##_fuzz_run, e##_vm_engine, slices, 0, 0 },
+    ENGINES
+#undef X
+};
+#define N_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+static uint64_t cap = FUZZ_CAP;
+static size_t aot_every; // 0: never
+static size_t cases, aot_cases, mismatches;
+static engine lockstep_engine = { "lockstep", NULL, NULL, NULL, false, 0, 0 };
+static char aot_dir[] = "/tmp/fuzz-aot-XXXXXX";
+
+static double now_seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// the case's bytes in order, zeros once they run out
+typedef struct {
+    const uint8_t* data;
+    size_t size, at;
+} reader;
+
+static uint8_t take(reader* r) {
+    return r->at < r->size ? r->data[r->at++] : 0;
+}
+
+static uint16_t take16(reader* r) {
+    uint16_t lo = take(r);
+    return lo | take(r) << 8;
+}
+
+// input bytes: mostly digits, bits and delimiters, for the IN forms to parse
+static uint8_t input_byte(uint8_t b) {
+    switch (b >> 6) {
+    case 0: return '0' + b % 10;
+    case 1: return '0' + (b & 1);
+    case 2: return "\n ,x"[b & 3];
+    default: return b;
+    } // switch end
+}
+
+// an IMM16 RAM address: one of a few cells, or anywhere
+static uint16_t address(reader* r) {
+    uint8_t b = take(r);
+    return b < 0xF0 ? 0x3000 + b % 16 : take16(r);
+}
+
+/*
+ * Header byte: streams and ROM sizing; two bytes of slice seed; each
+ * stream as a length and that many bytes; then instructions until the
+ * bytes run out. Jump targets are kept as instruction indices and laid
+ * out at the end; 0xFF picks a raw address instead, which may land in
+ * the middle of an instruction or outside ROM.
+ */
+static void decode(const uint8_t* data, size_t size, fuzz_case* c) {
+    reader r = { data, size, 0 };
+    uint32_t start[FUZZ_INSTRUCTIONS];
+    struct {
+        size_t at;
+        bool raw;
+        uint16_t target; // an address if raw, else an instruction index
+    } jumps[FUZZ_INSTRUCTIONS];
+    size_t n = 0, n_jumps = 0, at = 0;
+
+    uint8_t header = take(&r);
+    c->streams = 1 + (header & 3);
+    c->seed = (take16(&r) + 1) * 0x9E3779B97F4A7C15ull;
+    c->cap = cap;
+    for (size_t s = 0; s < c->streams; s++) {
+        c->input_size[s] = take(&r) % FUZZ_INPUT;
+        for (size_t i = 0; i < c->input_size[s]; i++) c->input[s][i] = input_byte(take(&r));
+    }
+
+    memset(c->rom, 0, sizeof(c->rom));
+    while (r.at < r.size && n < FUZZ_INSTRUCTIONS && at < ROM_MAX_SIZE - 16) {
+        uint8_t s = take(&r);
+        start[n++] = (uint32_t)at;
+        if (s < 200) {
+            uint8_t op = s % 0x32;
+            c->rom[at++] = op;
+            if (op <= 0x07 || (op >= 0x10 && op <= 0x13)) c->rom[at++] = take(&r); // IMM8
+            else if (op == 0x14 || op == 0x22 || op == 0x23) {                   // jumps
+                uint8_t b = take(&r);
+                jumps[n_jumps].at = at;
+                jumps[n_jumps].raw = b == 0xFF;
+                jumps[n_jumps++].target = b == 0xFF ? take16(&r) : b;
+                at += 2;
+            }
+            else if (op >= 0x15 && op <= 0x2B) { // IMM16
+                uint16_t imm;
+                if (op >= 0x24) imm = address(&r);
+                else if (op == 0x21) { // CMP: mostly against 0-3
+                    uint8_t b = take(&r);
+                    imm = b & 0x80 ? (uint16_t)(b | take(&r) << 8) : b & 3;
+                }
+                else imm = take16(&r);
+                c->rom[at++] = imm & 0xFF;
+                c->rom[at++] = imm >> 8;
+            }
+        }
+        else if (s < 220) { // close a counting loop: SUB A, step; CMP A, 0; JNZ back
+            uint16_t step = (s & 1) ? 1 : take16(&r);
+            uint8_t back = take(&r);
+            memcpy(c->rom + at, (uint8_t[]){ 0x19, step & 0xFF, step >> 8, 0x21, 0, 0, 0x23 }, 7);
+            at += 7;
+            jumps[n_jumps].at = at;
+            jumps[n_jumps].raw = false;
+            jumps[n_jumps++].target = (uint16_t)(back % n); // an earlier instruction
+            at += 2;
+        }
+        else if (s < 236) { // a small count to start one with
+            c->rom[at++] = 0x10;
+            c->rom[at++] = take(&r) % 32;
+        }
+        else if (s < 244) c->rom[at++] = 0xFF; // HALT
+        else c->rom[at++] = take(&r);          // any byte, an unknown opcode more often than not
+    }
+    for (size_t j = 0; j < n_jumps; j++) {
+        uint16_t target = jumps[j].raw ? jumps[j].target : (uint16_t)start[jumps[j].target % n];
+        c->rom[jumps[j].at] = target & 0xFF;
+        c->rom[jumps[j].at + 1] = target >> 8;
+    }
+    c->size = at ? at : 1;
+    // mostly a ROM that ends with the code, so running off it ends early; sometimes the padded default
+    c->rom_size = (header & 0x1C) ? c->size : 0;
+}
+
+static size_t differ(const char* engine, const char* how, size_t s, const fuzz_result* want,
+                     const fuzz_result* got, bool ram) {
+    if (want->status == got->status && want->cpu.A == got->cpu.A && want->cpu.B == got->cpu.B
+        && want->cpu.C == got->cpu.C && want->cpu.D == got->cpu.D && want->cpu.PC == got->cpu.PC
+        && want->cpu.Z == got->cpu.Z && want->instructions == got->instructions
+        && (!ram || want->ram == got->ram) && want->out == got->out && want->out_size == got->out_size)
+        return 0;
+    const fuzz_result* r[2] = { want, got };
+    fprintf(stderr, "case %zu, stream %zu: %s %s differs from the %s\n", cases, s, engine, how, engines[0].name);
+    for (int i = 0; i < 2; i++) {
+        fprintf(stderr, "  %-9s %s A=%04X B=%04X C=%04X D=%04X Z=%d PC=%u n=%llu ram=%016llx out=%llu bytes %016llx\n",
+                i ? engine : engines[0].name, plain_vm_status_string(r[i]->status), r[i]->cpu.A, r[i]->cpu.B,
+                r[i]->cpu.C, r[i]->cpu.D, r[i]->cpu.Z, r[i]->cpu.PC, (unsigned long long)r[i]->instructions,
+                (unsigned long long)r[i]->ram, (unsigned long long)r[i]->out_size, (unsigned long long)r[i]->out);
+    }
+    return 1;
+}
+
+static bool stopped(vm_status status) {
+    return status == VM_HALTED || status == VM_END_OF_ROM;
+}
+
+/*
+ * Build the case with the host compiler and run each stream through it;
+ * the program prints what the interpreter would, and exits with success
+ * where it halts or runs off the end of ROM.
+ */
+static size_t aot_check(const fuzz_case* c, const fuzz_result* want) {
+    char path[64], command[256];
+    size_t bad = 0;
+
+    snprintf(path, sizeof(path), "%s/fuzz.c", aot_dir);
+    FILE* f = fopen(path, "w");
+    if (!f || !threaded_fuzz_compile(f)) {
+        if (f) fclose(f);
+        return 0;
+    }
+    fclose(f);
+    const char* cc = getenv("CC");
+    snprintf(command, sizeof(command), "%s -O1 -w -o %s/fuzz %s/fuzz.c", cc ? cc : "cc", aot_dir, aot_dir);
+    if (system(command) != 0) {
+        fprintf(stderr, "case %zu: the generated C did not build\n", cases);
+        return 1;
+    }
+    aot_cases++;
+    for (size_t s = 0; s < c->streams; s++) {
+        snprintf(path, sizeof(path), "%s/in", aot_dir);
+        f = fopen(path, "wb");
+        if (!f) return bad;
+        fwrite(c->input[s], 1, c->input_size[s], f);
+        fclose(f);
+        snprintf(command, sizeof(command), "%s/fuzz < %s/in > %s/out", aot_dir, aot_dir, aot_dir);
+        int status = system(command);
+        snprintf(path, sizeof(path), "%s/out", aot_dir);
+        f = fopen(path, "rb");
+        if (!f) return bad;
+        fuzz_result got = want[s];
+        got.out = FNV_OFFSET;
+        got.out_size = 0;
+        for (int b; (b = getc(f)) != EOF; got.out_size++) got.out = fnv(got.out, (uint8_t)b);
+        fclose(f);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) got.status = VM_ERR_UNKNOWN_OPCODE;
+        bad += differ("aot", "program", s, &want[s], &got, false);
+    }
+    return bad;
+}
+
+// run one case everywhere; the number of runs that differ from the reference
+static size_t check(const uint8_t* data, size_t size) {
+    static fuzz_case c;
+    fuzz_result want[FUZZ_STREAMS], got[FUZZ_STREAMS];
+    vm_status loaded = VM_OK;
+    size_t bad = 0;
+
+    decode(data, size, &c);
+    cases++;
+    for (size_t e = 0; e < N_ENGINES; e++) {
+        engine* en = &engines[e];
+        vm_status status = en->load(&c);
+        if (e == 0) loaded = status;
+        else if (status != loaded) {
+            fprintf(stderr, "case %zu: %s loads with %s, the %s with %s\n", cases, en->name,
+                    plain_vm_status_string(status), engines[0].name, plain_vm_status_string(loaded));
+            bad++;
+        }
+        if (status != VM_OK) continue;
+        for (size_t s = 0; s < c.streams; s++) {
+            for (int sliced = 0; sliced < (en->slices ? 2 : 1); sliced++) {
+                fuzz_result* r = e == 0 && !sliced ? &want[s] : &got[s];
+                double start = now_seconds();
+                en->run(&c, s, sliced, r);
+                en->seconds += now_seconds() - start;
+                en->instructions += r->instructions;
+                if (r != &want[s]) bad += differ(en->name, sliced ? "in slices" : "whole", s, &want[s], r, true);
+            }
+        }
+    }
+    if (loaded != VM_OK) return bad;
+
+    bool all_stop = true;
+    for (size_t s = 0; s < c.streams; s++) all_stop &= want[s].status != VM_STEP_LIMIT;
+    if (all_stop && threaded_fuzz_load(&c) == VM_OK) {
+        double start = now_seconds();
+        if (threaded_fuzz_lockstep(&c, got)) {
+            lockstep_engine.seconds += now_seconds() - start;
+            for (size_t s = 0; s < c.streams; s++) {
+                lockstep_engine.instructions += got[s].instructions;
+                bad += differ("lockstep", "lane", s, &want[s], &got[s], false);
+            }
+        }
+    }
+    bool all_halt = true;
+    for (size_t s = 0; s < c.streams; s++) all_halt &= stopped(want[s].status);
+    if (aot_every && all_halt && cases % aot_every == 0 && threaded_fuzz_load(&c) == VM_OK) bad += aot_check(&c, want);
+    return bad;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (check(data, size)) abort(); // for libFuzzer to keep the case
+    return 0;
+}
+
+static void report(size_t n, double seconds) {
+    fprintf(stderr, "#%zu\texec/s: %.0f\tmismatches: %zu\n", n, n / seconds, mismatches);
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+// a case file's bytes; NULL if it cannot be read
+static uint8_t* read_case(const char* path, size_t* size) {
+    static uint8_t data[1 << 16];
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    *size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = 10000, files = 0;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0) n = strtoull(argv[++i], NULL, 0);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) seed = strtoull(argv[++i], NULL, 0);
+        else if (i + 1 < argc && strcmp(argv[i], "-c") == 0) cap = strtoull(argv[++i], NULL, 0);
+        else if (i + 1 < argc && strcmp(argv[i], "-a") == 0) aot_every = strtoull(argv[++i], NULL, 0);
+        else argv[++files] = argv[i];
+    }
+    if (cap == 0) cap = 1;
+    if (aot_every && !mkdtemp(aot_dir)) {
+        perror("fuzz: aot directory");
+        return 1;
+    }
+
+    double start = now_seconds();
+    if (files) {
+        for (size_t i = 1; i <= files; i++) {
+            size_t size;
+            const uint8_t* data = read_case(argv[i], &size);
+            if (!data) {
+                perror(argv[i]);
+                return 1;
+            }
+            mismatches += check(data, size);
+        }
+        n = files;
+    }
+    else {
+        uint64_t s = seed * 0x9E3779B97F4A7C15ull | 1;
+        static uint8_t data[2048];
+        for (size_t i = 1; i <= n; i++) {
+            size_t size = 16 + next(&s) % (sizeof(data) - 16);
+            for (size_t b = 0; b < size; b++) data[b] = (uint8_t)next(&s);
+            size_t bad = check(data, size);
+            if (bad) {
+                char path[64];
+                snprintf(path, sizeof(path), "fuzz-crash-%llu-%zu", (unsigned long long)seed, i);
+                FILE* f = fopen(path, "wb");
+                if (f) {
+                    fwrite(data, 1, size, f);
+                    fclose(f);
+                    fprintf(stderr, "case %zu written to %s\n", i, path);
+                }
+                mismatches += bad;
+            }
+            if ((i & (i - 1)) == 0 && i >= 1024) report(i, now_seconds() - start);
+        }
+    }
+    double seconds = now_seconds() - start;
+    if (aot_every) {
+        char command[64];
+        snprintf(command, sizeof(command), "rm -rf %s", aot_dir);
+        if (system(command) != 0) perror("fuzz: aot directory");
+    }
+
+    report(n, seconds);
+    for (size_t e = 0; e < N_ENGINES; e++) {
+        printf("%-10s %-26s %9.1f M instr/s\n", engines[e].name, engines[e].engine(),
+               engines[e].instructions / engines[e].seconds / 1e6);
+    }
+    if (lockstep_engine.seconds > 0)
+        printf("%-10s %-26s %9.1f M instr/s\n", "lockstep", "lanes of the default build",
+               lockstep_engine.instructions / lockstep_engine.seconds / 1e6);
+    if (aot_every) printf("%-10s %zu cases compiled\n", "aot", aot_cases);
+    printf("%zu cases in %.3f s: %.0f exec/s, %zu mismatches\n", n, seconds, n / seconds, mismatches);
+    return mismatches != 0;
+}
+
+#endif
+#endif
@@ -0,0 +1,84 @@
+#!/bin/sh
+# Differential fuzzing of every engine against the baseline interpreter,
+# the first commit's main.c kept in bench/baseline.c, or against the plain
+# switch at the safety levels that mean to differ from it (bench/fuzz.c).
+# Each engine is compiled from the library with its own flags, the
+# baseline from that file alone, and each is merged into one object with
+# `ld -r` and has every global symbol prefixed with its name, so all of
+# them link into one driver and run every case side by side. Prints
+# exec/s and each engine's M instr/s, exits 1 on any difference, and
+# appends one CSV line per run to [results file] (default: fuzz.csv at
+# the repo root, which git ignores, wherever the script is run from):
+#
+#   date,commit,cases,cap,seconds,execs_per_s,mismatches
+#
+# usage: bench/fuzz.sh [cases] [seed] [results file]
+#        bench/fuzz.sh fuzz-crash-...      (run saved cases again)
+#        CFLAGS="-O2 -DVM_SAFETY=3" bench/fuzz.sh   (every engine at another level)
+#        AOT=50 bench/fuzz.sh      (also compile every 50th case ahead of time)
+#        CAP=100000 bench/fuzz.sh  (instructions per input stream)
+#        CC=clang FUZZER=1 bench/fuzz.sh [libFuzzer options]   (coverage-guided)
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+LIB=$(ls "$ROOT"/with-safety/*.c | grep -v '/main\.c$')
+ENGINE_CFLAGS=
+DRIVER_CFLAGS=
+if [ "${FUZZER:-0}" = 1 ]; then
+    ENGINE_CFLAGS=-fsanitize=fuzzer-no-link
+    DRIVER_CFLAGS="-fsanitize=fuzzer -DFUZZ_LIBFUZZER"
+fi
+
+# the prefixes bench/fuzz.c's ENGINES list, and the sources and flags of each
+for engine in base plain sw threaded compact jit; do
+    srcs=$LIB
+    case $engine in
+    base) srcs="$ROOT/bench/baseline.c" flags=-DFUZZ_BASELINE ;;
+    plain) flags="-DNO_THREADED_DISPATCH -DNO_FUSION -DNO_LOOP_IDIOMS" ;;
+    sw) flags=-DNO_THREADED_DISPATCH ;;
+    threaded) flags= ;;
+    compact) flags=-DCOMPACT_HANDLERS ;;
+    jit) flags=-DVM_JIT ;;
+    esac
+    mkdir "$WORK/$engine"
+    for src in $srcs "$ROOT/bench/fuzz.c"; do
+        $CC $CFLAGS $ENGINE_CFLAGS $flags -pthread -DFUZZ_ENGINE -c \
+            -o "$WORK/$engine/$(basename "$src" .c).o" "$src"
+    done
+    ld -r -o "$WORK/$engine.o" "$WORK/$engine"/*.o
+    nm -g --defined-only "$WORK/$engine.o" | awk -v p="$engine" '{ print $3, p "_" $3 }' > "$WORK/$engine.syms"
+    objcopy --redefine-syms="$WORK/$engine.syms" "$WORK/$engine.o"
+done
+$CC $CFLAGS $DRIVER_CFLAGS -pthread -o "$WORK/fuzz" "$ROOT/bench/fuzz.c" "$WORK"/*.o
+
+CAP=${CAP:-10000}
+if [ "${FUZZER:-0}" = 1 ]; then
+    "$WORK/fuzz" "$@"
+    exit
+fi
+if [ -f "${1:-}" ]; then # saved cases, run again
+    "$WORK/fuzz" -c "$CAP" "$@"
+    exit
+fi
+
+CASES=${1:-10000}
+SEED=${2:-1}
+RESULTS=${3:-$ROOT/fuzz.csv}
+
+status=0
+"$WORK/fuzz" -n "$CASES" -s "$SEED" -c "$CAP" -a "${AOT:-0}" > "$WORK/summary" || status=$?
+cat "$WORK/summary"
+
+COMMIT=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+[ -s "$RESULTS" ] || echo "date,commit,cases,cap,seconds,execs_per_s,mismatches" > "$RESULTS"
+awk -v d="$DATE" -v c="$COMMIT" -v cap="$CAP" -v OFS=, '/ exec\/s, / {
+    print d, c, $1, cap, $4, $6, $8
+}' "$WORK/summary" >> "$RESULTS"
+exit $status
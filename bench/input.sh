@@ -0,0 +1,57 @@
+#!/bin/sh
+# Compare the buffered input path (mmap for a regular file, block read()
+# for a pipe) with the stdio path (-DNO_INPUT_BUFFER) in with-safety/ on
+# input-bound ROMs that run IN, IN_DECIMAL or IN_BINARY until end of
+# input. Reports input throughput in MB/s.
+#
+# usage: bench/input.sh [runs] [input MB]
+
+set -e
+
+RUNS=${1:-3}
+MB=${2:-16}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -o "$WORK/buffered" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DNO_INPUT_BUFFER -o "$WORK/stdio" "$ROOT"/with-safety/*.c
+
+# 0000: IN                  ii         ; loop:
+# 0001: CMP A, 0            21 00 00
+# 0004: JNZ loop            23 00 00
+# 0007: HALT                FF
+# reads until end of input, which reads as 0; the inputs contain no 0
+read_loop() {
+    echo "$1 210000 230000 FF" | xxd -r -p
+}
+read_loop 2D > "$WORK/in.rom"
+read_loop 30 > "$WORK/in_decimal.rom"
+read_loop 31 > "$WORK/in_binary.rom"
+
+BYTES=$((MB * 1024 * 1024))
+yes abcdefghijklmnopqrstuvwxyz | head -c $BYTES > "$WORK/in.txt"
+yes 123 | head -c $BYTES > "$WORK/in_decimal.txt"
+yes 10110 | head -c $BYTES > "$WORK/in_binary.txt"
+
+run() {
+    start=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    echo "$ms ms, $(( BYTES * 1000 / (ms > 0 ? ms : 1) / 1048576 )) MB/s"
+}
+
+for rom in in in_decimal in_binary; do
+    for engine in stdio buffered; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            echo "$rom: $engine: file: $(run "$WORK/$engine" "$WORK/$rom.rom" < "$WORK/$rom.txt")"
+            echo "$rom: $engine: pipe: $(cat "$WORK/$rom.txt" | run "$WORK/$engine" "$WORK/$rom.rom")"
+            i=$((i + 1))
+        done
+    done
+done
@@ -0,0 +1,84 @@
+/*
+ * Host instructions per cycle of the interpreter: load a ROM, read the
+ * hardware counters around one vm_run() to the end, and report guest
+ * instructions, host instructions and cycles. Where perf_event_open()
+ * is not allowed (containers, VMs without a PMU) the TSC stands in for
+ * cycles and host instructions are reported as 0. One line on stderr:
+ *
+ *   guest_instructions host_instructions cycles pmu|tsc status
+ *
+ * usage: ipc rom|source.asm    (stdin and stdout are the program's)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../with-safety/vm.h"
+
+static int counter(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static uint64_t tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s rom\n", argv[0]);
+        return 2;
+    }
+    vm* m = vm_create();
+    size_t len = strlen(argv[1]);
+    bool source = len > 4 && strcmp(argv[1] + len - 4, ".asm") == 0;
+    vm_status status = !m ? VM_ERR_NO_MEMORY
+                     : source ? vm_load_asm(m, argv[1], 0, NULL, NULL)
+                     : vm_load(m, argv[1], 0, NULL);
+    if (status != VM_OK) {
+        fprintf(stderr, "%s: %s\n", argv[1], vm_status_string(status));
+        return 1;
+    }
+
+    int cycles = counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    int instructions = cycles >= 0 ? counter(PERF_COUNT_HW_INSTRUCTIONS, cycles) : -1;
+    bool pmu = cycles >= 0 && instructions >= 0;
+
+    uint64_t start = tsc();
+    if (pmu) ioctl(cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    status = vm_run(m, 0);
+    if (pmu) ioctl(cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t ticks = tsc() - start;
+
+    uint64_t host_cycles = ticks, host_instructions = 0;
+    if (pmu && (read(cycles, &host_cycles, 8) != 8 || read(instructions, &host_instructions, 8) != 8)) {
+        pmu = false;
+        host_cycles = ticks;
+        host_instructions = 0;
+    }
+    fprintf(stderr, "%llu %llu %llu %s %s\n", (unsigned long long)vm_instructions(m),
+            (unsigned long long)host_instructions, (unsigned long long)host_cycles,
+            pmu ? "pmu" : "tsc", vm_status_string(status));
+    vm_destroy(m);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Interpreter IPC before and after a change: build bench/ipc.c against
+# the working tree and against with-safety/ at [ref] (default HEAD), run
+# every bench/roms.sh workload on both, and report host cycles per guest
+# instruction, host IPC and the size of the dispatch loop. IPC
+# needs hardware counters (perf_event_open); without them the TSC is
+# used for cycles and IPC is shown as n/a.
+#
+# usage: bench/ipc.sh [runs] [ref]
+
+set -e
+
+RUNS=${1:-3}
+REF=${2:-HEAD}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+mkdir -p "$WORK/ref/bench"
+git -C "$ROOT" archive "$REF" with-safety | tar -x -C "$WORK/ref"
+cp "$ROOT/bench/ipc.c" "$WORK/ref/bench/"
+for tree in ref tree; do
+    src=$ROOT
+    [ $tree = ref ] && src=$WORK/ref
+    $CC $CFLAGS -pthread -o "$WORK/ipc-$tree" "$src/bench/ipc.c" \
+        $(ls "$src"/with-safety/*.c | grep -v '/main\.c$')
+done
+# the dispatch loop's code size, from the symbol table: interpret(), or
+# vm_run() in trees from before it was split out
+loop_size() {
+    printf '%d' "0x$(nm -S "$1" | awk '$4 == "interpret" { i = $2 } $4 == "vm_run" { v = $2 } END { print i ? i : v }')"
+}
+echo "dispatch loop: $(loop_size "$WORK/ipc-ref") bytes at $REF, $(loop_size "$WORK/ipc-tree") bytes in the working tree"
+
+for w in $("$ROOT"/bench/roms.sh "$WORK"); do
+    [ -f "$WORK/$w.txt" ] || : > "$WORK/$w.txt"
+    for tree in ref tree; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            "$WORK/ipc-$tree" "$WORK/$w.asm" < "$WORK/$w.txt" 2>&1 > /dev/null | awk -v w="$w" -v t="$tree" '{
+                ipc = $4 == "pmu" && $3 ? sprintf("%.2f", $2 / $3) : "n/a"
+                printf "%-14s %-5s %6.2f cycles/instr (%s), IPC %s\n", w, t, $3 / $1, $4, ipc
+            }'
+            i=$((i + 1))
+        done
+    done
+done
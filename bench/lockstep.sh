@@ -0,0 +1,92 @@
+#!/bin/sh
+# Lockstep vs scalar batch: run the same manifest through `--batch` and
+# `--batch --lockstep` on one thread and on [threads] (default: all CPUs)
+# and report jobs/s and aggregate guest instructions/s for each. Every
+# job runs one of two ROMs with its own loop count, so the lanes of a
+# group split at the loop exits and merge again after them.
+#
+# usage: bench/lockstep.sh [runs] [jobs] [threads]
+#        CFLAGS="-O2 -mavx2" bench/lockstep.sh   (wider vectors)
+
+set -e
+
+RUNS=${1:-3}
+JOBS=${2:-2000}
+THREADS=${3:-$(getconf _NPROCESSORS_ONLN)}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/simple-cpu" "$ROOT"/with-safety/*.c
+
+# counting: nested INC/CMP/JNZ loops around a counter in RAM
+cat > "$WORK/count.asm" <<'ASM'
+    IN_DECIMAL A
+    STORE A, [0x1000]
+outer:
+    MOV A, 0xFF00       ; 256 iterations
+inner:
+    INC A
+    CMP A, 0
+    JNZ inner
+    LOAD A, [0x1000]
+    DEC A
+    STORE A, [0x1000]
+    CMP A, 0
+    JNZ outer
+    PRINT_DECIMAL A
+    HALT
+ASM
+
+# arithmetic: running sums kept in RAM
+cat > "$WORK/mix.asm" <<'ASM'
+    IN_DECIMAL A
+    STORE A, [0x2000]
+outer:
+    MOV A, 0xFFC0       ; 64 iterations
+inner:
+    LOAD B, [0x10]
+    ADD B, 0x1234
+    STORE B, [0x10]
+    LOAD C, [0x11]
+    ADD C, 7
+    SUB C, 3
+    STORE C, [0x11]
+    MOV D, 0x0F0F
+    ADD D, 1
+    STORE D, [0x12]
+    INC A
+    CMP A, 0
+    JNZ inner
+    LOAD A, [0x2000]
+    DEC A
+    STORE A, [0x2000]
+    CMP A, 0
+    JNZ outer
+    LOAD A, [0x10]
+    PRINT_DECIMAL A
+    HALT
+ASM
+
+i=0
+while [ $i -lt "$JOBS" ]; do
+    echo $((i % 16 + 240)) > "$WORK/in$i.txt"
+    rom=count
+    [ $((i % 2)) -eq 1 ] && rom=mix
+    echo "$WORK/$rom.asm $WORK/in$i.txt" >> "$WORK/manifest.txt"
+    i=$((i + 1))
+done
+
+for j in 1 "$THREADS"; do
+    for mode in "" --lockstep; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            "$WORK/simple-cpu" --batch "$WORK/manifest.txt" -j "$j" $mode 2>&1 >/dev/null
+            i=$((i + 1))
+        done
+    done
+    if [ "$THREADS" -eq 1 ]; then break; fi
+done
@@ -0,0 +1,186 @@
+/*
+ * Counting loops, differentially: generates random ROMs made of loops
+ * whose bodies mix ALU, LOAD, STORE, CMP and PRINT instructions over A-D
+ * and a few RAM cells, closed by a JNZ, sometimes entered in the middle.
+ * Each ROM runs once straight through and once in random slices, both
+ * capped at the same instruction count, and one line with the status,
+ * registers, Z, PC, instruction count and hashes of RAM and output is
+ * printed for each run. bench/loops.sh builds this against the reference
+ * switch interpreter and against the loop idioms and compares the lines;
+ * the time per build goes to stderr.
+ *
+ * usage: loops [roms] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../with-safety/vm.h"
+
+#define CAP 2000000 // instructions per run; loops that never exit stop here
+#define CELLS 8     // RAM cells the loops work on, from 0x3000
+
+static uint64_t seed, slicing; // ROMs, and slice sizes
+
+static uint32_t next(uint64_t* s, uint32_t n) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return (uint32_t)(*s >> 32) % n;
+}
+
+static uint32_t rnd(uint32_t n) {
+    return next(&seed, n);
+}
+
+// FNV-1a of everything printed
+static uint64_t fnv(uint64_t h, const void* p, size_t n) {
+    for (size_t i = 0; i < n; i++) h = (h ^ ((const uint8_t*)p)[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static void hash_ascii(void* ctx, uint8_t c) {
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, "a", 1);
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, &c, 1);
+}
+
+static void hash_decimal(void* ctx, uint16_t value) {
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, "d", 1);
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, &value, 2);
+}
+
+static void hash_bits(void* ctx, uint8_t value) {
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, "b", 1);
+    *(uint64_t*)ctx = fnv(*(uint64_t*)ctx, &value, 1);
+}
+
+static uint8_t no_input(void* ctx) {
+    (void)ctx;
+    return 0;
+}
+
+static size_t emit(uint8_t* rom, size_t at, int n, int b0, int b1, int b2) {
+    rom[at] = (uint8_t)b0;
+    if (n > 1) rom[at + 1] = (uint8_t)b1;
+    if (n > 2) rom[at + 2] = (uint8_t)b2;
+    return at + n;
+}
+
+static size_t emit16(uint8_t* rom, size_t at, int op, unsigned v) {
+    return emit(rom, at, 3, op, v & 0xFF, v >> 8);
+}
+
+// one body instruction at random
+static size_t random_op(uint8_t* rom, size_t at) {
+    unsigned r = rnd(4), cell = 0x3000 + rnd(CELLS);
+    switch (rnd(9)) {
+    case 0: return emit(rom, at, 2, 0x00 + 4 * rnd(2) + r, rnd(256), 0); // ADD/SUB r, IMM8
+    case 1: return emit(rom, at, 1, 0x08 + 4 * rnd(2) + r, 0, 0);        // INC/DEC r
+    case 2: return emit16(rom, at, 0x15 + 4 * rnd(3) + r, rnd(65536));  // ADD/SUB/MOV r, IMM16
+    case 3: return emit(rom, at, 2, 0x10 + r, rnd(256), 0);             // MOV r, IMM8
+    case 4: return emit16(rom, at, 0x24 + r, cell);                     // LOAD r, [cell]
+    case 5: return emit16(rom, at, 0x28 + r, cell);                     // STORE r, [cell]
+    case 6: return emit16(rom, at, 0x21, rnd(4) ? rnd(4) : rnd(65536)); // CMP A, k
+    case 7: // a PRINT, now and then
+        if (rnd(3) == 0) return emit(rom, at, 1, (int[]){ 0x2C, 0x2E, 0x2F }[rnd(3)], 0, 0);
+        return emit(rom, at, 1, 0x08 + r, 0, 0);
+    default: // SUB r, IMM16
+        return emit16(rom, at, 0x19 + r, rnd(65536));
+    }
+}
+
+// a loop, its counter last: in A, or in a RAM cell through A
+static size_t random_loop(uint8_t* rom, size_t at) {
+    size_t jump = 0;
+    if (rnd(4) == 0) { // enter somewhere in the body
+        jump = at;
+        at += 3;
+    }
+    size_t head = at, entry = at;
+    for (unsigned i = 0, n = rnd(8); i < n; i++) {
+        if (jump && rnd(n) == 0) entry = at;
+        at = random_op(rom, at);
+    }
+    if (rnd(2)) {
+        unsigned step = rnd(4) ? 1 : rnd(65536);
+        at = rnd(2) ? emit16(rom, at, 0x15, step) : emit16(rom, at, 0x19, step);
+    }
+    else {
+        unsigned cell = 0x3000 + rnd(CELLS);
+        at = emit16(rom, at, 0x24, cell);
+        at = rnd(2) ? emit(rom, at, 1, 0x0C, 0, 0) : emit(rom, at, 2, 0x04, rnd(256), 0);
+        at = emit16(rom, at, 0x28, cell);
+    }
+    at = emit16(rom, at, 0x21, rnd(2) ? 0 : rnd(256));
+    at = emit16(rom, at, 0x23, (unsigned)head);
+    if (jump) emit16(rom, jump, 0x14, (unsigned)entry);
+    return at;
+}
+
+static size_t random_rom(uint8_t* rom) {
+    size_t at = 0;
+    memset(rom, 0, 65536);
+    for (unsigned r = 0; r < 4; r++) at = emit16(rom, at, 0x1D + r, rnd(65536));
+    for (unsigned c = 0; c < CELLS; c++) {
+        at = emit(rom, at, 2, 0x10, rnd(256), 0);
+        at = emit16(rom, at, 0x28, 0x3000 + c);
+    }
+    at = emit16(rom, at, 0x1D, rnd(65536));
+    for (unsigned i = 0, n = 1 + rnd(4); i < n; i++) {
+        at = random_loop(rom, at);
+        if (rnd(2)) at = random_op(rom, at);
+    }
+    return emit(rom, at, 1, 0xFF, 0, 0);
+}
+
+static void report(vm* m, size_t rom, const char* how, vm_status status, uint64_t out) {
+    const cpu_state* cpu = vm_cpu(m);
+    printf("rom %zu %s: %s A=%04X B=%04X C=%04X D=%04X Z=%d PC=%u n=%llu ram=%016llx out=%016llx\n",
+           rom, how, vm_status_string(status), cpu->A, cpu->B, cpu->C, cpu->D, cpu->Z, cpu->PC,
+           (unsigned long long)vm_instructions(m),
+           (unsigned long long)fnv(0xcbf29ce484222325ull, vm_ram(m), RAM_SIZE), (unsigned long long)out);
+}
+
+int main(int argc, char* argv[]) {
+    size_t roms = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+    seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+    seed = seed * 0x9E3779B97F4A7C15ull | 1;
+    slicing = seed ^ 0x5DEECE66Dull;
+
+    static uint8_t image[65536];
+    uint64_t out;
+    vm_io io = { &out, hash_ascii, hash_decimal, hash_bits, no_input, no_input, no_input, NULL };
+    vm* m = vm_create();
+    if (!m) return 1;
+    vm_set_io(m, &io);
+
+    uint64_t instructions = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < roms; i++) {
+        size_t size = random_rom(image);
+        if (vm_load_image(m, image, size, 0, NULL) != VM_OK) return 1;
+
+        out = 0xcbf29ce484222325ull;
+        vm_status status = vm_run(m, CAP);
+        report(m, i, "whole", status, out);
+        instructions += vm_instructions(m);
+
+        vm_reset(m);
+        out = 0xcbf29ce484222325ull;
+        do {
+            uint64_t left = CAP - vm_instructions(m), slice = 1 + next(&slicing, 400);
+            status = vm_run(m, slice < left ? slice : left);
+        } while (status == VM_STEP_LIMIT && vm_instructions(m) < CAP);
+        report(m, i, "slices", status, out);
+        instructions += vm_instructions(m);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: %zu ROMs, %llu instructions in %.3f s, %.1f M instr/s\n", vm_engine(), roms,
+            (unsigned long long)instructions, seconds, instructions / seconds / 1e6);
+    vm_destroy(m);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Loop idioms against the reference interpreter: builds bench/loops.c
+# once with the switch dispatch and -DNO_LOOP_IDIOMS and once as
+# configured, runs both on the same [roms] random ROMs, and compares the
+# final state and output of every run line by line. Prints the time each
+# build took and exits 1 on any difference.
+#
+# usage: bench/loops.sh [roms] [seed]
+#        CFLAGS="-O2 -DVM_JIT" bench/loops.sh   (another configuration)
+
+set -e
+
+ROMS=${1:-1000}
+SEED=${2:-1}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+LIB=$(ls "$ROOT"/with-safety/*.c | grep -v '/main\.c$')
+
+$CC $CFLAGS -pthread -DNO_THREADED_DISPATCH -DNO_LOOP_IDIOMS -o "$WORK/reference" "$ROOT/bench/loops.c" $LIB
+$CC $CFLAGS -pthread -o "$WORK/idioms" "$ROOT/bench/loops.c" $LIB
+
+printf 'reference  '
+"$WORK/reference" "$ROMS" "$SEED" > "$WORK/reference.txt"
+printf 'idioms     '
+"$WORK/idioms" "$ROMS" "$SEED" > "$WORK/idioms.txt"
+
+if ! cmp -s "$WORK/reference.txt" "$WORK/idioms.txt"; then
+    echo "runs that differ (reference, then idioms):"
+    diff "$WORK/reference.txt" "$WORK/idioms.txt" | head -20
+    exit 1
+fi
+echo "$((ROMS * 2)) runs identical"
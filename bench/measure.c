@@ -0,0 +1,49 @@
+/*
+ * Run a command with stdin and stdout redirected to files and print its
+ * wall time in seconds, peak resident set in KB and exit status, for
+ * bench/suite.sh: `measure <stdin> <stdout> command [args...]`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <stdin> <stdout> command [args...]\n", argv[0]);
+        return 2;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        int in = open(argv[1], O_RDONLY);
+        int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (in < 0 || out < 0 || dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0) {
+            perror("redirect");
+            _exit(127);
+        }
+        execv(argv[3], argv + 3);
+        perror(argv[3]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%.6f %ld %d\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           usage.ru_maxrss, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Compare the buffered output path (block, line and unbuffered flush
+# policies) with the stdio path (-DNO_OUTPUT_BUFFER) in with-safety/ on
+# output-bound ROMs: PRINT_DECIMAL, PRINT_ASCII and PRINT_BITS in a tight
+# loop. Output goes to a file so that the cost of write() is included.
+#
+# usage: bench/output.sh [runs]
+
+set -e
+
+RUNS=${1:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -o "$WORK/buffered" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DNO_OUTPUT_BUFFER -o "$WORK/stdio" "$ROOT"/with-safety/*.c
+
+# 0000: MOV A, n            10 nn
+# 0002: STORE A, [0x1000]   28 00 10
+# 0005: MOV A, 0            10 00      ; outer:
+# 0007: PRINT               pp         ; inner:
+# 0008: INC A               08
+# 0009: CMP A, 0            21 00 00
+# 000C: JNZ inner           23 07 00
+# 000F: LOAD A, [0x1000]    24 00 10
+# 0012: DEC A               0C
+# 0013: STORE A, [0x1000]   28 00 10
+# 0016: CMP A, 0            21 00 00
+# 0019: JZ done             22 1F 00
+# 001C: JMP outer           14 05 00
+# 001F: HALT                FF         ; done:
+# prints A for every value 0..65535, n times over
+print_loop() {
+    echo "10$2 280010 1000 $1 08 210000 230700 240010 0C 280010 210000 221F00 140500 FF" \
+        | xxd -r -p
+}
+print_loop 2E 08 > "$WORK/decimal.rom" # ~2.5 MB
+print_loop 2C 20 > "$WORK/ascii.rom"   # 2 MB
+print_loop 2F 08 > "$WORK/bits.rom"    # ~4.7 MB
+
+run() {
+    start=$(date +%s%N)
+    "$@" > "$WORK/out" 2>/dev/null
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 )) ms, $(wc -c < "$WORK/out") bytes"
+}
+
+for rom in decimal ascii bits; do
+    for engine in stdio buffered:block buffered:line buffered:unbuffered; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            case $engine in
+            stdio) result=$(run "$WORK/stdio" "$WORK/$rom.rom") ;;
+            *) result=$(run "$WORK/buffered" --flush "${engine#buffered:}" "$WORK/$rom.rom") ;;
+            esac
+            echo "$rom: $engine: $result"
+            i=$((i + 1))
+        done
+    done
+done
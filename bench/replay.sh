@@ -0,0 +1,67 @@
+#!/bin/sh
+# Record/replay: a ROM that reads [numbers] decimal values from stdin and
+# prints a running sum after each. Times the live run (stdin from a
+# file, stdout to /dev/null), recording it, and replaying the trace, and
+# reports the trace size per I/O event. Also records and replays a run
+# that ends in a trap, which the replay has to match as well.
+#
+# usage: bench/replay.sh [runs] [numbers]
+
+set -e
+
+RUNS=${1:-3}
+N=${2:-1000000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/simple-cpu" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DVM_SAFETY=3 -o "$WORK/safety3" "$ROOT"/with-safety/*.c
+
+cat > "$WORK/sum.asm" <<'ASM'
+loop:
+    IN_DECIMAL A
+    CMP A, 0
+    JZ done             ; 0 or end of input
+    STORE A, [0x0100]
+    LOAD B, [0x0100]
+    ADD B, 0            ; B keeps the sum, 16-bit
+    LOAD A, [0x0100]
+    ADD A, 0
+    MOV A, 0
+    STORE B, [0x0102]
+    LOAD A, [0x0102]
+    PRINT_DECIMAL A
+    MOV A, 10
+    PRINT_ASCII A
+    JMP loop
+done:
+    HALT
+ASM
+awk -v n="$N" 'BEGIN { srand(1); for (i = 0; i < n; i++) print int(rand() * 254) + 1 }' > "$WORK/in.txt"
+
+stats() {
+    sed -n 's/^.*dispatch[^:]*: \([0-9]*\) instructions in \([0-9.]*\) s.*$/\1 instructions in \2 s/p'
+}
+
+i=0
+while [ $i -lt "$RUNS" ]; do
+    live=$("$WORK/simple-cpu" "$WORK/sum.asm" < "$WORK/in.txt" 2>&1 > /dev/null | stats)
+    rec=$("$WORK/simple-cpu" --record "$WORK/sum.trace" "$WORK/sum.asm" < "$WORK/in.txt" 2>&1 > /dev/null | stats)
+    rep=$("$WORK/simple-cpu" --replay "$WORK/sum.trace" "$WORK/sum.asm" < /dev/null 2>&1 > /dev/null | tee "$WORK/replay.log" | stats)
+    grep -q '^replay matched' "$WORK/replay.log" || { cat "$WORK/replay.log"; exit 1; }
+    echo "live: $live; record: $rec; replay: $rep"
+    i=$((i + 1))
+done
+size=$(wc -c < "$WORK/sum.trace")
+echo "trace: $size bytes, $(echo "$size $N" | awk '{ printf "%.2f", $1 / ($2 * 3 + 1) }') bytes per I/O event"
+
+# JMP 0x1000, outside the 3-byte ROM: VM_ERR_BAD_JUMP, the last status
+echo "14 00 10" | xxd -r -p > "$WORK/trap.rom"
+"$WORK/safety3" --record "$WORK/trap.trace" --rom-size 3 "$WORK/trap.rom" > /dev/null 2>&1 || true
+"$WORK/safety3" --replay "$WORK/trap.trace" --rom-size 3 "$WORK/trap.rom" > "$WORK/trap.log" 2>&1 || true
+grep -q '^replay matched' "$WORK/trap.log" || { echo "trap: replay failed"; cat "$WORK/trap.log"; exit 1; }
+echo "trap: $(grep '^replay matched' "$WORK/trap.log")"
@@ -0,0 +1,125 @@
+#!/bin/sh
+# Write the benchmark workloads to [dir]: one assembler source per ROM,
+# each stressing one thing, and for input-bound ones the input as
+# <name>.txt. Used by bench/suite.sh and as the PGO training set
+# (bench/train.sh). Prints the workload names.
+#
+# usage: bench/roms.sh dir
+
+set -e
+
+WORK=${1:?usage: bench/roms.sh dir}
+mkdir -p "$WORK"
+
+# alu: 16 register ops per iteration of a 65535-iteration loop, 255 times
+cat > "$WORK/alu.asm" <<'ASM'
+    MOV A, 255
+    STORE A, [0x0000]
+outer:
+    MOV A, 1
+inner:
+    ADD B, 7
+    SUB C, 3
+    INC D
+    ADD B, 1000
+    DEC C
+    SUB D, 2
+    ADD C, 11
+    INC B
+    MOV D, 5
+    ADD D, 300
+    SUB B, 9
+    DEC D
+    ADD C, 1
+    SUB C, 700
+    INC C
+    ADD D, 13
+    INC A
+    CMP A, 0
+    JNZ inner
+    LOAD A, [0x0000]
+    DEC A
+    STORE A, [0x0000]
+    CMP A, 0
+    JNZ outer
+    HALT
+ASM
+
+# ram: 4000 STORE/LOAD pairs per pass, one STORE into every 16-byte block
+# of RAM and a LOAD from the block 32 KB away, 20000 passes
+awk 'BEGIN {
+    print "    MOV A, 45536 ; 65536 - passes"
+    print "sweep:"
+    for (i = 0; i < 4000; i++) {
+        a = i * 16 + i % 16
+        printf "    STORE B, [0x%04X]\n    LOAD C, [0x%04X]\n    INC B\n", a, (a + 32768) % 65536
+    }
+    print "    INC A"
+    print "    CMP A, 0"
+    print "    JNZ sweep"
+    print "    HALT"
+}' > "$WORK/ram.asm"
+
+# branch: A cycles through 0..31 and is compared with each value in turn,
+# alternating JZ and JNZ, so every branch goes each way; 255 x 256 rounds
+awk 'BEGIN {
+    print "    MOV A, 255"
+    print "    STORE A, [0x0000]"
+    print "outer:"
+    print "    MOV A, 0"
+    print "    STORE A, [0x0001]"
+    print "round:"
+    print "    MOV A, 0"
+    print "cycle:"
+    for (k = 0; k < 32; k++) {
+        printf "    CMP A, %d\n", k
+        if (k % 2) printf "    JNZ skip_%d\n    INC C\n", k
+        else printf "    JZ skip_%d\n    INC B\n", k
+        printf "skip_%d:\n", k
+    }
+    print "    INC A"
+    print "    CMP A, 32"
+    print "    JNZ cycle"
+    print "    LOAD A, [0x0001]"
+    print "    DEC A"
+    print "    STORE A, [0x0001]"
+    print "    CMP A, 0"
+    print "    JNZ round"
+    print "    LOAD A, [0x0000]"
+    print "    DEC A"
+    print "    STORE A, [0x0000]"
+    print "    CMP A, 0"
+    print "    JNZ outer"
+    print "    HALT"
+}' > "$WORK/branch.asm"
+
+# print_decimal: every value 0..65535, 64 times over, to a file
+cat > "$WORK/print_decimal.asm" <<'ASM'
+    MOV A, 64
+    STORE A, [0x0000]
+outer:
+    MOV A, 0
+inner:
+    PRINT_DECIMAL A
+    INC A
+    CMP A, 0
+    JNZ inner
+    LOAD A, [0x0000]
+    DEC A
+    STORE A, [0x0000]
+    CMP A, 0
+    JNZ outer
+    HALT
+ASM
+
+# in_decimal: reads 1..255 over and over until end of input, which reads as 0
+cat > "$WORK/in_decimal.asm" <<'ASM'
+loop:
+    IN_DECIMAL A
+    CMP A, 0
+    JNZ loop
+    HALT
+ASM
+awk 'BEGIN { for (i = 0; i < 4000000; i++) print i % 255 + 1 }' > "$WORK/in_decimal.txt"
+
+echo "alu ram branch print_decimal in_decimal"
@@ -0,0 +1,111 @@
+/*
+ * Time slicing: n guests that each run about 1M instructions and halt,
+ * plus one runaway stuck in `JMP` to itself, all on one thread through
+ * vm_sched. For every slice size, reports when the last guest finished,
+ * the throughput, and how much of the time the runaway got. Slice 0 is
+ * the baseline: every guest run to completion with one vm_run() call.
+ *
+ * usage: sched [guests]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../with-safety/vm.h"
+#include "../with-safety/scheduler.h"
+
+static const char guest_source[] =
+    "    MOV D, 5\n"
+    "outer:\n"
+    "    MOV A, 1\n"
+    "inner:\n"
+    "    INC A\n"
+    "    ADD B, 3\n"
+    "    CMP A, 0\n"
+    "    JNZ inner\n"
+    "    DEC D\n"
+    "    STORE D, [0x0100]\n"
+    "    LOAD A, [0x0100]\n"
+    "    CMP A, 0\n"
+    "    JNZ outer\n"
+    "    HALT\n";
+
+static const char runaway_source[] = "spin:\n    JMP spin\n";
+
+static size_t finished;
+
+static void done(void* ctx, vm* m, vm_status status) {
+    (void)ctx;
+    (void)m;
+    if (status != VM_HALTED) {
+        fprintf(stderr, "guest stopped: %s\n", vm_status_string(status));
+        exit(1);
+    }
+    finished++;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+    static const uint64_t slices[] = { 0, 1000, 10000, 100000, 1000000 };
+
+    vm* guest_rom = vm_create();
+    vm* runaway = vm_create();
+    if (!guest_rom || !runaway
+        || vm_load_asm_source(guest_rom, guest_source, sizeof(guest_source) - 1, 0, NULL, NULL) != VM_OK
+        || vm_load_asm_source(runaway, runaway_source, sizeof(runaway_source) - 1, 0, NULL, NULL) != VM_OK) {
+        fprintf(stderr, "couldn't load the guests\n");
+        return 1;
+    }
+    vm** guests = malloc(n * sizeof(*guests));
+    for (size_t i = 0; i < n; i++) {
+        guests[i] = vm_create();
+        if (!guests[i] || vm_load_shared(guests[i], guest_rom) != VM_OK) {
+            fprintf(stderr, "couldn't create guest %zu\n", i);
+            return 1;
+        }
+    }
+
+    for (size_t k = 0; k < sizeof(slices) / sizeof(slices[0]); k++) {
+        for (size_t i = 0; i < n; i++) vm_reset(guests[i]);
+        vm_reset(runaway);
+        finished = 0;
+
+        double start = now_seconds();
+        if (slices[k] == 0) {
+            for (size_t i = 0; i < n; i++) done(NULL, guests[i], vm_run(guests[i], 0));
+        }
+        else {
+            vm_sched* s = vm_sched_create(slices[k], done);
+            vm_sched_add(s, runaway, 0, NULL);
+            for (size_t i = 0; i < n; i++) vm_sched_add(s, guests[i], 0, NULL);
+            while (finished < n) vm_sched_run(s, 1);
+            vm_sched_destroy(s);
+        }
+        double elapsed = now_seconds() - start;
+
+        uint64_t work = 0;
+        for (size_t i = 0; i < n; i++) work += vm_instructions(guests[i]);
+        uint64_t spun = vm_instructions(runaway);
+        if (slices[k] == 0) {
+            printf("no slicing: %zu guests in %.3f s (%.1f M instr/s)\n",
+                   n, elapsed, work / elapsed / 1e6);
+        }
+        else {
+            printf("slice %7llu: %zu guests + runaway in %.3f s (%.1f M instr/s), runaway got %.2f%%\n",
+                   (unsigned long long)slices[k], n, elapsed, (work + spun) / elapsed / 1e6,
+                   100.0 * spun / (work + spun));
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) vm_destroy(guests[i]);
+    free(guests);
+    vm_destroy(runaway);
+    vm_destroy(guest_rom);
+    return 0;
+}
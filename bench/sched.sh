@@ -0,0 +1,27 @@
+#!/bin/sh
+# Time slicing with vm_sched: [guests] guests that halt after ~1M
+# instructions plus one that never does, on one thread, for several slice
+# sizes against running each guest straight through.
+#
+# usage: bench/sched.sh [runs] [guests]
+
+set -e
+
+RUNS=${1:-3}
+N=${2:-1000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+# the library without its CLI
+$CC $CFLAGS -pthread -o "$WORK/sched" "$ROOT/bench/sched.c" \
+    $(ls "$ROOT"/with-safety/*.c | grep -v '/main\.c$')
+
+i=0
+while [ $i -lt "$RUNS" ]; do
+    "$WORK/sched" "$N"
+    i=$((i + 1))
+done
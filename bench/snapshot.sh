@@ -0,0 +1,58 @@
+#!/bin/sh
+# Warm start: a ROM spends ~100M instructions initializing RAM before a
+# short piece of real work. Compare running it cold with running from a
+# snapshot taken at the start of the work, and report the snapshot size
+# and the restore time.
+#
+# usage: bench/snapshot.sh [runs]
+
+set -e
+
+RUNS=${1:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/simple-cpu" "$ROOT"/with-safety/*.c
+
+cat > "$WORK/warm.asm" <<'ASM'
+    MOV A, 255
+    STORE A, [0x1000]
+outer:
+    MOV A, 1
+inner:                  ; 255 x 65535 iterations
+    INC A
+    ADD B, 3
+    STORE B, [0x2000]
+    CMP A, 0
+    JNZ inner
+    LOAD A, [0x1000]
+    DEC A
+    STORE A, [0x1000]
+    CMP A, 0
+    JNZ outer
+work:                   ; 0x0020
+    LOAD A, [0x2000]
+    PRINT_DECIMAL A
+    MOV A, 10
+    PRINT_ASCII A
+    HALT
+ASM
+
+"$WORK/simple-cpu" --snapshot-at pc:0x20 --snapshot "$WORK/warm.snap" "$WORK/warm.asm" > /dev/null 2>&1
+echo "snapshot: $(wc -c < "$WORK/warm.snap") bytes"
+
+i=0
+while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$WORK/simple-cpu" "$WORK/warm.asm" > /dev/null 2>&1
+    mid=$(date +%s%N)
+    "$WORK/simple-cpu" --restore "$WORK/warm.snap" "$WORK/warm.asm" 2>&1 > /dev/null \
+        | sed -n 's/^restored .* in /restore: /p'
+    end=$(date +%s%N)
+    echo "cold: $(( (mid - start) / 1000 )) us, from snapshot: $(( (end - mid) / 1000 )) us"
+    i=$((i + 1))
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measure the cost of launching many short VM runs with with-safety/:
+# the mmap ROM loader against the read() loader (-DNO_ROM_MMAP), for a
+# 4-byte ROM and for a full 32 KB image. Reports microseconds per run,
+# process creation included.
+#
+# usage: bench/startup.sh [runs] [launches per run]
+
+set -e
+
+RUNS=${1:-3}
+N=${2:-1000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+$CC $CFLAGS -pthread -o "$WORK/mmap" "$ROOT"/with-safety/*.c
+$CC $CFLAGS -pthread -DNO_ROM_MMAP -o "$WORK/read" "$ROOT"/with-safety/*.c
+
+# MOV A, 'A'; PRINT_ASCII; HALT
+echo "1041 2C FF" | xxd -r -p > "$WORK/tiny.rom"
+# the same, padded with HALTs to 32 KB
+{ cat "$WORK/tiny.rom"; yes FF | head -n 32764 | xxd -r -p; } > "$WORK/full.rom"
+
+for rom in tiny full; do
+    for loader in read mmap; do
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            start=$(date +%s%N)
+            j=0
+            while [ $j -lt "$N" ]; do
+                "$WORK/$loader" "$WORK/$rom.rom" > /dev/null
+                j=$((j + 1))
+            done
+            end=$(date +%s%N)
+            echo "$rom: $loader: $(( (end - start) / N / 1000 )) us/run"
+            i=$((i + 1))
+        done
+    done
+done
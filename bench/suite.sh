@@ -0,0 +1,74 @@
+#!/bin/sh
+# Benchmark suite: generated ROMs that each stress one thing (ALU ops on
+# registers, a LOAD/STORE sweep over all 64 KB of RAM, JZ/JNZ-heavy code,
+# PRINT_DECIMAL output, IN_DECIMAL input), run on a build of every
+# safety level (-DVM_SAFETY, see with-safety/cpu.h). Reports M instr/s,
+# ns/instruction and peak RSS per run and the median of each, and
+# appends one CSV line per run to [results file] (default: suite.csv at
+# the repo root, which git ignores):
+#
+#   date,commit,engine,workload,run,instructions,seconds,mips,ns_per_instr,peak_rss_kb
+#
+# Instruction counts come from a -DVM_STATS build; the ROMs are well
+# formed, so every level executes the same instructions.
+#
+# usage: bench/suite.sh [runs] [results file]
+
+set -e
+
+RUNS=${1:-5}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+RESULTS=${2:-$ROOT/suite.csv}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+ENGINES="none rom full jumps"
+level=0
+for engine in $ENGINES; do
+    $CC $CFLAGS -pthread -DVM_SAFETY=$level -o "$WORK/$engine" "$ROOT"/with-safety/*.c
+    level=$((level + 1))
+done
+$CC $CFLAGS -pthread -DVM_STATS -o "$WORK/stats" "$ROOT"/with-safety/*.c
+$CC -O2 -o "$WORK/measure" "$ROOT"/bench/measure.c
+
+WORKLOADS=$("$ROOT"/bench/roms.sh "$WORK")
+for w in $WORKLOADS; do
+    "$WORK/stats" --assemble "$WORK/$w.rom" "$WORK/$w.asm" > /dev/null 2>&1
+    [ -f "$WORK/$w.txt" ] || : > "$WORK/$w.txt"
+    count=$("$WORK/stats" "$WORK/$w.rom" < "$WORK/$w.txt" 2>&1 > /dev/null \
+        | awk '{ for (i = 1; i < NF; i++) if ($(i + 1) == "instructions") print $i }')
+    echo "$w: $count instructions, $(wc -c < "$WORK/$w.rom") bytes of ROM"
+    echo "$count" > "$WORK/$w.count"
+done
+
+COMMIT=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+[ -s "$RESULTS" ] || echo "date,commit,engine,workload,run,instructions,seconds,mips,ns_per_instr,peak_rss_kb" > "$RESULTS"
+
+for w in $WORKLOADS; do
+    count=$(cat "$WORK/$w.count")
+    for engine in $ENGINES; do
+        : > "$WORK/runs"
+        i=1
+        while [ $i -le "$RUNS" ]; do
+            set -- $("$WORK/measure" "$WORK/$w.txt" "$WORK/out" "$WORK/$engine" "$WORK/$w.rom")
+            if [ "$3" != 0 ]; then
+                echo "$w: $engine exited with status $3" >&2
+                exit 1
+            fi
+            echo "$DATE $COMMIT $engine $w $i $count $1 $2" | awk -v OFS=, '{
+                print $1, $2, $3, $4, $5, $6, $7, sprintf("%.1f", $6 / $7 / 1e6),
+                    sprintf("%.3f", $7 * 1e9 / $6), $8
+            }' | tee -a "$RESULTS" >> "$WORK/runs"
+            i=$((i + 1))
+        done
+        sort -t, -k7,7g "$WORK/runs" | awk -F, -v n="$RUNS" 'NR == int((n + 1) / 2) {
+            printf "%-14s %-6s %8.1f M instr/s %7.3f ns/instr %7d KB peak RSS (median of %d)\n",
+                $4, $3, $8, $9, $10, n
+        }'
+    done
+done
+echo "results appended to $RESULTS"
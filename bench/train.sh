@@ -0,0 +1,21 @@
+#!/bin/sh
+# PGO training run (make pgo): assemble and run every bench/roms.sh
+# workload and test_program.asm with the given instrumented build, so the
+# profile covers the assembler, the loader, both I/O directions and the
+# dispatch loop.
+#
+# usage: bench/train.sh simple-cpu
+
+set -e
+
+CPU=${1:?usage: bench/train.sh simple-cpu}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for w in $("$ROOT"/bench/roms.sh "$WORK"); do
+    [ -f "$WORK/$w.txt" ] || : > "$WORK/$w.txt"
+    "$CPU" --assemble "$WORK/$w.rom" "$WORK/$w.asm" > /dev/null
+    "$CPU" "$WORK/$w.rom" < "$WORK/$w.txt" > /dev/null
+done
+"$CPU" "$ROOT/test_program.asm" > /dev/null
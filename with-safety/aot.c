@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "aot.h"
+
+static const char* const safety_levels[] = { "none", "ROM bounds", "full", "full + jumps" };
+
+// what the generated program needs besides main(): stdio, with input.c's and output.c's semantics
+static const char prelude[] =
+    "#define _POSIX_C_SOURCE 200809L\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "static uint8_t ram[65536];\n"
+    "static char in_buffer[65536], out_buffer[65536];\n"
+    "static bool printed; // since the last flush\n"
+    "\n"
+    "static inline void print_ascii(unsigned c) {\n"
+    "    putchar_unlocked(c);\n"
+    "    printed = true;\n"
+    "}\n"
+    "\n"
+    "static inline void print_decimal(unsigned value) {\n"
+    "    char digits[5];\n"
+    "    int n = 0;\n"
+    "    do {\n"
+    "        digits[n++] = '0' + value % 10;\n"
+    "        value /= 10;\n"
+    "    } while (value);\n"
+    "    while (n) putchar_unlocked(digits[--n]);\n"
+    "    printed = true;\n"
+    "}\n"
+    "\n"
+    "static inline void print_bits(unsigned value) {\n"
+    "    for (int i = 7; i >= 0; i--) putchar_unlocked(value >> i & 1 ? '1' : '0');\n"
+    "    putchar_unlocked('\\n');\n"
+    "    printed = true;\n"
+    "}\n"
+    "\n"
+    "// every IN flushes pending output first, so prompts appear before the read\n"
+    "static inline void flush_printed(void) {\n"
+    "    if (printed) fflush(stdout);\n"
+    "    printed = false;\n"
+    "}\n"
+    "\n"
+    "static inline uint16_t in_byte(void) {\n"
+    "    flush_printed();\n"
+    "    int c = getchar_unlocked();\n"
+    "    return c == EOF ? 0 : c & 0xFF;\n"
+    "}\n"
+    "\n"
+    "// digits up to and including the first non-digit, which is dropped\n"
+    "static inline uint16_t in_decimal(void) {\n"
+    "    uint32_t value = 0;\n"
+    "    int c;\n"
+    "    flush_printed();\n"
+    "    while ((c = getchar_unlocked()) != EOF && c >= '0' && c <= '9') value = value * 10 + (c - '0');\n"
+    "    return value & 0xFF;\n"
+    "}\n"
+    "\n"
+    "static inline uint16_t in_binary(void) {\n"
+    "    uint32_t value = 0;\n"
+    "    int c;\n"
+    "    flush_printed();\n"
+    "    while ((c = getchar_unlocked()) != EOF && (c == '0' || c == '1')) value = (value << 1) | (c - '0');\n"
+    "    return value & 0xFF;\n"
+    "}\n"
+    "\n"
+    "static inline int fail(FILE* to, const char* message) {\n"
+    "    fflush(stdout);\n"
+    "    fputs(message, to);\n"
+    "    return EXIT_FAILURE;\n"
+    "}\n"
+    "\n";
+
+// the instruction that runs at pc: a superinstruction's first component
+static uint8_t opcode_at(const vm* m, size_t pc) {
+    uint8_t op = m->code[pc].op;
+    return is_compound(op) ? m->rom[pc] : op;
+}
+
+static bool is_branch(uint8_t op) {
+    return op == 0x14 || op == 0x22 || op == 0x23;
+}
+
+// whether the next instruction can run after this one
+static bool falls_through(uint8_t op) {
+    return !ends_run(op) || op == 0x22 || op == 0x23 || op == OP_BAD_JZ || op == OP_BAD_JNZ;
+}
+
+// the register a family opcode names, `first` being its A form
+static char reg(uint8_t op, uint8_t first) {
+    return "ABCD"[op - first];
+}
+
+static void emit(const vm* m, size_t pc, uint8_t op, FILE* out) {
+    const decoded_op* d = &m->code[pc];
+
+    fprintf(out, "    ");
+    switch (op) {
+    case 0x00: case 0x01: case 0x02: case 0x03: // ADD r, IMM8
+        fprintf(out, "%c += %u;", reg(op, 0x00), d->imm);
+        break;
+    case 0x15: case 0x16: case 0x17: case 0x18: // ADD r, IMM16
+        fprintf(out, "%c += %u;", reg(op, 0x15), d->imm);
+        break;
+    case 0x04: case 0x05: case 0x06: case 0x07: // SUB r, IMM8
+        fprintf(out, "%c -= %u;", reg(op, 0x04), d->imm);
+        break;
+    case 0x19: case 0x1A: case 0x1B: case 0x1C: // SUB r, IMM16
+        fprintf(out, "%c -= %u;", reg(op, 0x19), d->imm);
+        break;
+    case 0x08: case 0x09: case 0x0A: case 0x0B: // INC r
+        fprintf(out, "%c++;", reg(op, 0x08));
+        break;
+    case 0x0C: case 0x0D: case 0x0E: case 0x0F: // DEC r
+        fprintf(out, "%c--;", reg(op, 0x0C));
+        break;
+    case 0x10: case 0x11: case 0x12: case 0x13: // MOV r, IMM8
+        fprintf(out, "%c = %u;", reg(op, 0x10), d->imm);
+        break;
+    case 0x1D: case 0x1E: case 0x1F: case 0x20: // MOV r, IMM16
+        fprintf(out, "%c = %u;", reg(op, 0x1D), d->imm);
+        break;
+    case 0x14: // JMP IMM16
+        fprintf(out, "goto pc_%04x;", d->imm);
+        break;
+    case 0x21: // CMP A, IMM16
+        fprintf(out, "Z = A == %u;", d->imm);
+        break;
+    case 0x22: // JZ IMM16
+        fprintf(out, "if (Z) goto pc_%04x;", d->imm);
+        break;
+    case 0x23: // JNZ IMM16
+        fprintf(out, "if (!Z) goto pc_%04x;", d->imm);
+        break;
+    case 0x24: case 0x25: case 0x26: case 0x27: // LOAD r, [IMM16]
+        fprintf(out, "%c = ram[0x%04X];", reg(op, 0x24), d->imm);
+        break;
+    case 0x28: case 0x29: case 0x2A: case 0x2B: // STORE r, [IMM16]
+        fprintf(out, "ram[0x%04X] = %c & 0xFF;", d->imm, reg(op, 0x28));
+        break;
+    case 0x2C: // PRINT A AS ASCII
+        fprintf(out, "print_ascii(A & 0xFF);");
+        break;
+    case 0x2D: // IN A
+        fprintf(out, "A = in_byte();");
+        break;
+    case 0x2E: // PRINT A AS DECIMAL
+        fprintf(out, "print_decimal(A);");
+        break;
+    case 0x2F: // PRINT A AS BITS
+        fprintf(out, "print_bits(A & 0xFF);");
+        break;
+    case 0x30: // IN A (DECIMAL)
+        fprintf(out, "A = in_decimal();");
+        break;
+    case 0x31: // IN A (BINARY)
+        fprintf(out, "A = in_binary();");
+        break;
+    case 0xFF: // HALT
+    case OP_END:
+        fprintf(out, "return EXIT_SUCCESS;");
+        break;
+    case OP_TRUNCATED:
+        fprintf(out, "return fail(stderr, \"Truncated instruction at PC=%zu\\n\");", pc);
+        break;
+    case OP_UNVERIFIED:
+        fprintf(out, "return fail(stderr, \"Unverified code reached at PC=%zu\\n\");", pc);
+        break;
+    case OP_BAD_JMP:
+        fprintf(out, "return fail(stderr, \"Jump outside code at PC=%zu\\n\");", pc);
+        break;
+    case OP_BAD_JZ:
+    case OP_BAD_JNZ:
+        fprintf(out, "if (%sZ) return fail(stderr, \"Jump outside code at PC=%zu\\n\");",
+                op == OP_BAD_JZ ? "" : "!", pc);
+        break;
+    default: // OP_UNKNOWN
+        fprintf(out, "return fail(stdout, \"Unknown opcode: 0x%02X at PC=%zu\\n\");", m->rom[pc], pc);
+        break;
+    } // switch end
+    fprintf(out, " // %04zx\n", pc);
+}
+
+bool aot_compile(const vm* m, const char* rom_name, FILE* out) {
+    size_t code_size = m->rom_size + CODE_TAIL;
+    uint8_t* reached = calloc(code_size, 1);
+    uint8_t* label = calloc(code_size, 1);
+    size_t* work = malloc(code_size * sizeof(size_t));
+    if (!reached || !label || !work) {
+        free(reached);
+        free(label);
+        free(work);
+        return false;
+    }
+
+    // every instruction reachable from PC 0 through fall-through and jumps
+    size_t pending = 0;
+    work[pending++] = 0;
+    reached[0] = 1;
+    while (pending) {
+        size_t pc = work[--pending];
+        uint8_t op = opcode_at(m, pc);
+        size_t next[2];
+        size_t n = 0;
+
+        if (falls_through(op)) next[n++] = pc + m->code[pc].len;
+        if (is_branch(op)) {
+            next[n++] = m->code[pc].imm;
+            label[m->code[pc].imm] = 1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (reached[next[i]]) continue;
+            reached[next[i]] = 1;
+            work[pending++] = next[i];
+        }
+    }
+
+    /*
+     * Statements go in address order. One that falls through to anything
+     * but the next reachable address, as when a jump lands inside another
+     * instruction, ends with a goto.
+     */
+    size_t following = code_size; // reachable address after pc
+    for (size_t pc = code_size; pc-- > 0; ) {
+        if (!reached[pc]) continue;
+        uint8_t op = opcode_at(m, pc);
+        if (falls_through(op) && pc + m->code[pc].len != following) label[pc + m->code[pc].len] = 1;
+        following = pc;
+    }
+
+    fprintf(out, "// %s: %zu-byte ROM (hash %016llx), compiled by simple-cpu at safety level %s\n",
+            rom_name, m->rom_size, (unsigned long long)rom_hash(m), safety_levels[VM_SAFETY]);
+    fputs(prelude, out);
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    uint16_t A = 0, B = 0, C = 0, D = 0;\n");
+    fprintf(out, "    bool Z = false;\n");
+    fprintf(out, "    (void)A, (void)B, (void)C, (void)D, (void)Z; // not every ROM uses them all\n");
+    fprintf(out, "    // as the interpreter buffers: 64 KB, output line by line only on a terminal\n");
+    fprintf(out, "    setvbuf(stdin, in_buffer, _IOFBF, sizeof(in_buffer));\n");
+    fprintf(out, "    setvbuf(stdout, out_buffer, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, sizeof(out_buffer));\n");
+    fprintf(out, "\n");
+    for (size_t pc = 0; pc < code_size; pc++) {
+        if (!reached[pc]) continue;
+        uint8_t op = opcode_at(m, pc);
+        if (label[pc]) fprintf(out, "pc_%04zx:\n", pc);
+        emit(m, pc, op, out);
+
+        size_t after = pc + 1;
+        while (after < code_size && !reached[after]) after++;
+        if (falls_through(op) && pc + m->code[pc].len != after)
+            fprintf(out, "    goto pc_%04zx;\n", pc + m->code[pc].len);
+    }
+    fprintf(out, "}\n");
+
+    free(reached);
+    free(label);
+    free(work);
+    return !ferror(out);
+}
@@ -0,0 +1,22 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * Ahead-of-time compilation (--compile out.c). Writes the ROM loaded in
+ * m as one C program that needs nothing but the C library: every
+ * instruction reachable from PC 0 becomes a statement, jump targets
+ * become labels, A-D and Z are locals of main() and RAM is a static
+ * array. The I/O opcodes call a few stdio helpers emitted with it, and
+ * the traps print what the interpreter would and exit with failure.
+ *
+ * The program follows m's decode, so it behaves like this build's
+ * safety level. false if out could not be written.
+ */
+bool aot_compile(const vm* m, const char* rom_name, FILE* out);
+
+#endif
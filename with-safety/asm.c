@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "asm.h"
+
+// operand shapes, one per row of the mnemonic table
+typedef enum {
+    ARG_NONE,     // HALT
+    ARG_A,        // PRINT_DECIMAL [A]: the register is optional, and only A
+    ARG_REG,      // INC r
+    ARG_REG_IMM,  // ADD r, v: op8 + r or op16 + r by the size of v
+    ARG_A_IMM16,  // CMP A, v
+    ARG_IMM16,    // JMP v
+    ARG_REG_MEM,  // LOAD r, [v]
+} arg_kind;
+
+typedef struct {
+    const char* name;
+    uint8_t len;
+    arg_kind kind;
+    uint8_t op8;  // the opcode, or the IMM8 form for ARG_REG_IMM
+    uint8_t op16; // the IMM16 form for ARG_REG_IMM
+} mnemonic;
+
+#define M(name, kind, op8, op16) { name, sizeof(name) - 1, kind, op8, op16 }
+
+static const mnemonic mnemonics[] = {
+    M("ADD", ARG_REG_IMM, 0x00, 0x15),
+    M("SUB", ARG_REG_IMM, 0x04, 0x19),
+    M("INC", ARG_REG, 0x08, 0),
+    M("DEC", ARG_REG, 0x0C, 0),
+    M("MOV", ARG_REG_IMM, 0x10, 0x1D),
+    M("JMP", ARG_IMM16, 0x14, 0),
+    M("CMP", ARG_A_IMM16, 0x21, 0),
+    M("JZ", ARG_IMM16, 0x22, 0),
+    M("JNZ", ARG_IMM16, 0x23, 0),
+    M("LOAD", ARG_REG_MEM, 0x24, 0),
+    M("STORE", ARG_REG_MEM, 0x28, 0),
+    M("PRINT_ASCII", ARG_A, 0x2C, 0),
+    M("IN", ARG_A, 0x2D, 0),
+    M("PRINT_DECIMAL", ARG_A, 0x2E, 0),
+    M("PRINT_BITS", ARG_A, 0x2F, 0),
+    M("IN_DECIMAL", ARG_A, 0x30, 0),
+    M("IN_BINARY", ARG_A, 0x31, 0),
+    M("HALT", ARG_NONE, 0xFF, 0),
+};
+
+#undef M
+
+/*
+ * Label table: open addressing on an FNV-1a hash of the name, which
+ * points into the source. An undefined label collects the ROM offsets
+ * that wait for it as a chain through fixups[]; defining it patches them.
+ */
+typedef struct {
+    const char* name; // NULL: empty slot
+    uint32_t len;
+    uint32_t hash;
+    int32_t value;    // -1 until defined
+    uint32_t pending; // 1 + first fixups[] index waiting for it, 0 for none
+    size_t first_use; // line, for the undefined label error
+} label;
+
+typedef struct {
+    uint32_t at;   // ROM offset of the 16-bit operand
+    uint32_t next; // 1 + next fixup for the same label, 0 for none
+    size_t line;   // of the use, for the error if the label does not fit
+} fixup;
+
+typedef struct {
+    const char* p;   // next source byte
+    const char* end;
+    size_t line;
+
+    uint8_t* rom;
+    size_t cap;
+    size_t size;
+
+    label* labels;
+    uint32_t label_mask; // table size - 1, a power of two
+    uint32_t n_labels;
+    fixup* fixups;
+    uint32_t n_fixups, fixup_cap;
+
+    asm_error* err;
+} assembler;
+
+// an operand value; unknown means a forward reference to l
+typedef struct {
+    bool known;
+    int32_t value;
+    label* l;
+} value;
+
+static int fail(assembler* a, const char* fmt, ...) {
+    va_list ap;
+    a->err->line = a->line;
+    va_start(ap, fmt);
+    vsnprintf(a->err->message, sizeof(a->err->message), fmt, ap);
+    va_end(ap);
+    return ERROR;
+}
+
+static inline bool is_ident_start(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '.';
+}
+
+static inline bool is_ident(char c) {
+    return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+static inline void skip_blanks(assembler* a) {
+    while (a->p < a->end && (*a->p == ' ' || *a->p == '\t' || *a->p == '\r')) a->p++;
+}
+
+// true at the end of the statement: end of line, comment or end of input
+static inline bool at_eol(assembler* a) {
+    skip_blanks(a);
+    return a->p == a->end || *a->p == '\n' || *a->p == ';';
+}
+
+static uint32_t hash_name(const char* s, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+static int grow_labels(assembler* a) {
+    uint32_t size = (a->label_mask + 1) * 2;
+    label* labels = calloc(size, sizeof(label));
+    if (!labels) return fail(a, "out of memory");
+    for (uint32_t i = 0; i <= a->label_mask; i++) {
+        label* l = &a->labels[i];
+        if (!l->name) continue;
+        uint32_t slot = l->hash & (size - 1);
+        while (labels[slot].name) slot = (slot + 1) & (size - 1);
+        labels[slot] = *l;
+    }
+    free(a->labels);
+    a->labels = labels;
+    a->label_mask = size - 1;
+    return OK;
+}
+
+// find or add the label; NULL only when out of memory (a->err is set)
+static label* lookup(assembler* a, const char* name, uint32_t len) {
+    if ((a->n_labels + 1) * 2 > a->label_mask + 1 && grow_labels(a) != OK) return NULL;
+
+    uint32_t hash = hash_name(name, len);
+    uint32_t slot = hash & a->label_mask;
+    for (;;) {
+        label* l = &a->labels[slot];
+        if (!l->name) {
+            l->name = name;
+            l->len = len;
+            l->hash = hash;
+            l->value = -1;
+            l->first_use = a->line;
+            a->n_labels++;
+            return l;
+        }
+        if (l->hash == hash && l->len == len && memcmp(l->name, name, len) == 0) return l;
+        slot = (slot + 1) & a->label_mask;
+    }
+}
+
+static int define(assembler* a, const char* name, uint32_t len) {
+    label* l = lookup(a, name, len);
+    if (!l) return ERROR;
+    if (l->value >= 0) return fail(a, "label '%.*s' already defined", (int)len, name);
+    l->value = (int32_t)a->size;
+    for (uint32_t f = l->pending; f; f = a->fixups[f - 1].next) {
+        uint32_t at = a->fixups[f - 1].at;
+        if (l->value > 0xFFFF) { // the end of a full 64 KB ROM
+            a->line = a->fixups[f - 1].line;
+            return fail(a, "label '%.*s' does not fit in 16 bits", (int)len, name);
+        }
+        a->rom[at] = l->value & 0xFF;
+        a->rom[at + 1] = (l->value >> 8) & 0xFF;
+    }
+    l->pending = 0;
+    return OK;
+}
+
+static int add_fixup(assembler* a, label* l, uint32_t at) {
+    if (a->n_fixups == a->fixup_cap) {
+        uint32_t cap = a->fixup_cap ? a->fixup_cap * 2 : 1024;
+        fixup* fixups = realloc(a->fixups, cap * sizeof(fixup));
+        if (!fixups) return fail(a, "out of memory");
+        a->fixups = fixups;
+        a->fixup_cap = cap;
+    }
+    a->fixups[a->n_fixups] = (fixup){ at, l->pending, a->line };
+    l->pending = ++a->n_fixups;
+    return OK;
+}
+
+static uint32_t ident_length(assembler* a) {
+    const char* s = a->p;
+    while (s < a->end && is_ident(*s)) s++;
+    return (uint32_t)(s - a->p);
+}
+
+static bool same_word(const char* s, uint32_t len, const char* upper, uint32_t upper_len) {
+    if (len != upper_len) return false;
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != upper[i]) return false;
+    }
+    return true;
+}
+
+// A-D as 0-3, -1 if the next word is not a register
+static int peek_register(assembler* a) {
+    skip_blanks(a);
+    if (a->p == a->end || !is_ident_start(*a->p) || ident_length(a) != 1) return -1;
+    char c = *a->p;
+    if (c >= 'a' && c <= 'd') return c - 'a';
+    if (c >= 'A' && c <= 'D') return c - 'A';
+    return -1;
+}
+
+static int parse_register(assembler* a, int* reg) {
+    *reg = peek_register(a);
+    if (*reg < 0) return fail(a, "expected register A, B, C or D");
+    a->p++;
+    return OK;
+}
+
+static int expect(assembler* a, char c) {
+    skip_blanks(a);
+    if (a->p == a->end || *a->p != c) return fail(a, "expected '%c'", c);
+    a->p++;
+    return OK;
+}
+
+static int parse_number(assembler* a, int32_t* out) {
+    const char* s = a->p;
+    int base = 10;
+    int64_t v = 0;
+    bool any = false;
+
+    if (a->end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    else if (a->end - s > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) {
+        base = 2;
+        s += 2;
+    }
+    for (; s < a->end; s++) {
+        int d;
+        char c = *s;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else if (is_ident(c)) return fail(a, "bad digit '%c' in number", c);
+        else break;
+        if (d >= base) return fail(a, "bad digit '%c' in number", c);
+        v = v * base + d;
+        if (v > 0xFFFF) return fail(a, "value does not fit in 16 bits");
+        any = true;
+    }
+    if (!any) return fail(a, "expected a number");
+    a->p = s;
+    *out = (int32_t)v;
+    return OK;
+}
+
+// a number, 'c', -number or label
+static int parse_value(assembler* a, value* v) {
+    skip_blanks(a);
+    v->known = true;
+    v->l = NULL;
+    if (a->p == a->end) return fail(a, "expected a value");
+
+    char c = *a->p;
+    if (c == '\'') {
+        if (a->end - a->p < 3 || a->p[2] != '\'') return fail(a, "bad character literal");
+        v->value = (uint8_t)a->p[1];
+        a->p += 3;
+        return OK;
+    }
+    if (c == '-') {
+        a->p++;
+        if (parse_number(a, &v->value) != OK) return ERROR;
+        if (v->value > 0x8000) return fail(a, "value does not fit in 16 bits");
+        v->value = (-v->value) & 0xFFFF; // two's complement, always IMM16
+        return OK;
+    }
+    if (c >= '0' && c <= '9') return parse_number(a, &v->value);
+    if (!is_ident_start(c)) return fail(a, "expected a value");
+
+    uint32_t len = ident_length(a);
+    label* l = lookup(a, a->p, len);
+    if (!l) return ERROR;
+    a->p += len;
+    if (l->value >= 0) {
+        v->value = l->value;
+    }
+    else {
+        v->known = false;
+        v->l = l;
+    }
+    return OK;
+}
+
+static int room(assembler* a, size_t n) {
+    if (a->size + n > a->cap) return fail(a, "program does not fit in %zu bytes of ROM", a->cap);
+    return OK;
+}
+
+static int emit_op(assembler* a, uint8_t op) {
+    if (room(a, 1) != OK) return ERROR;
+    a->rom[a->size++] = op;
+    return OK;
+}
+
+static int emit_op8(assembler* a, uint8_t op, const value* v) {
+    if (room(a, 2) != OK) return ERROR;
+    a->rom[a->size++] = op;
+    a->rom[a->size++] = (uint8_t)v->value;
+    return OK;
+}
+
+static int emit_op16(assembler* a, uint8_t op, const value* v) {
+    if (room(a, 3) != OK) return ERROR;
+    if (v->known && v->value > 0xFFFF) return fail(a, "value does not fit in 16 bits");
+    a->rom[a->size] = op;
+    if (v->known) {
+        a->rom[a->size + 1] = v->value & 0xFF;
+        a->rom[a->size + 2] = (v->value >> 8) & 0xFF;
+    }
+    else if (add_fixup(a, v->l, (uint32_t)a->size + 1) != OK) {
+        return ERROR;
+    }
+    a->size += 3;
+    return OK;
+}
+
+static const mnemonic* find_mnemonic(const char* s, uint32_t len) {
+    for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); i++) {
+        if (same_word(s, len, mnemonics[i].name, mnemonics[i].len)) return &mnemonics[i];
+    }
+    return NULL;
+}
+
+static int instruction(assembler* a, const mnemonic* m) {
+    value v;
+    int reg;
+
+    switch (m->kind) {
+    case ARG_NONE:
+        return emit_op(a, m->op8);
+    case ARG_A:
+        if (!at_eol(a)) {
+            if (parse_register(a, &reg) != OK) return ERROR;
+            if (reg != 0) return fail(a, "%s only takes register A", m->name);
+        }
+        return emit_op(a, m->op8);
+    case ARG_REG:
+        if (parse_register(a, &reg) != OK) return ERROR;
+        return emit_op(a, m->op8 + reg);
+    case ARG_REG_IMM:
+        if (parse_register(a, &reg) != OK || expect(a, ',') != OK || parse_value(a, &v) != OK)
+            return ERROR;
+        if (v.known && v.value <= 0xFF) return emit_op8(a, m->op8 + reg, &v);
+        return emit_op16(a, m->op16 + reg, &v);
+    case ARG_A_IMM16:
+        if (parse_register(a, &reg) != OK) return ERROR;
+        if (reg != 0) return fail(a, "%s only takes register A", m->name);
+        if (expect(a, ',') != OK || parse_value(a, &v) != OK) return ERROR;
+        return emit_op16(a, m->op8, &v);
+    case ARG_IMM16:
+        if (parse_value(a, &v) != OK) return ERROR;
+        return emit_op16(a, m->op8, &v);
+    case ARG_REG_MEM:
+        if (parse_register(a, &reg) != OK || expect(a, ',') != OK || expect(a, '[') != OK
+            || parse_value(a, &v) != OK || expect(a, ']') != OK)
+            return ERROR;
+        return emit_op16(a, m->op8 + reg, &v);
+    } // switch end
+    return ERROR;
+}
+
+// labels, then at most one instruction, then the rest of the line
+static int statement(assembler* a) {
+    for (;;) {
+        if (at_eol(a)) break;
+        if (!is_ident_start(*a->p)) return fail(a, "unexpected '%c'", *a->p);
+
+        const char* word = a->p;
+        uint32_t len = ident_length(a);
+        a->p += len;
+        skip_blanks(a);
+        if (a->p < a->end && *a->p == ':') {
+            a->p++;
+            if (define(a, word, len) != OK) return ERROR;
+            continue;
+        }
+
+        const mnemonic* m = find_mnemonic(word, len);
+        if (!m) return fail(a, "unknown instruction '%.*s'", (int)len, word);
+        if (instruction(a, m) != OK) return ERROR;
+        if (!at_eol(a)) return fail(a, "unexpected '%c' after %s", *a->p, m->name);
+        break;
+    }
+
+    // skip the comment, if any, and the newline
+    const char* nl = memchr(a->p, '\n', a->end - a->p);
+    a->p = nl ? nl + 1 : a->end;
+    a->line++;
+    return OK;
+}
+
+// the first undefined label that was used, by line
+static int check_undefined(assembler* a) {
+    label* first = NULL;
+    for (uint32_t i = 0; i <= a->label_mask; i++) {
+        label* l = &a->labels[i];
+        if (l->name && l->pending && (!first || l->first_use < first->first_use)) first = l;
+    }
+    if (!first) return OK;
+    a->line = first->first_use;
+    return fail(a, "undefined label '%.*s'", (int)first->len, first->name);
+}
+
+int assemble(const char* src, size_t len, uint8_t* rom, size_t cap, size_t* size,
+             asm_error* err) {
+    assembler a = {
+        .p = src, .end = src + len, .line = 1,
+        .rom = rom, .cap = cap,
+        .label_mask = 255,
+        .err = err,
+    };
+    int result = ERROR;
+
+    err->line = 0;
+    err->message[0] = '\0';
+    a.labels = calloc(a.label_mask + 1, sizeof(label));
+    if (!a.labels) {
+        fail(&a, "out of memory");
+        return ERROR;
+    }
+    while (a.p < a.end) {
+        if (statement(&a) != OK) goto done;
+    }
+    if (check_undefined(&a) != OK) goto done;
+    *size = a.size;
+    result = OK;
+
+done:
+    free(a.labels);
+    free(a.fixups);
+    return result;
+}
+
+bool asm_source_path(const char* path) {
+    size_t len = strlen(path);
+    return len > 4 && same_word(path + len - 4, 4, ".ASM", 4);
+}
@@ -0,0 +1,29 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * Single-pass assembler for test_program.asm-style sources: one
+ * instruction per line, `label:` definitions, `;` comments, decimal, 0x,
+ * 0b and 'c' literals, and labels anywhere an address or immediate goes.
+ * Mnemonics and registers are case-insensitive, labels are not.
+ *
+ * ADD, SUB and MOV pick the IMM8 opcode when the value is known and fits
+ * in a byte, IMM16 otherwise; a forward reference is not known yet, so it
+ * always gets IMM16 and is backpatched when the label is defined.
+ *
+ * Machine code goes straight into rom (cap bytes). Returns OK with the
+ * code size in *size, or ERROR with err filled in.
+ */
+int assemble(const char* src, size_t len, uint8_t* rom, size_t cap, size_t* size,
+             asm_error* err);
+
+// true for paths that name assembler source (*.asm) rather than a ROM image
+bool asm_source_path(const char* path);
+
+#endif
@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef VM_STATS
+#include <time.h>
+#endif
+
+#include "vm.h"
+#include "input.h"
+#include "asm.h"
+#include "batch.h"
+#include "lockstep.h"
+
+typedef struct {
+    uint8_t* data;
+    size_t len, cap;
+    bool overflow; // ran out of memory, the rest was dropped
+} job_output;
+
+typedef struct {
+    const char* rom_path;    // all three point into the manifest text
+    const char* input_path;  // NULL: no input
+    const char* output_path; // NULL: stdout, in manifest order
+    size_t line;
+    const vm* rom;           // loaded once per distinct rom_path
+
+    vm_status status;
+    size_t pc;
+    uint64_t instructions;
+    const char* failed_file; // input or output that could not be used
+    int error;               // its errno
+    job_output out;
+    bool done;               // guarded by batch.print_lock
+} job;
+
+/*
+ * Chase-Lev work-stealing deque of job indices. The owner pops from the
+ * bottom, thieves take from the top. All jobs are pushed before the
+ * workers start, so the array never grows and is never written again.
+ */
+typedef struct {
+    _Atomic long top;
+    _Atomic long bottom;
+    uint32_t* items;
+} deque;
+
+typedef enum { STEAL_EMPTY, STEAL_OK, STEAL_RETRY } steal_result;
+
+struct batch;
+
+typedef struct {
+    deque dq;
+    struct batch* b;
+    uint32_t seed; // victim selection
+    pthread_t thread;
+    lockstep* ls;  // --lockstep, created on first use
+} worker;
+
+/*
+ * --lockstep: jobs of one ROM, up to LOCKSTEP_LANES of them in manifest
+ * order, run together as one group; the deques then hold group indices.
+ */
+typedef struct {
+    uint32_t first; // into batch.grouped
+    uint32_t n;
+} job_group;
+
+typedef struct batch {
+    job* jobs;
+    size_t n_jobs;
+    worker* workers;
+    int n_workers;
+    atomic_size_t unclaimed; // jobs (or groups) still sitting in some deque
+    job** grouped;           // jobs by ROM, then manifest order
+    job_group* groups;       // NULL without --lockstep
+    size_t n_groups;
+
+    pthread_mutex_t print_lock;
+    size_t next_print;       // first job not yet reported
+    size_t failed;
+    const char* manifest;
+} batch;
+
+static bool deque_pop(deque* d, uint32_t* item) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    *item = d->items[b];
+    if (t < b) return true;
+
+    // the last item: race the thieves for it
+    bool won = atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                       memory_order_seq_cst,
+                                                       memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return won;
+}
+
+static steal_result deque_steal(deque* d, uint32_t* item) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (t >= b) return STEAL_EMPTY;
+    *item = d->items[t];
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return STEAL_RETRY;
+    return STEAL_OK;
+}
+
+// try every other worker once, starting at a random one
+static bool steal(worker* w, uint32_t* item) {
+    batch* b = w->b;
+
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    int start = w->seed % b->n_workers;
+    for (int i = 0; i < b->n_workers; i++) {
+        worker* victim = &b->workers[(start + i) % b->n_workers];
+        if (victim == w) continue;
+        if (deque_steal(&victim->dq, item) == STEAL_OK) return true;
+    }
+    return false;
+}
+
+// per-job I/O: output into memory, input from the job's file
+typedef struct {
+    job_output* out;
+    in_reader in;
+} job_io;
+
+static void put(job_output* o, const uint8_t* bytes, size_t n) {
+    if (o->len + n > o->cap) {
+        size_t cap = o->cap ? o->cap : 4096;
+        while (cap < o->len + n) cap *= 2;
+        uint8_t* data = realloc(o->data, cap);
+        if (!data) {
+            o->overflow = true;
+            return;
+        }
+        o->data = data;
+        o->cap = cap;
+    }
+    memcpy(o->data + o->len, bytes, n);
+    o->len += n;
+}
+
+static void job_print_ascii(void* ctx, uint8_t c) {
+    put(((job_io*)ctx)->out, &c, 1);
+}
+
+static void job_print_decimal(void* ctx, uint16_t value) {
+    uint8_t digits[5]; // 65535
+    size_t n = sizeof digits;
+
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    put(((job_io*)ctx)->out, digits + n, sizeof digits - n);
+}
+
+static void job_print_bits(void* ctx, uint8_t value) {
+    uint8_t bits[9];
+    for (int i = 0; i < 8; i++)
+        bits[i] = (value >> (7 - i)) & 1 ? '1' : '0';
+    bits[8] = '\n';
+    put(((job_io*)ctx)->out, bits, sizeof bits);
+}
+
+static uint8_t job_in(void* ctx) {
+    return in_read_byte(&((job_io*)ctx)->in);
+}
+
+static uint8_t job_in_decimal(void* ctx) {
+    return in_read_decimal(&((job_io*)ctx)->in);
+}
+
+static uint8_t job_in_binary(void* ctx) {
+    return in_read_binary(&((job_io*)ctx)->in);
+}
+
+static bool write_all(int fd, const uint8_t* p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool job_succeeded(const job* j) {
+    return !j->failed_file && !j->out.overflow
+        && (j->status == VM_HALTED || j->status == VM_END_OF_ROM);
+}
+
+// called in manifest order under print_lock
+static void report(batch* b, job* j) {
+    if (!j->output_path && j->out.len)
+        write_all(STDOUT_FILENO, j->out.data, j->out.len);
+    free(j->out.data);
+    j->out.data = NULL;
+
+    if (job_succeeded(j)) return;
+    b->failed++;
+    if (j->failed_file)
+        fprintf(stderr, "%s:%zu: %s: %s\n", b->manifest, j->line, j->failed_file, strerror(j->error));
+    else if (j->out.overflow)
+        fprintf(stderr, "%s:%zu: %s: output dropped, out of memory\n", b->manifest, j->line, j->rom_path);
+    else
+        fprintf(stderr, "%s:%zu: %s: %s at PC=%zu\n", b->manifest, j->line, j->rom_path,
+                vm_status_string(j->status), j->pc);
+}
+
+static void finish(batch* b, job* j) {
+    pthread_mutex_lock(&b->print_lock);
+    j->done = true;
+    while (b->next_print < b->n_jobs && b->jobs[b->next_print].done)
+        report(b, &b->jobs[b->next_print++]);
+    pthread_mutex_unlock(&b->print_lock);
+}
+
+// open j's input for io; false, with j failed, if it can't be read
+static bool job_start(job* j, job_io* io, int* in_fd) {
+    *io = (job_io){ .out = &j->out, .in = { .at_eof = true } }; // no input reads as EOF
+    *in_fd = -1;
+    if (!j->input_path) return true;
+
+    *in_fd = open(j->input_path, O_RDONLY);
+    if (*in_fd < 0) {
+        j->failed_file = j->input_path;
+        j->error = errno;
+        return false;
+    }
+    in_open(&io->in, *in_fd);
+    return true;
+}
+
+// close the input and write the output file, if j has one
+static void job_end(job* j, job_io* io, int in_fd) {
+    if (in_fd >= 0) {
+        in_close(&io->in);
+        close(in_fd);
+    }
+
+    if (j->output_path) {
+        int fd = open(j->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0 || !write_all(fd, j->out.data, j->out.len)) {
+            j->failed_file = j->output_path;
+            j->error = errno;
+        }
+        if (fd >= 0) close(fd);
+    }
+}
+
+static vm_io job_callbacks(job_io* io) {
+    vm_io callbacks = {
+        io, job_print_ascii, job_print_decimal, job_print_bits,
+        job_in, job_in_decimal, job_in_binary, NULL,
+    };
+    return callbacks;
+}
+
+static void run_job(vm* m, job* j) {
+    job_io io;
+    int in_fd;
+
+    if (!job_start(j, &io, &in_fd)) return;
+    j->status = vm_load_shared(m, j->rom);
+    if (j->status == VM_OK) {
+        vm_io callbacks = job_callbacks(&io);
+        vm_set_io(m, &callbacks);
+        j->status = vm_run(m, 0);
+        j->pc = vm_cpu(m)->PC;
+        j->instructions = vm_instructions(m);
+    }
+    job_end(j, &io, in_fd);
+}
+
+// the jobs of g as the lanes of one lockstep run, then all reported
+static void run_group(worker* w, const job_group* g) {
+    batch* b = w->b;
+    job* lanes[LOCKSTEP_LANES];
+    job_io io[LOCKSTEP_LANES];
+    int in_fd[LOCKSTEP_LANES];
+    vm_io callbacks[LOCKSTEP_LANES];
+    size_t n = 0;
+
+    if (!w->ls) w->ls = lockstep_create();
+    for (uint32_t k = 0; k < g->n; k++) {
+        job* j = b->grouped[g->first + k];
+        if (!w->ls) j->status = VM_ERR_NO_MEMORY;
+        else if (job_start(j, &io[n], &in_fd[n])) lanes[n++] = j;
+    }
+    if (n) {
+        for (size_t i = 0; i < n; i++) callbacks[i] = job_callbacks(&io[i]);
+        lockstep_run(w->ls, lanes[0]->rom, n, callbacks);
+    }
+    for (size_t i = 0; i < n; i++) {
+        job* j = lanes[i];
+        j->status = lockstep_status(w->ls, i);
+        j->pc = lockstep_cpu(w->ls, i).PC;
+        j->instructions = lockstep_instructions(w->ls, i);
+        job_end(j, &io[i], in_fd[i]);
+    }
+    for (uint32_t k = 0; k < g->n; k++) finish(b, b->grouped[g->first + k]);
+}
+
+static void* worker_main(void* arg) {
+    worker* w = arg;
+    batch* b = w->b;
+    vm* m = vm_create();
+    uint32_t i;
+
+    for (;;) {
+        if (deque_pop(&w->dq, &i) || steal(w, &i)) {
+            atomic_fetch_sub_explicit(&b->unclaimed, 1, memory_order_relaxed);
+            if (b->groups) {
+                run_group(w, &b->groups[i]);
+                continue;
+            }
+            job* j = &b->jobs[i];
+            if (m) run_job(m, j);
+            else j->status = VM_ERR_NO_MEMORY;
+            finish(b, j);
+        }
+        else if (atomic_load_explicit(&b->unclaimed, memory_order_relaxed) == 0) {
+            break;
+        }
+        else {
+            sched_yield(); // the remaining jobs are being stolen by others
+        }
+    }
+    vm_destroy(m);
+    lockstep_destroy(w->ls);
+    return NULL;
+}
+
+// the whole manifest, NUL-terminated; NULL with errno set on failure
+static char* read_manifest(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    size_t len = 0, cap = 4096;
+    char* text = malloc(cap);
+    while (text) {
+        len += fread(text + len, 1, cap - len - 1, f);
+        if (len < cap - 1) break;
+        cap *= 2;
+        char* bigger = realloc(text, cap);
+        if (!bigger) free(text);
+        text = bigger;
+    }
+    if (text && ferror(f)) {
+        free(text);
+        text = NULL;
+    }
+    fclose(f);
+    if (text) text[len] = '\0';
+    return text;
+}
+
+static char* next_field(char** p) {
+    char* s = *p;
+    while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+    if (!*s) {
+        *p = s;
+        return NULL;
+    }
+    char* e = s;
+    while (*e && *e != ' ' && *e != '\t' && *e != '\r') e++;
+    if (*e) *e++ = '\0';
+    *p = e;
+    return s;
+}
+
+// split the manifest text in place into jobs; false on a malformed line
+static bool parse_manifest(batch* b, char* text) {
+    size_t cap = 0;
+    size_t line = 0;
+
+    for (char* s = text; *s; ) {
+        char* eol = strchr(s, '\n');
+        if (eol) *eol = '\0';
+        line++;
+
+        char* rest = s;
+        char* fields[4];
+        int n = 0;
+        while (n < 4 && (fields[n] = next_field(&rest))) n++;
+        s = eol ? eol + 1 : s + strlen(s);
+        if (n == 0 || fields[0][0] == '#') continue;
+        if (n > 3) {
+            fprintf(stderr, "%s:%zu: expected `rom [input [output]]`\n", b->manifest, line);
+            return false;
+        }
+
+        if (b->n_jobs == cap) {
+            cap = cap ? cap * 2 : 256;
+            job* jobs = realloc(b->jobs, cap * sizeof(job));
+            if (!jobs) {
+                perror("Couldn't read manifest.");
+                return false;
+            }
+            b->jobs = jobs;
+        }
+        job* j = &b->jobs[b->n_jobs++];
+        memset(j, 0, sizeof(*j));
+        j->rom_path = fields[0];
+        j->input_path = n > 1 && strcmp(fields[1], "-") != 0 ? fields[1] : NULL;
+        j->output_path = n > 2 ? fields[2] : NULL;
+        j->line = line;
+    }
+    return true;
+}
+
+static int by_rom_path(const void* a, const void* b) {
+    return strcmp((*(job* const*)a)->rom_path, (*(job* const*)b)->rom_path);
+}
+
+/*
+ * Load every distinct ROM once, into roms[]; jobs point at their copy.
+ * Paths are compared as strings, so two spellings of one file load twice.
+ */
+static bool load_roms(batch* b, size_t rom_size, vm*** roms, size_t* n_roms) {
+    job** order = malloc(b->n_jobs * sizeof(job*));
+    *roms = malloc(b->n_jobs * sizeof(vm*));
+    *n_roms = 0;
+    if (!order || !*roms) {
+        free(order);
+        perror("Couldn't load ROMs.");
+        return false;
+    }
+    for (size_t i = 0; i < b->n_jobs; i++) order[i] = &b->jobs[i];
+    qsort(order, b->n_jobs, sizeof(job*), by_rom_path);
+
+    bool ok = true;
+    for (size_t i = 0; i < b->n_jobs && ok; i++) {
+        job* j = order[i];
+        if (i > 0 && strcmp(j->rom_path, order[i - 1]->rom_path) == 0) {
+            j->rom = order[i - 1]->rom;
+            continue;
+        }
+
+        vm* m = vm_create();
+        asm_error err;
+        vm_status status = VM_ERR_NO_MEMORY;
+        if (m && asm_source_path(j->rom_path)) status = vm_load_asm(m, j->rom_path, rom_size, NULL, &err);
+        else if (m) status = vm_load(m, j->rom_path, rom_size, NULL);
+        if (status == VM_ERR_ASSEMBLY) {
+            fprintf(stderr, "%s:%zu: %s:%zu: %s\n", b->manifest, j->line, j->rom_path,
+                    err.line, err.message);
+        }
+        else if (status != VM_OK) {
+            fprintf(stderr, "%s:%zu: %s: %s\n", b->manifest, j->line, j->rom_path,
+                    status == VM_ERR_OPEN ? strerror(errno) : vm_status_string(status));
+        }
+        if (status != VM_OK) {
+            fprintf(stderr, "Error loading ROM.\n");
+            vm_destroy(m);
+            ok = false;
+            break;
+        }
+        (*roms)[(*n_roms)++] = m;
+        j->rom = m;
+    }
+    free(order);
+    return ok;
+}
+
+static int by_rom_then_line(const void* a, const void* b) {
+    const job* x = *(job* const*)a;
+    const job* y = *(job* const*)b;
+    if (x->rom != y->rom) return (uintptr_t)x->rom < (uintptr_t)y->rom ? -1 : 1;
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+// cut the jobs of each ROM into groups of up to LOCKSTEP_LANES
+static bool make_groups(batch* b) {
+    b->grouped = malloc((b->n_jobs ? b->n_jobs : 1) * sizeof(job*));
+    b->groups = malloc((b->n_jobs ? b->n_jobs : 1) * sizeof(job_group));
+    if (!b->grouped || !b->groups) {
+        perror("Couldn't group jobs.");
+        return false;
+    }
+    for (size_t i = 0; i < b->n_jobs; i++) b->grouped[i] = &b->jobs[i];
+    qsort(b->grouped, b->n_jobs, sizeof(job*), by_rom_then_line);
+
+    for (size_t i = 0; i < b->n_jobs; i++) {
+        job_group* g = b->n_groups ? &b->groups[b->n_groups - 1] : NULL;
+        if (g && g->n < LOCKSTEP_LANES && b->grouped[g->first]->rom == b->grouped[i]->rom) {
+            g->n++;
+        }
+        else {
+            b->groups[b->n_groups++] = (job_group){ (uint32_t)i, 1 };
+        }
+    }
+    return true;
+}
+
+#ifdef VM_STATS
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+int batch_run(const char* manifest, int threads, size_t rom_size, bool lockstep) {
+    batch b = { .manifest = manifest };
+    vm** roms = NULL;
+    size_t n_roms = 0;
+    int exit_status = EXIT_FAILURE;
+
+    char* text = read_manifest(manifest);
+    if (!text) {
+        perror("Couldn't read manifest.");
+        return EXIT_FAILURE;
+    }
+    if (!parse_manifest(&b, text) || !load_roms(&b, rom_size, &roms, &n_roms)) goto done;
+    if (lockstep && !make_groups(&b)) goto done;
+    size_t n_items = lockstep ? b.n_groups : b.n_jobs;
+
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > n_items) threads = n_items ? (int)n_items : 1;
+    b.n_workers = threads;
+    b.workers = calloc(threads, sizeof(worker));
+    uint32_t* items = malloc((n_items ? n_items : 1) * sizeof(uint32_t));
+    if (!b.workers || !items) {
+        free(items);
+        perror("Couldn't start workers.");
+        goto done;
+    }
+
+    /*
+     * Deal contiguous runs of the manifest to the workers, pushed in
+     * reverse so each owner works front to back: that keeps stdout
+     * flowing early, while thieves take from the far end.
+     */
+    for (int w = 0; w < threads; w++) {
+        size_t first = n_items * w / threads;
+        size_t last = n_items * (w + 1) / threads;
+        worker* wk = &b.workers[w];
+        wk->b = &b;
+        wk->seed = 2463534242u + w * 2654435761u;
+        wk->dq.items = items + first;
+        for (size_t i = last; i > first; i--)
+            wk->dq.items[last - i] = (uint32_t)(i - 1);
+        atomic_init(&wk->dq.top, 0);
+        atomic_init(&wk->dq.bottom, (long)(last - first));
+    }
+    atomic_init(&b.unclaimed, n_items);
+    pthread_mutex_init(&b.print_lock, NULL);
+
+#ifdef VM_STATS
+    double start_time = now_seconds();
+#endif
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&b.workers[started].thread, NULL, worker_main, &b.workers[started]) != 0)
+            break;
+    }
+    if (started == 0) worker_main(&b.workers[0]); // no threads at all: run them here
+    for (int w = 0; w < started; w++)
+        pthread_join(b.workers[w].thread, NULL);
+#ifdef VM_STATS
+    double elapsed = now_seconds() - start_time;
+    uint64_t instructions = 0;
+    for (size_t i = 0; i < b.n_jobs; i++) instructions += b.jobs[i].instructions;
+    fprintf(stderr, "batch: %zu jobs on %d threads%s in %.3f s (%.1f jobs/s, %.1f M instr/s)\n",
+            b.n_jobs, started ? started : 1, lockstep ? ", lockstep" : "", elapsed,
+            elapsed > 0 ? b.n_jobs / elapsed : 0.0, elapsed > 0 ? instructions / elapsed / 1e6 : 0.0);
+#endif
+
+    pthread_mutex_destroy(&b.print_lock);
+    free(items);
+    if (b.failed == 0) exit_status = EXIT_SUCCESS;
+
+done:
+    for (size_t i = 0; i < n_roms; i++) vm_destroy(roms[i]);
+    free(roms);
+    free(b.groups);
+    free(b.grouped);
+    free(b.workers);
+    free(b.jobs);
+    free(text);
+    return exit_status;
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Batch mode (--batch manifest -j N). The manifest lists one job per
+ * line as `rom [input [output]]`, whitespace separated; blank lines and
+ * lines starting with '#' are skipped. input `-` or none means the IN
+ * opcodes read end of input. A job with an output path writes its PRINT
+ * output there; the others are collected and written to stdout whole, in
+ * manifest order, so jobs never interleave.
+ *
+ * Every distinct ROM path is loaded and verified once and shared by all
+ * of its jobs; each job runs in its own vm with its own RAM. Jobs are
+ * spread over `threads` workers, each with a work-stealing deque.
+ * With `lockstep` (--lockstep) a worker takes up to LOCKSTEP_LANES jobs
+ * of one ROM at a time and runs them together (lockstep.h).
+ * Returns the process exit status: failure if any job did not halt or
+ * run off the end of ROM.
+ */
+int batch_run(const char* manifest, int threads, size_t rom_size, bool lockstep);
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define OK 0
+#define ERROR 1
+
+/*
+ * Safety level, picked at build time with -DVM_SAFETY=n. Every level is
+ * enforced once, when verify() decodes the ROM, so the handlers are the
+ * same for all of them and none carries a check:
+ *
+ *   NONE   every address decodes as an instruction; operands cut off by
+ *          the end of ROM read as zero
+ *   ROM    the same, but an instruction cut off by the end of ROM traps
+ *   FULL   only code reachable from PC 0 is decoded, the rest traps
+ *   JUMPS  FULL, and a jump that leaves ROM or lands inside another
+ *          instruction traps when taken instead of running on
+ *
+ * An unknown opcode traps at every level, and so does running off the
+ * end of ROM or jumping past it below JUMPS.
+ */
+#define VM_SAFETY_NONE 0
+#define VM_SAFETY_ROM 1
+#define VM_SAFETY_FULL 2
+#define VM_SAFETY_JUMPS 3
+
+#ifndef VM_SAFETY
+#define VM_SAFETY VM_SAFETY_FULL
+#endif
+#if VM_SAFETY < VM_SAFETY_NONE || VM_SAFETY > VM_SAFETY_JUMPS
+#error "VM_SAFETY must be 0 (none), 1 (ROM bounds), 2 (full) or 3 (jumps)"
+#endif
+
+// LOAD/STORE take a 16-bit address, so RAM accesses need no runtime check
+_Static_assert(RAM_SIZE > UINT16_MAX, "RAM must cover the 16-bit address space");
+
+/*
+ * Handler indices for the decoded instruction stream. Real opcodes keep
+ * their own value; the internal ones below live in the unassigned
+ * 0x32-0xFE range, which the decoder never passes through unchanged.
+ */
+#define OP_UNKNOWN 0x32   // opcode not in the instruction set
+#define OP_TRUNCATED 0x33 // operand bytes would run past the end of ROM
+#define OP_END 0x34       // fell off the end of ROM
+
+/*
+ * OP_END entries after the last ROM address. One would do if every
+ * instruction fit in ROM, but VM_SAFETY_NONE runs one that is cut off
+ * by the end, which steps up to two entries further.
+ */
+#define CODE_TAIL 3
+
+/*
+ * Superinstructions installed by fuse() at the first address of a
+ * matching sequence. The component instructions keep their own entries,
+ * so a jump into the middle of a sequence still runs them one by one.
+ */
+#define OP_DECM_JNZ 0x35         // LOAD A,[x]; DEC A; STORE A,[x]; CMP A,k; JNZ t
+#define OP_CMP_JNZ 0x36          // CMP A,k; JNZ t
+#define OP_CMP_JZ 0x37           // CMP A,k; JZ t
+#define OP_LOAD_PRINT_DEC 0x38   // LOAD A,[x]; PRINT_DECIMAL A
+#define OP_LOAD_PRINT_ASCII 0x39 // LOAD A,[x]; PRINT_ASCII A
+#define OP_MOV_STORE_A 0x3A      // MOV r,imm8; STORE r,[x] for r = A..D
+#define OP_MOV_STORE_B 0x3B
+#define OP_MOV_STORE_C 0x3C
+#define OP_MOV_STORE_D 0x3D
+#define OP_FUSED_FIRST OP_DECM_JNZ
+#define OP_FUSED_LAST OP_MOV_STORE_D
+
+#define OP_UNVERIFIED 0x3E // address the verifier never reached
+#define OP_BREAK 0x3F      // vm_set_breakpoint(); the real entry is saved in the vm
+
+// VM_SAFETY_JUMPS: JMP, JZ and JNZ whose target is not code, trapping when taken
+#define OP_BAD_JMP 0x40
+#define OP_BAD_JZ 0x41
+#define OP_BAD_JNZ 0x42
+
+// a counting loop evaluated in closed form, installed by find_loops() at its first address (loops.h)
+#define OP_LOOP 0x43
+
+/*
+ * Whether the entry runs more than the instruction at its address, a
+ * superinstruction or a whole loop; rom[pc] is then that instruction,
+ * the first to step through.
+ */
+static inline bool is_compound(uint8_t op) {
+    return (op >= OP_FUSED_FIRST && op <= OP_FUSED_LAST) || op == OP_LOOP;
+}
+
+/*
+ * vm_run() charges its step budget once per run: the instructions from a
+ * PC up to and including the next JMP, JZ, JNZ, HALT or trap, which is
+ * what runs[PC] holds. Straight-line code between branches is then never
+ * checked against the budget.
+ */
+static inline bool ends_run(uint8_t op) {
+    return op == 0x14 || op == 0x22 || op == 0x23 || op == 0xFF
+        || op == OP_UNKNOWN || op == OP_TRUNCATED || op == OP_END || op == OP_UNVERIFIED
+        || (op >= OP_BAD_JMP && op <= OP_BAD_JNZ);
+}
+
+/*
+ * One decoded instruction. verify() fills the entry of every reachable
+ * ROM address, so jumps can land anywhere, plus trailing OP_END entries
+ * for running off the end. The immediate is already assembled and the
+ * bounds check is done once there: an instruction whose operands would
+ * cross the end of ROM decodes to OP_TRUNCATED and traps if executed.
+ */
+typedef struct {
+    uint16_t imm; // IMM8 or little-endian IMM16 operand
+    uint8_t op;   // opcode or OP_* handler index
+    uint8_t len;  // instruction length in bytes
+} decoded_op;
+
+struct jit_state;
+struct loop;
+struct exectrace;
+struct exec_record;
+struct vm_stdio;
+
+/*
+ * The vm handle behind vm.h; shared by vm.c, verify.c and jit.c. It is
+ * allocated on a cache line, and the registers plus everything vm_run()
+ * loads on entry fit in that first line.
+ */
+#define VM_CACHE_LINE 64
+
+struct vm {
+    _Alignas(VM_CACHE_LINE) cpu_state cpu;
+    const uint8_t* rom;     // ROM_MAX_SIZE read-only bytes, zero past the image
+    size_t rom_size;
+    decoded_op* code;       // rom_size + CODE_TAIL entries
+    uint32_t* runs;         // rom_size + CODE_TAIL entries, in the same mapping as code
+    uint8_t* ram;           // RAM_SIZE bytes
+    vm_io io;
+    verify_report report;
+    uint64_t instructions;  // executed since load or reset
+    struct jit_state* jit;  // NULL unless -DVM_JIT and available
+    bool shared;            // rom and code belong to another vm (vm_load_shared)
+    bool has_breakpoint;
+    size_t breakpoint;      // PC whose code[] entry is OP_BREAK
+    uint8_t breakpoint_op;  // and the op it replaced
+    bool interpret_only;    // vm_interpret_only(): no compiled code until the next load
+    uint64_t io_at;         // instruction count, this one included, of the I/O op in progress
+    size_t io_pc;           // and its PC; both only kept up to date by the interpreter
+    struct loop* loops;     // found by find_loops(), by head address; shared like code
+    size_t n_loops;
+    struct exectrace* exectrace;    // exectrace_open(), NULL when not tracing
+    struct exec_record* trace_at;   // where the interpreter appends the next record
+    struct vm_stdio* stdio; // output ring and stdin reader behind the default io
+};
+
+_Static_assert(sizeof(cpu_state) == 16, "cpu_state is 16 bytes");
+_Static_assert(offsetof(struct vm, ram) + sizeof(uint8_t*) <= VM_CACHE_LINE,
+               "registers and the pointers vm_run() loads share a cache line");
+
+// I/O opcodes 0x2C-0x31, shared by the interpreter and compiled code
+void io_print_ascii(vm* m, uint16_t a);
+uint16_t io_in(vm* m);
+void io_print_decimal(vm* m, uint16_t a);
+void io_print_bits(vm* m, uint16_t a);
+uint16_t io_in_decimal(vm* m);
+uint16_t io_in_binary(vm* m);
+
+// drop m's compiled code until the next load, so all I/O sets io_at and io_pc
+void vm_interpret_only(vm* m);
+
+// ROM identity (size and contents) for snapshot and trace files
+uint64_t rom_hash(const vm* m);
+
+#endif
@@ -0,0 +1,797 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "exectrace.h"
+#include "profile.h"
+
+/*
+ * File layout: the header, the ROM image and what runs at each of its
+ * entries (EXEC_RUNS...) packed together, blocks, then the end record. A block is an
+ * exec_block, whose checkpoint is the state going into its first
+ * instruction, followed by its packed bytes. Unpacked, they are the
+ * exec_records of its LOADs and INs in order, in host byte order like
+ * the headers, each with its PC as the step from the record before (from
+ * the checkpoint, for the first). A loop's body comes to the same records
+ * every iteration, which the packer then finds, and one without a LOAD to
+ * none at all; straight-line code that loads at a regular stride comes to
+ * the same record over and over.
+ */
+#define EXEC_VERSION 3
+#define EXEC_CHUNKS 64                 // in the ring, 1 MB
+#define EXEC_PCS (ROM_MAX_SIZE + CODE_TAIL)
+#define EXEC_RAW_MAX (EXEC_CHECKPOINT * sizeof(exec_record))
+#define EXEC_ROM_BYTES(rom_size) (2 * (size_t)(rom_size) + CODE_TAIL) // the image and its map
+#define EXEC_IDLE_MS 10                // how long the writer leaves a few chunks waiting
+
+// what the decoded entry at a PC does, as the trace keeps it
+#define EXEC_RUNS 0        // the instruction the ROM has there
+#define EXEC_TRAPS 1       // nothing: HALT, or a trap
+#define EXEC_TRAPS_TAKEN 2 // traps if the jump there is taken (VM_SAFETY_JUMPS)
+
+/*
+ * EXEC_LANES records as a GCC/Clang vector type, a PC and a delta in
+ * every pair of lanes, so a block's PCs turn into steps with plain SSE2.
+ */
+#define EXEC_LANES 4
+typedef uint16_t record_lanes __attribute__((vector_size(EXEC_LANES * sizeof(exec_record))));
+static const record_lanes pc_lanes = { UINT16_MAX, 0, UINT16_MAX, 0, UINT16_MAX, 0, UINT16_MAX, 0 };
+
+// the packer's match finder: last position of every hashed 4-byte string
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+
+typedef struct {
+    char magic[8];       // "SCPUEXEC"
+    uint32_t version;
+    uint32_t rom_size;   // the ROM image, then rom_size + CODE_TAIL EXEC_RUNS...
+    uint64_t rom_hash;
+    uint64_t start;      // the vm's instruction count when tracing began
+    uint32_t checkpoint; // instructions per block at most
+    uint32_t rom_packed; // which follow packed in this many bytes
+} exec_header;
+
+_Static_assert(EXEC_ROM_BYTES(ROM_MAX_SIZE) <= EXEC_RAW_MAX, "the ROM and its map pack from the block buffers");
+
+typedef struct {
+    uint64_t first;       // its first instruction, counted from the start of the trace
+    uint32_t count;       // instructions in the block
+    uint32_t raw_size;    // bytes its records take unpacked
+    uint32_t packed_size; // and packed, as they follow
+    uint32_t pc;          // the checkpoint
+    uint16_t a, b, c, d;
+    uint8_t z;
+    uint8_t reserved[7];
+} exec_block;
+
+typedef struct {
+    char magic[8];        // "SCPUEXND"
+    uint64_t instructions;
+    uint64_t blocks;
+    uint32_t pc;          // the state after the last instruction
+    uint16_t a, b, c, d;
+    uint8_t z;
+    uint8_t reserved[7];
+} exec_end;
+
+/*
+ * A chunk of the ring once the interpreter is done with it. One that
+ * ends a block says where; the next one then starts the next block.
+ */
+typedef struct {
+    uint32_t count;   // records in it
+    bool ends;        // a block
+    cpu_state start;  // the state going into the block it starts, if it does
+    uint64_t first;   // and the vm's instruction count there
+    cpu_state end;    // the state after the block it ends, if it does
+    uint64_t last;
+} exec_chunk;
+
+static const char magic[8] = { 'S', 'C', 'P', 'U', 'E', 'X', 'E', 'C' };
+static const char end_magic[8] = { 'S', 'C', 'P', 'U', 'E', 'X', 'N', 'D' };
+
+// instruction length by opcode, 0 outside the instruction set and for HALT, which stays put
+static const uint8_t advance[256] = {
+    [0x00 ... 0x07] = 2, // ADD/SUB r, IMM8
+    [0x08 ... 0x0F] = 1, // INC/DEC r
+    [0x10 ... 0x13] = 2, // MOV r, IMM8
+    [0x14 ... 0x2B] = 3, // JMP, IMM16 forms, CMP, JZ/JNZ, LOAD/STORE
+    [0x2C ... 0x31] = 1, // PRINT/IN
+};
+
+struct exectrace {
+    vm* m;
+
+    // the ring: the interpreter fills chunks, the writer empties them
+    exec_record* ring;                  // EXEC_CHUNKS * EXEC_CHUNK records, chunk-aligned
+    exec_chunk chunks[EXEC_CHUNKS];
+    _Atomic uint64_t published;         // chunks handed to the writer
+    _Atomic uint64_t consumed;          // and given back
+    atomic_bool closing;                // the last chunk is published
+    atomic_bool writer_waiting;         // for chunks to be published
+    atomic_bool producer_waiting;       // for a free chunk
+    pthread_mutex_t lock;               // only to sleep on; the ring takes none
+    pthread_cond_t more;                // the writer's wakeup
+    pthread_cond_t room;                // the interpreter's
+    uint64_t first;                     // the vm's instruction count where the block began
+    cpu_state paused;                   // m->cpu as the last vm_run() left it
+    uint64_t paused_at;                 // and m->instructions
+    pthread_t writer;
+
+    // the writer's
+    int fd;
+    int error;                          // errno of the first failed write, or 0
+    uint64_t instructions;              // taken so far
+    uint64_t blocks;                    // written so far
+    exec_block block;                   // the block being filled
+    uint64_t block_first;               // the vm's instruction count where it began
+    uint32_t records;                   // its records so far, in raw
+    uint16_t last_pc;                   // the PC of the last of them
+    exec_record* raw;                   // EXEC_CHECKPOINT of them at most
+    uint8_t* packed;                    // room for them packed
+    uint32_t* lz_table;
+    uint32_t lz_base;                   // what lz_table holds at or below is from earlier blocks
+};
+
+static bool write_all(int fd, const void* buf, size_t n) {
+    const uint8_t* p = buf;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static void write_out(exectrace* t, const void* buf, size_t n) {
+    if (!t->error && !write_all(t->fd, buf, n)) t->error = errno;
+}
+
+static uint8_t* put_varint(uint8_t* p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// NULL past end or if damaged
+static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint32_t* v) {
+    *v = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t b = *p++;
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return p;
+    }
+    return NULL;
+}
+
+/*
+ * The packer: LZ77 over a block's steps. Its output is a list of
+ * (literal count, literals, match length - LZ_MIN_MATCH + 1, distance)
+ * with varint counts; a match length of 0 ends it. Only the last
+ * position of each hash is kept and matches are taken greedily, which
+ * is enough for the long exact repeats loops make. Positions go into the
+ * table past base, so what earlier blocks left there reads as empty
+ * without clearing it for every block.
+ */
+static uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// the bytes at a and b that agree, up to limit
+static size_t lz_extend(const uint8_t* a, const uint8_t* b, size_t limit) {
+    size_t n = 0;
+    for (; n + 8 <= limit; n += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) {
+            while (a[n] == b[n]) n++;
+            return n;
+        }
+    }
+    while (n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+// worst case: every 4 bytes a short match coded in up to 5
+static size_t lz_bound(size_t n) {
+    return n + n / 2 + 16;
+}
+
+static size_t lz_pack(const uint8_t* in, size_t n, uint8_t* out, uint32_t* table, uint32_t base) {
+    uint8_t* o = out;
+    size_t lit = 0, i = 0;
+    unsigned misses = 0;
+
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t h = lz_hash(in + i);
+        size_t from = table[h] > base ? table[h] - base : 0; // position + 1
+        table[h] = base + (uint32_t)i + 1;
+        size_t len = from ? lz_extend(in + from - 1, in + i, n - i) : 0;
+        if (len < LZ_MIN_MATCH) {
+            i += 1 + (misses++ >> 5); // skip faster through what doesn't repeat
+            continue;
+        }
+        misses = 0;
+        o = put_varint(o, (uint32_t)(i - lit));
+        memcpy(o, in + lit, i - lit);
+        o += i - lit;
+        o = put_varint(o, (uint32_t)(len - LZ_MIN_MATCH + 1));
+        o = put_varint(o, (uint32_t)(i - (from - 1)));
+        i += len;
+        lit = i;
+    }
+    o = put_varint(o, (uint32_t)(n - lit));
+    memcpy(o, in + lit, n - lit);
+    o += n - lit;
+    *o++ = 0;
+    return (size_t)(o - out);
+}
+
+// false unless in unpacks to exactly n bytes
+static bool lz_unpack(const uint8_t* in, size_t in_size, uint8_t* out, size_t n) {
+    const uint8_t* end = in + in_size;
+    size_t o = 0;
+    for (;;) {
+        uint32_t lit, len, distance;
+        if (!(in = get_varint(in, end, &lit)) || lit > (size_t)(end - in) || lit > n - o) return false;
+        memcpy(out + o, in, lit);
+        in += lit;
+        o += lit;
+        if (!(in = get_varint(in, end, &len))) return false;
+        if (len == 0) return o == n && in == end;
+        len += LZ_MIN_MATCH - 1;
+        if (!(in = get_varint(in, end, &distance)) || distance == 0 || distance > o || len > n - o) return false;
+        for (uint32_t k = 0; k < len; k++, o++) out[o] = out[o - distance]; // may overlap
+    }
+}
+
+static bool same_state(const cpu_state* a, const cpu_state* b) {
+    return a->A == b->A && a->B == b->B && a->C == b->C && a->D == b->D
+           && a->Z == b->Z && a->PC == b->PC;
+}
+
+static void end_block(exectrace* t, uint64_t last) {
+    uint64_t count = last - t->block_first;
+    if (count == 0) return; // the host set the registers straight away
+    size_t raw_size = t->records * sizeof(exec_record);
+    if (t->lz_base > UINT32_MAX - EXEC_RAW_MAX) {
+        memset(t->lz_table, 0, sizeof(uint32_t) << LZ_HASH_BITS);
+        t->lz_base = 0;
+    }
+    size_t packed = lz_pack((const uint8_t*)t->raw, raw_size, t->packed, t->lz_table, t->lz_base);
+    t->lz_base += (uint32_t)raw_size;
+    t->block.count = (uint32_t)count;
+    t->block.raw_size = (uint32_t)raw_size;
+    t->block.packed_size = (uint32_t)packed;
+    write_out(t, &t->block, sizeof(t->block));
+    write_out(t, t->packed, packed);
+    t->blocks++;
+    t->instructions += count;
+}
+
+// add chunk c's records to the block, starting or ending it where c says
+static void take_chunk(exectrace* t, const exec_record* records, const exec_chunk* c, bool starts) {
+    if (starts) {
+        t->block = (exec_block){
+            .first = t->instructions,
+            .pc = c->start.PC,
+            .a = c->start.A, .b = c->start.B, .c = c->start.C, .d = c->start.D,
+            .z = c->start.Z,
+        };
+        t->block_first = c->first;
+        t->records = 0;
+        t->last_pc = (uint16_t)c->start.PC;
+    }
+    // the PCs as steps, EXEC_LANES records at a time against the ones a record back
+    exec_record* raw = t->raw + t->records;
+    uint32_t i = 0;
+    if (c->count) {
+        raw[0] = (exec_record){ (uint16_t)(records[0].pc - t->last_pc), records[0].delta };
+        t->last_pc = records[c->count - 1].pc;
+        i = 1;
+    }
+    for (; i + EXEC_LANES <= c->count; i += EXEC_LANES) {
+        record_lanes now, before;
+        memcpy(&now, records + i, sizeof(now));
+        memcpy(&before, records + i - 1, sizeof(before));
+        now -= before & pc_lanes;
+        memcpy(raw + i, &now, sizeof(now));
+    }
+    for (; i < c->count; i++) {
+        raw[i] = (exec_record){ (uint16_t)(records[i].pc - records[i - 1].pc), records[i].delta };
+    }
+    t->records += c->count;
+    if (c->ends) end_block(t, c->last);
+}
+
+static exec_record* chunk(exectrace* t, uint64_t n) {
+    return t->ring + (n % EXEC_CHUNKS) * EXEC_CHUNK;
+}
+
+static void finish(exectrace* t) {
+    const cpu_state* cpu = &t->paused;
+    exec_end e = {
+        .instructions = t->instructions,
+        .blocks = t->blocks,
+        .pc = cpu->PC,
+        .a = cpu->A, .b = cpu->B, .c = cpu->C, .d = cpu->D,
+        .z = cpu->Z,
+    };
+    memcpy(e.magic, end_magic, sizeof(end_magic));
+    write_out(t, &e, sizeof(e));
+}
+
+/*
+ * Sleeping and waking around the ring. The side about to sleep says so
+ * and looks again under the lock; the other side makes its progress
+ * visible before it looks whether to wake it, so one of them always
+ * sees the other. Each wakes the other only once there is a good part
+ * of the ring to work through, so that on a single CPU they take turns
+ * by the half ring rather than by the chunk.
+ */
+static void wait_for_chunks(exectrace* t, uint64_t n) {
+    pthread_mutex_lock(&t->lock);
+    atomic_store(&t->writer_waiting, true);
+    if (n == atomic_load(&t->published) && !atomic_load(&t->closing)) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += EXEC_IDLE_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&t->more, &t->lock, &until);
+    }
+    atomic_store(&t->writer_waiting, false);
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void wake(exectrace* t, pthread_cond_t* cond) {
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// take chunks as they are published, until the last one
+static void* write_trace(void* arg) {
+    exectrace* t = arg;
+    uint64_t n = 0;
+    bool starts = true;
+    for (;;) {
+        uint64_t published = atomic_load(&t->published);
+        if (n == published) {
+            // published before closing was set: this sees the last chunk
+            if (atomic_load(&t->closing) && n == atomic_load(&t->published)) break;
+            wait_for_chunks(t, n);
+            continue;
+        }
+        const exec_chunk* c = &t->chunks[n % EXEC_CHUNKS];
+        take_chunk(t, chunk(t, n), c, starts);
+        starts = c->ends;
+        atomic_store(&t->consumed, ++n);
+        if (atomic_load(&t->producer_waiting) && published - n <= EXEC_CHUNKS / 2) wake(t, &t->room);
+    }
+    finish(t);
+    return NULL;
+}
+
+// publish the chunk `at` ends, and wait for the next one; where that starts
+static exec_record* hand_over(exectrace* t, const exec_record* at) {
+    uint64_t n = atomic_load_explicit(&t->published, memory_order_relaxed);
+    t->chunks[n % EXEC_CHUNKS].count = (uint32_t)(at - chunk(t, n));
+    atomic_store(&t->published, ++n);
+    if (atomic_load(&t->writer_waiting) && n - atomic_load(&t->consumed) >= EXEC_CHUNKS / 2) {
+        wake(t, &t->more);
+    }
+    if (n - atomic_load(&t->consumed) == EXEC_CHUNKS) {
+        pthread_mutex_lock(&t->lock);
+        atomic_store(&t->producer_waiting, true);
+        while (n - atomic_load(&t->consumed) == EXEC_CHUNKS) {
+            pthread_cond_signal(&t->more); // it may have gone to sleep short of half a ring
+            pthread_cond_wait(&t->room, &t->lock);
+        }
+        atomic_store(&t->producer_waiting, false);
+        pthread_mutex_unlock(&t->lock);
+    }
+    t->chunks[n % EXEC_CHUNKS].ends = false;
+    return chunk(t, n);
+}
+
+// the current chunk ends the block with end; the next starts one with m's state
+static void checkpoint(exectrace* t, cpu_state end, uint64_t last) {
+    vm* m = t->m;
+    uint64_t n = atomic_load_explicit(&t->published, memory_order_relaxed);
+    exec_chunk* c = &t->chunks[n % EXEC_CHUNKS];
+    c->ends = true;
+    c->end = end;
+    c->last = last;
+    m->trace_at = hand_over(t, m->trace_at);
+    c = &t->chunks[(n + 1) % EXEC_CHUNKS];
+    c->start = m->cpu;
+    c->first = m->instructions;
+    t->first = m->instructions;
+}
+
+exec_record* exectrace_next_chunk(vm* m, exec_record* at) {
+    return hand_over(m->exectrace, at);
+}
+
+void exectrace_resume(vm* m) {
+    exectrace* t = m->exectrace;
+    // the host set the registers: replay has to start over from them
+    if (!same_state(&m->cpu, &t->paused) || m->instructions != t->paused_at) {
+        checkpoint(t, t->paused, t->paused_at);
+    }
+}
+
+uint64_t exectrace_budget(vm* m, uint64_t left) {
+    exectrace* t = m->exectrace;
+    if (m->instructions - t->first >= EXEC_CHECKPOINT) checkpoint(t, m->cpu, m->instructions);
+    uint64_t room = EXEC_CHECKPOINT - (m->instructions - t->first);
+    return left < room ? left : room;
+}
+
+void exectrace_pause(vm* m) {
+    exectrace* t = m->exectrace;
+    t->paused = m->cpu;
+    t->paused_at = m->instructions;
+}
+
+// what runs at each of m's code[] entries, rom_size + CODE_TAIL of them
+static void fill_traps(uint8_t* traps, const vm* m) {
+    for (size_t pc = 0; pc < m->rom_size + CODE_TAIL; pc++) {
+        uint8_t op = m->has_breakpoint && pc == m->breakpoint ? m->breakpoint_op : m->code[pc].op;
+        if (op == 0xFF || op == OP_UNKNOWN || op == OP_TRUNCATED || op == OP_END || op == OP_UNVERIFIED) {
+            traps[pc] = EXEC_TRAPS;
+        }
+        else if (op >= OP_BAD_JMP && op <= OP_BAD_JNZ) {
+            traps[pc] = EXEC_TRAPS_TAKEN;
+        }
+        else {
+            traps[pc] = EXEC_RUNS;
+        }
+    }
+}
+
+static void free_trace(exectrace* t) {
+    free(t->ring);
+    free(t->raw);
+    free(t->packed);
+    free(t->lz_table);
+    free(t);
+}
+
+exectrace* exectrace_open(vm* m, const char* path, const char** error) {
+    *error = NULL;
+    if (!m->code) {
+        *error = vm_status_string(VM_ERR_NO_ROM);
+        return NULL;
+    }
+    if (m->exectrace) {
+        *error = "the vm is already being traced";
+        return NULL;
+    }
+
+    exectrace* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->m = m;
+    t->ring = aligned_alloc(EXEC_CHUNK_BYTES, EXEC_CHUNKS * EXEC_CHUNK_BYTES);
+    t->raw = malloc(EXEC_RAW_MAX);
+    t->packed = malloc(lz_bound(EXEC_RAW_MAX));
+    t->lz_table = calloc(1, sizeof(uint32_t) << LZ_HASH_BITS);
+    if (!t->ring || !t->raw || !t->packed || !t->lz_table) {
+        free_trace(t);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    exec_header h = {
+        .version = EXEC_VERSION,
+        .rom_size = (uint32_t)m->rom_size,
+        .rom_hash = rom_hash(m),
+        .start = vm_instructions(m),
+        .checkpoint = EXEC_CHECKPOINT,
+    };
+    memcpy(h.magic, magic, sizeof(magic));
+    // mostly zero padding and long runs of one entry, so packed they come to little
+    uint8_t* image = (uint8_t*)t->raw;
+    size_t image_size = EXEC_ROM_BYTES(m->rom_size);
+    memcpy(image, m->rom, m->rom_size);
+    fill_traps(image + m->rom_size, m);
+    h.rom_packed = (uint32_t)lz_pack(image, image_size, t->packed, t->lz_table, 0);
+    t->lz_base = (uint32_t)image_size; // so the first block finds nothing of it
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (t->fd < 0 || !write_all(t->fd, &h, sizeof(h)) || !write_all(t->fd, t->packed, h.rom_packed)) {
+        int err = errno;
+        if (t->fd >= 0) close(t->fd);
+        free_trace(t);
+        errno = err;
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->more, NULL);
+    pthread_cond_init(&t->room, NULL);
+    int err = pthread_create(&t->writer, NULL, write_trace, t);
+    if (err) {
+        close(t->fd);
+        free_trace(t);
+        errno = err;
+        return NULL;
+    }
+
+    vm_interpret_only(m);
+    t->chunks[0].start = m->cpu;
+    t->chunks[0].first = m->instructions;
+    t->first = m->instructions;
+    t->paused = m->cpu;
+    t->paused_at = m->instructions;
+    m->trace_at = chunk(t, 0);
+    m->exectrace = t;
+    return t;
+}
+
+bool exectrace_close(exectrace* t) {
+    vm* m = t->m;
+    uint64_t n = atomic_load_explicit(&t->published, memory_order_relaxed);
+    exec_chunk* c = &t->chunks[n % EXEC_CHUNKS];
+    c->ends = true;
+    c->end = t->paused;
+    c->last = t->paused_at;
+    c->count = (uint32_t)(m->trace_at - chunk(t, n));
+    atomic_store(&t->published, n + 1);
+    atomic_store(&t->closing, true);
+    wake(t, &t->more);
+    pthread_join(t->writer, NULL);
+    pthread_cond_destroy(&t->more);
+    pthread_cond_destroy(&t->room);
+    pthread_mutex_destroy(&t->lock);
+    m->exectrace = NULL;
+    m->trace_at = NULL;
+
+    if (close(t->fd) != 0 && !t->error) t->error = errno;
+    int err = t->error;
+    free_trace(t);
+    errno = err;
+    return !err;
+}
+
+// decoding
+
+typedef struct {
+    const uint8_t* rom;   // rom_size bytes
+    size_t rom_size;
+    const uint8_t* traps; // rom_size + CODE_TAIL EXEC_RUNS...
+} exec_rom;
+
+static uint8_t rom_at(const exec_rom* rom, size_t at) {
+    return at < rom->rom_size ? rom->rom[at] : 0;
+}
+
+// the instruction at pc as the ROM has it
+static void describe(char* out, size_t size, const exec_rom* rom, uint32_t pc) {
+    if (pc >= rom->rom_size) {
+        snprintf(out, size, "(end of ROM)");
+        return;
+    }
+    uint8_t opcode = rom->rom[pc];
+    const char* name = opcode_mnemonic(opcode);
+    uint16_t imm = rom_at(rom, pc + 1) | rom_at(rom, pc + 2) << 8;
+    if (!name) snprintf(out, size, "(unknown 0x%02X)", opcode);
+    else if (advance[opcode] == 2) snprintf(out, size, "%s 0x%02X", name, imm & 0xFF);
+    else if (advance[opcode] == 3) snprintf(out, size, "%s 0x%04X", name, imm);
+    else snprintf(out, size, "%s", name);
+}
+
+/*
+ * Replay block b's instructions from its checkpoint, printing those from
+ * `from` on until *left runs out. records holds its LOADs and INs.
+ */
+static bool dump_block(const exec_block* b, const exec_record* records, const exec_rom* rom,
+                       uint64_t from, uint64_t* left, FILE* out) {
+    const exec_record* end = records + b->raw_size / sizeof(exec_record);
+    uint16_t r[4] = { b->a, b->b, b->c, b->d };
+    uint32_t pc = b->pc;
+    uint16_t last_pc = (uint16_t)pc; // of the last record
+    bool z = b->z != 0;
+    if (b->raw_size % sizeof(exec_record)) return false;
+
+    for (uint32_t i = 0; i < b->count && *left; i++) {
+        if (pc >= rom->rom_size + CODE_TAIL) return false;
+        uint32_t at = pc;
+        uint8_t opcode = rom_at(rom, at);
+        uint16_t imm = opcode < 0x14 ? rom_at(rom, at + 1) : rom_at(rom, at + 1) | rom_at(rom, at + 2) << 8;
+        uint32_t target = imm < rom->rom_size ? imm : (uint32_t)rom->rom_size; // verify() sends jumps past ROM to its end
+        unsigned k = opcode & 3;
+        bool stored = false;
+
+        bool jumps = opcode == 0x14 || (opcode == 0x22 && z) || (opcode == 0x23 && !z);
+        if (rom->traps[at] == EXEC_RUNS || (rom->traps[at] == EXEC_TRAPS_TAKEN && !jumps)) {
+            if (!advance[opcode]) return false;
+            pc += advance[opcode];
+            switch (opcode) {
+            case 0x00 ... 0x03: // ADD r, IMM8
+                r[k] += imm;
+                break;
+            case 0x04 ... 0x07: // SUB r, IMM8
+                r[k] -= imm;
+                break;
+            case 0x08 ... 0x0B: // INC r
+                r[k]++;
+                break;
+            case 0x0C ... 0x0F: // DEC r
+                r[k]--;
+                break;
+            case 0x10 ... 0x13: // MOV r, IMM8
+                r[k] = imm;
+                break;
+            case 0x15 ... 0x18: // ADD r, IMM16
+                r[opcode - 0x15] += imm;
+                break;
+            case 0x19 ... 0x1C: // SUB r, IMM16
+                r[opcode - 0x19] -= imm;
+                break;
+            case 0x1D ... 0x20: // MOV r, IMM16
+                r[opcode - 0x1D] = imm;
+                break;
+            case 0x21: // CMP A, IMM16
+                z = r[0] == imm;
+                break;
+            case 0x14: // JMP
+            case 0x22: // JZ
+            case 0x23: // JNZ
+                if (jumps) pc = target;
+                break;
+            case 0x24 ... 0x27: // LOAD r, [IMM16]
+            case 0x2D: // IN A
+            case 0x30:
+            case 0x31:
+                if (records == end || records->pc != (uint16_t)(at - last_pc)) return false;
+                last_pc = (uint16_t)at;
+                r[opcode < 0x28 ? k : 0] += records++->delta;
+                break;
+            case 0x28 ... 0x2B: // STORE r, [IMM16]
+                stored = true;
+                break;
+            default: // PRINT
+                break;
+            } // switch end
+        }
+
+        uint64_t n = b->first + i;
+        if (n < from) continue;
+        char text[40];
+        describe(text, sizeof(text), rom, at);
+        fprintf(out, "%10llu  %04X  %-22s A=%04X B=%04X C=%04X D=%04X Z=%d",
+                (unsigned long long)n, at, text, r[0], r[1], r[2], r[3], z);
+        if (stored) fprintf(out, "  [%04X]=%02X", imm, r[k] & 0xFF);
+        if (fputc('\n', out) == EOF) return false;
+        --*left;
+    }
+    return records == end || *left == 0;
+}
+
+bool exectrace_dump(const char* path, uint64_t from, uint64_t count, FILE* out,
+                    const char** error) {
+    *error = NULL;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        *error = strerror(errno);
+        return false;
+    }
+    if (st.st_size < (off_t)sizeof(exec_header)) {
+        close(fd);
+        *error = "not an execution trace";
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    uint8_t* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    exec_header h;
+    memcpy(&h, data, sizeof(h));
+    uint8_t* raw = malloc(EXEC_RAW_MAX);
+    uint8_t* image = malloc(EXEC_ROM_BYTES(ROM_MAX_SIZE));
+    exec_rom* rom = malloc(sizeof(*rom));
+    bool ok = raw && image && rom;
+    if (!ok) {
+        *error = strerror(ENOMEM);
+    }
+    else if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != EXEC_VERSION
+             || h.rom_size > ROM_MAX_SIZE || size - sizeof(h) < h.rom_packed) {
+        *error = "not an execution trace";
+        ok = false;
+    }
+    else if (!lz_unpack(data + sizeof(h), h.rom_packed, image, EXEC_ROM_BYTES(h.rom_size))) {
+        *error = "execution trace is damaged";
+        ok = false;
+    }
+
+    const uint8_t* p = data + sizeof(h) + (ok ? h.rom_packed : 0);
+    const uint8_t* blocks_end = data + size;
+    exec_end e = { .instructions = 0 };
+    bool complete = false;
+    if (ok && (size_t)(blocks_end - p) >= sizeof(e)) {
+        memcpy(&e, blocks_end - sizeof(e), sizeof(e));
+        complete = memcmp(e.magic, end_magic, sizeof(end_magic)) == 0;
+        if (complete) blocks_end -= sizeof(e);
+    }
+    if (ok) {
+        rom->rom = image;
+        rom->rom_size = h.rom_size;
+        rom->traps = rom->rom + h.rom_size;
+        if (complete) fprintf(out, "# %llu instructions", (unsigned long long)e.instructions);
+        else fprintf(out, "# incomplete trace");
+        fprintf(out, ", traced from instruction %llu of a %u-byte ROM\n",
+                (unsigned long long)h.start, h.rom_size);
+    }
+
+    // skip whole blocks by their headers, up to the one holding `from`
+    uint64_t left = count ? count : UINT64_MAX;
+    bool shown_checkpoint = false;
+    while (ok && left && p < blocks_end) {
+        exec_block b;
+        if ((size_t)(blocks_end - p) < sizeof(b)) break; // cut off while writing
+        memcpy(&b, p, sizeof(b));
+        p += sizeof(b);
+        if (b.packed_size > (size_t)(blocks_end - p)) break;
+        const uint8_t* packed = p;
+        p += b.packed_size;
+        if (b.first + b.count <= from) continue;
+
+        if (b.raw_size > EXEC_RAW_MAX || b.count > h.checkpoint
+            || !lz_unpack(packed, b.packed_size, raw, b.raw_size)) {
+            *error = "execution trace is damaged";
+            ok = false;
+            break;
+        }
+        if (!shown_checkpoint) {
+            fprintf(out, "# checkpoint at %llu: PC=%04X A=%04X B=%04X C=%04X D=%04X Z=%d\n",
+                    (unsigned long long)b.first, b.pc, b.a, b.b, b.c, b.d, b.z);
+            shown_checkpoint = true;
+        }
+        if (!dump_block(&b, (const exec_record*)raw, rom, from, &left, out)) {
+            *error = ferror(out) ? strerror(errno) : "execution trace is damaged";
+            ok = false;
+        }
+    }
+    if (ok && complete && left && from <= e.instructions) {
+        fprintf(out, "# end: PC=%04X A=%04X B=%04X C=%04X D=%04X Z=%d\n",
+                e.pc, e.a, e.b, e.c, e.d, e.z);
+    }
+    if (ok && fflush(out) != 0) {
+        *error = strerror(errno);
+        ok = false;
+    }
+    free(raw);
+    free(image);
+    free(rom);
+    munmap(data, size);
+    return ok;
+}
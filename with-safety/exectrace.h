@@ -0,0 +1,75 @@
+#ifndef EXECTRACE_H
+#define EXECTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * Execution traces (--exec-trace, --dump-trace). Everything but the
+ * value a LOAD or IN gives follows from the ROM and the state going into
+ * an instruction, so that is all the interpreter records while one is
+ * open: an exec_record with the PC and how far the register moved,
+ * appended to a ring of chunks in memory. Every other instruction runs
+ * as it would untraced. The interpreter hands over a whole chunk at a
+ * time, without locks, and only waits when the ring is full. vm_run()
+ * stops every EXEC_CHECKPOINT instructions for a checkpoint of the
+ * registers, and a writer thread compresses the records in between into
+ * a block, so exectrace_dump() can begin replaying at the block that
+ * holds the instruction it seeks to. The file carries the ROM and which
+ * of its instructions trap, which is all the replay needs besides.
+ *
+ * Superinstructions holding a LOAD, and loops, run as their component
+ * instructions, and compiled code is dropped, so that every LOAD is
+ * seen. A trace belongs to the ROM it was recorded with. It is counted
+ * from the instruction it was opened at.
+ */
+typedef struct exectrace exectrace;
+
+// what the interpreter appends for a LOAD or IN
+typedef struct exec_record {
+    uint16_t pc;    // its low 16 bits; past a full 64 KB ROM it wraps
+    uint16_t delta; // how far the register it wrote moved
+} exec_record;
+
+#define EXEC_CHUNK 4096 // records handed over at a time
+#define EXEC_CHUNK_BYTES (EXEC_CHUNK * sizeof(exec_record)) // chunks are aligned to this
+#define EXEC_CHECKPOINT 65536 // instructions between checkpoints at most
+
+/*
+ * Start tracing everything m runs to path; m must be loaded. NULL on
+ * failure, with *error describing it, or NULL in *error to mean errno.
+ */
+exectrace* exectrace_open(vm* m, const char* path, const char** error);
+
+/*
+ * Stop tracing, write out the rest of the trace and its end record, and
+ * free t. false if the trace couldn't be written, see errno.
+ */
+bool exectrace_close(exectrace* t);
+
+// vm.c, with at just past the last record of a chunk: hand it over to the writer; where to go on
+exec_record* exectrace_next_chunk(vm* m, exec_record* at);
+
+/*
+ * vm_run(), around the interpreter, so that the host may set the
+ * registers in between: how many of left instructions it may run before
+ * the next checkpoint, which it takes once there; and where it stopped.
+ */
+void exectrace_resume(vm* m);
+uint64_t exectrace_budget(vm* m, uint64_t left);
+void exectrace_pause(vm* m);
+
+/*
+ * Print count instructions of the trace at path, one per line (0 for all
+ * of them), from instruction `from` on: its number, PC and instruction,
+ * then the registers and Z after it and any RAM write. Replay starts
+ * at the checkpoint of the block that holds `from`. false with *error
+ * set if the file is not a trace, is damaged, or out can't be written.
+ */
+bool exectrace_dump(const char* path, uint64_t from, uint64_t count, FILE* out,
+                    const char** error);
+
+#endif
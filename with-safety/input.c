@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+
+void in_open(in_reader* r, int fd) {
+    struct stat st;
+
+    r->fd = fd;
+    r->cur = r->end = NULL;
+    r->at_eof = false;
+    r->opened = true;
+    r->map = NULL;
+    r->map_size = 0;
+    r->block = NULL;
+    r->owns_block = false;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return;
+
+    // a regular file: map it and start at the current offset
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= st.st_size) return;
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return; // fall back to read()
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    r->map = map;
+    r->map_size = (size_t)st.st_size;
+    r->cur = (const uint8_t*)map + offset;
+    r->end = (const uint8_t*)map + st.st_size;
+    r->at_eof = true; // nothing left to read() once the mapping is used up
+}
+
+void in_close(in_reader* r) {
+    if (r->map) munmap(r->map, r->map_size);
+    if (r->owns_block) free(r->block);
+    r->map = NULL;
+    r->block = NULL;
+    r->owns_block = false;
+    r->cur = r->end = NULL;
+    r->at_eof = true;
+}
+
+// refill the block buffer, false at end of input
+static bool refill(in_reader* r) {
+    if (!r->block && !r->at_eof) {
+        r->block = malloc(IN_BLOCK_SIZE);
+        r->owns_block = true;
+        if (!r->block) r->at_eof = true;
+    }
+    while (!r->at_eof) {
+        ssize_t n = read(r->fd, r->block, IN_BLOCK_SIZE);
+        if (n > 0) {
+            r->cur = r->block;
+            r->end = r->block + n;
+            return true;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        r->at_eof = true; // EOF or a read error, both end the input
+    }
+    return false;
+}
+
+/*
+ * Convert EOF to 0 to prevent passing invalid data to the CPU.
+ * This allows input loops to treat 0x00 as end-of-input.
+ */
+uint16_t in_read_byte(in_reader* r) {
+    if (r->cur == r->end && !refill(r)) return 0;
+    return *r->cur++;
+}
+
+// digits up to and including the first non-digit, which is dropped
+uint16_t in_read_decimal(in_reader* r) {
+    uint32_t value = 0;
+
+    for (;;) {
+        if (r->cur == r->end && !refill(r)) break;
+        const uint8_t* p = r->cur;
+        const uint8_t* end = r->end;
+        while (p < end && *p >= '0' && *p <= '9') {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        r->cur = p;
+        if (p < end) {
+            r->cur++; // the delimiter
+            break;
+        }
+    }
+    return value & 0xFF;
+}
+
+uint16_t in_read_binary(in_reader* r) {
+    uint32_t value = 0;
+
+    for (;;) {
+        if (r->cur == r->end && !refill(r)) break;
+        const uint8_t* p = r->cur;
+        const uint8_t* end = r->end;
+        while (p < end && (*p == '0' || *p == '1')) {
+            value = (value << 1) | (*p - '0');
+            p++;
+        }
+        r->cur = p;
+        if (p < end) {
+            r->cur++; // the delimiter
+            break;
+        }
+    }
+    return value & 0xFF;
+}
+
+#ifndef NO_INPUT_BUFFER
+
+static int in_fd = STDIN_FILENO; // set once before any vm runs
+
+void in_init(int fd) {
+    in_fd = fd;
+}
+
+static inline in_reader* opened(in_reader* r) {
+    if (!r->opened) in_open(r, in_fd);
+    return r;
+}
+
+uint16_t in_byte(in_reader* r) {
+    return in_read_byte(opened(r));
+}
+
+uint16_t in_decimal(in_reader* r) {
+    return in_read_decimal(opened(r));
+}
+
+uint16_t in_binary(in_reader* r) {
+    return in_read_binary(opened(r));
+}
+
+#else // NO_INPUT_BUFFER: the original stdio path, kept for comparison
+
+void in_init(int fd) {
+    (void)fd;
+}
+
+uint16_t in_byte(in_reader* r) {
+    (void)r;
+    int c = getchar();
+    if (c == EOF) c = 0;
+    return c & 0xFF;
+}
+
+uint16_t in_decimal(in_reader* r) {
+    (void)r;
+    int value = 0;
+    int c;
+    while ((c = getchar()) != EOF && c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+    }
+    return value & 0xFF;
+}
+
+uint16_t in_binary(in_reader* r) {
+    (void)r;
+    int value = 0;
+    int c;
+    while ((c = getchar()) != EOF && (c == '0' || c == '1')) {
+        value = (value << 1) | (c - '0');
+    }
+    return value & 0xFF;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IN_BLOCK_SIZE 65536 // read() size when the input cannot be mapped
+
+/*
+ * VM input source for the IN opcodes. A regular file is mmapped whole,
+ * anything else (pipes, terminals) is read() in IN_BLOCK_SIZE blocks, and
+ * the decimal and binary forms are parsed straight from that buffer. End
+ * of input is sticky and reads as 0, as before. Build with
+ * -DNO_INPUT_BUFFER to go through stdio instead.
+ *
+ * in_open() sets up a reader for any fd; in_close() releases the mapping
+ * or block buffer but leaves the fd open.
+ */
+typedef struct {
+    const uint8_t* cur; // next unread byte
+    const uint8_t* end; // end of the buffered bytes
+    int fd;
+    bool at_eof;        // sticky, like stdio
+    bool opened;        // in_open() has run
+    void* map;          // the whole file when it could be mapped
+    size_t map_size;
+    uint8_t* block;     // IN_BLOCK_SIZE bytes for read(), allocated on first use
+    bool owns_block;
+} in_reader;
+
+void in_open(in_reader* r, int fd);
+void in_close(in_reader* r);
+uint16_t in_read_byte(in_reader* r);
+uint16_t in_read_decimal(in_reader* r);
+uint16_t in_read_binary(in_reader* r);
+
+/*
+ * The default input of every vm without vm_set_io(): each one has a
+ * reader of its own, all zero to start, which in_byte() and friends open
+ * on the in_init() fd (stdin until called) the first time it is read.
+ */
+void in_init(int fd);
+uint16_t in_byte(in_reader* r);
+uint16_t in_decimal(in_reader* r);
+uint16_t in_binary(in_reader* r);
+
+#endif
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__unix__))
+
+#include <sys/mman.h>
+
+// block starts seen this often get compiled
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 64
+#endif
+
+#define JIT_BUFFER_SIZE (4u << 20)
+#define JIT_MAX_BLOCK 256     // guest instructions per block
+#define JIT_MAX_INSN_BYTES 64 // worst case native bytes per guest instruction
+#define JIT_FAILED UINT16_MAX // hits[] marker: don't try to compile again
+
+/*
+ * Compiled block: uint32_t fn(cpu_state* cpu, uint64_t loops[2]). It
+ * loads A-D and Z into callee-saved host registers, runs to the block's
+ * ending branch and returns the next guest PC (or JIT_HALT | PC). A
+ * branch back to the block's own start stays in native code and bumps
+ * loops[0], until it reaches the limit in loops[1].
+ */
+typedef uint32_t (*jit_block_fn)(cpu_state* cpu, uint64_t* loops);
+
+typedef struct {
+    jit_block_fn fn;
+    uint32_t instructions; // guest instructions from entry to the ending branch
+} jit_block;
+
+struct jit_state {
+    vm* m;
+    jit_block* blocks; // by start PC
+    uint16_t* hits;    // times each PC was entered without compiled code
+    uint8_t* buffer;
+    size_t buffer_used;
+};
+
+// host register numbers
+enum {
+    RAX = 0, RCX = 1, RBX = 3, RSP = 4, RBP = 5, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+// guest A, B, C, D live in these for the whole block, Z in r15b, RAM base in rbp
+static const uint8_t guest_reg[4] = { RBX, R12, R13, R14 };
+static const uint8_t guest_offset[4] = {
+    offsetof(cpu_state, A), offsetof(cpu_state, B),
+    offsetof(cpu_state, C), offsetof(cpu_state, D),
+};
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* end;
+} emitter;
+
+static void emit8(emitter* e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void emit16(emitter* e, uint16_t v) {
+    emit8(e, v & 0xFF);
+    emit8(e, v >> 8);
+}
+
+static void emit32(emitter* e, uint32_t v) {
+    emit16(e, v & 0xFFFF);
+    emit16(e, v >> 16);
+}
+
+static void emit64(emitter* e, uint64_t v) {
+    emit32(e, (uint32_t)v);
+    emit32(e, (uint32_t)(v >> 32));
+}
+
+// op r16, imm16 (group 1: ext 0 = add, 5 = sub, 7 = cmp)
+static void emit_alu_imm16(emitter* e, uint8_t ext, uint8_t reg, uint16_t imm) {
+    emit8(e, 0x66);
+    if (reg >= 8) emit8(e, 0x41);
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+    emit16(e, imm);
+}
+
+// mov r32, imm32
+static void emit_mov_imm(emitter* e, uint8_t reg, uint32_t imm) {
+    if (reg >= 8) emit8(e, 0x41);
+    emit8(e, 0xB8 | (reg & 7));
+    emit32(e, imm);
+}
+
+// movzx r32, byte [rbp + addr]
+static void emit_load_ram(emitter* e, uint8_t reg, uint16_t addr) {
+    if (reg >= 8) emit8(e, 0x44);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBP);
+    emit32(e, addr);
+}
+
+// mov byte [rbp + addr], r8
+static void emit_store_ram(emitter* e, uint8_t reg, uint16_t addr) {
+    if (reg >= 8) emit8(e, 0x44);
+    emit8(e, 0x88);
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBP);
+    emit32(e, addr);
+}
+
+// movzx r32, word [rdi + disp8]
+static void emit_load_guest(emitter* e, uint8_t reg, uint8_t disp) {
+    if (reg >= 8) emit8(e, 0x44);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit8(e, 0x40 | ((reg & 7) << 3) | RDI);
+    emit8(e, disp);
+}
+
+// mov word [rdi + disp8], r16
+static void emit_store_guest(emitter* e, uint8_t reg, uint8_t disp) {
+    emit8(e, 0x66);
+    if (reg >= 8) emit8(e, 0x44);
+    emit8(e, 0x89);
+    emit8(e, 0x40 | ((reg & 7) << 3) | RDI);
+    emit8(e, disp);
+}
+
+// mov rdi, [rsp] (the saved cpu_state pointer)
+static void emit_reload_cpu(emitter* e) {
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x3C); emit8(e, 0x24);
+}
+
+static void emit_prologue(emitter* e, const vm* m) {
+    emit8(e, 0x53);                                 // push rbx
+    emit8(e, 0x55);                                 // push rbp
+    emit8(e, 0x41); emit8(e, 0x54);                 // push r12
+    emit8(e, 0x41); emit8(e, 0x55);                 // push r13
+    emit8(e, 0x41); emit8(e, 0x56);                 // push r14
+    emit8(e, 0x41); emit8(e, 0x57);                 // push r15
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x18); // sub rsp, 24
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0x3C); emit8(e, 0x24); // mov [rsp], rdi
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0x74); emit8(e, 0x24); emit8(e, 0x08); // mov [rsp+8], rsi
+
+    for (int r = 0; r < 4; r++)
+        emit_load_guest(e, guest_reg[r], guest_offset[r]);
+    // movzx r15d, byte [rdi + Z]
+    emit8(e, 0x44); emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x7F);
+    emit8(e, offsetof(cpu_state, Z));
+    // mov rbp, ram
+    emit8(e, 0x48); emit8(e, 0xBD);
+    emit64(e, (uint64_t)(uintptr_t)m->ram);
+}
+
+// write the guest registers back and return; eax already holds the next PC
+static void emit_epilogue(emitter* e) {
+    emit_reload_cpu(e);
+    for (int r = 0; r < 4; r++)
+        emit_store_guest(e, guest_reg[r], guest_offset[r]);
+    // mov byte [rdi + Z], r15b
+    emit8(e, 0x44); emit8(e, 0x88); emit8(e, 0x7F);
+    emit8(e, offsetof(cpu_state, Z));
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x18); // add rsp, 24
+    emit8(e, 0x41); emit8(e, 0x5F);                 // pop r15
+    emit8(e, 0x41); emit8(e, 0x5E);                 // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D);                 // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C);                 // pop r12
+    emit8(e, 0x5D);                                 // pop rbp
+    emit8(e, 0x5B);                                 // pop rbx
+    emit8(e, 0xC3);                                 // ret
+}
+
+// call an io_* helper with the vm in rdi: PRINT ops take A in esi, IN ops return it in ax
+static void emit_io_call(emitter* e, const vm* m, uint8_t opcode) {
+    bool input = opcode == 0x2D || opcode == 0x30 || opcode == 0x31;
+    uint64_t helper;
+
+    switch (opcode) {
+    case 0x2C: helper = (uint64_t)(uintptr_t)io_print_ascii; break;
+    case 0x2D: helper = (uint64_t)(uintptr_t)io_in; break;
+    case 0x2E: helper = (uint64_t)(uintptr_t)io_print_decimal; break;
+    case 0x2F: helper = (uint64_t)(uintptr_t)io_print_bits; break;
+    case 0x30: helper = (uint64_t)(uintptr_t)io_in_decimal; break;
+    default: helper = (uint64_t)(uintptr_t)io_in_binary; break;
+    }
+    emit8(e, 0x48); emit8(e, 0xBF);                 // mov rdi, m
+    emit64(e, (uint64_t)(uintptr_t)m);
+    if (!input) {
+        emit8(e, 0x89); emit8(e, 0xDE);             // mov esi, ebx
+    }
+    emit8(e, 0x48); emit8(e, 0xB8);                 // mov rax, helper
+    emit64(e, helper);
+    emit8(e, 0xFF); emit8(e, 0xD0);                 // call rax
+    if (input) {
+        emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xD8); // movzx ebx, ax
+    }
+}
+
+/*
+ * Back edge to the block body: while loops[0] < loops[1], ++loops[0] and
+ * jmp body. Past the limit it falls through with eax = start, so the
+ * block returns to its own start.
+ */
+static void emit_loop_back(emitter* e, const uint8_t* body, uint32_t start) {
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x44); emit8(e, 0x24); emit8(e, 0x08); // mov rax, [rsp+8]
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x08); // mov rcx, [rax]
+    emit8(e, 0x48); emit8(e, 0x3B); emit8(e, 0x48); emit8(e, 0x08); // cmp rcx, [rax+8]
+    emit8(e, 0x73); emit8(e, 0x0B);                 // jae +11
+    emit8(e, 0x48); emit8(e, 0xFF); emit8(e, 0xC1); // inc rcx
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0x08); // mov [rax], rcx
+    emit8(e, 0xE9);                                 // jmp rel32
+    emit32(e, (uint32_t)(body - (e->p + 4)));
+    emit_mov_imm(e, RAX, start);
+}
+
+/*
+ * Translate the basic block starting at pc. Blocks end after JMP, JZ,
+ * JNZ or HALT, or just before an instruction that only the interpreter
+ * handles (unknown, truncated, end of ROM), in which case the block
+ * returns that PC and the interpreter reports the error.
+ */
+static bool compile_block(jit_state* j, uint32_t start) {
+    const vm* m = j->m;
+    emitter e = { j->buffer + j->buffer_used, j->buffer + JIT_BUFFER_SIZE };
+    uint8_t* entry = e.p;
+    uint32_t pc = start;
+    uint32_t count = 0;
+
+    if (e.end - e.p < 128) return false;
+    emit_prologue(&e, m);
+    uint8_t* body = e.p;
+
+    for (;;) {
+        const decoded_op* d = &m->code[pc];
+        uint8_t opcode = d->op;
+
+        // superinstructions are compiled from their components
+        if (opcode >= OP_FUSED_FIRST && opcode <= OP_FUSED_LAST) opcode = m->rom[pc];
+
+        if (e.end - e.p < JIT_MAX_INSN_BYTES + 64) return false;
+        if (count == JIT_MAX_BLOCK || (opcode > 0x31 && opcode != 0xFF)) {
+            // stop in front of it and let the interpreter take over
+            if (count == 0) return false;
+            emit_mov_imm(&e, RAX, pc);
+            break;
+        }
+        count++;
+
+        uint8_t r = guest_reg[opcode & 3];
+        if (opcode <= 0x07) { // ADD/SUB r, IMM8
+            emit_alu_imm16(&e, opcode < 0x04 ? 0 : 5, r, d->imm);
+        }
+        else if (opcode <= 0x0F) { // INC/DEC r
+            emit_alu_imm16(&e, opcode < 0x0C ? 0 : 5, r, 1);
+        }
+        else if (opcode <= 0x13) { // MOV r, IMM8
+            emit_mov_imm(&e, r, d->imm);
+        }
+        else if (opcode == 0x14) { // JMP IMM16
+            if (d->imm == start) {
+                emit_loop_back(&e, body, start);
+            }
+            else {
+                emit_mov_imm(&e, RAX, d->imm);
+            }
+            break;
+        }
+        else if (opcode <= 0x20) { // ADD/SUB/MOV r, IMM16
+            r = guest_reg[(opcode - 0x15) & 3];
+            if (opcode <= 0x18) emit_alu_imm16(&e, 0, r, d->imm);
+            else if (opcode <= 0x1C) emit_alu_imm16(&e, 5, r, d->imm);
+            else emit_mov_imm(&e, r, d->imm);
+        }
+        else if (opcode == 0x21) { // CMP A, IMM16
+            emit_alu_imm16(&e, 7, RBX, d->imm);
+            emit8(&e, 0x41); emit8(&e, 0x0F); emit8(&e, 0x94); emit8(&e, 0xC7); // sete r15b
+        }
+        else if (opcode <= 0x23) { // JZ/JNZ IMM16
+            bool jz = opcode == 0x22;
+            emit8(&e, 0x45); emit8(&e, 0x84); emit8(&e, 0xFF); // test r15b, r15b
+            if (d->imm == start) {
+                // skip the back edge when not taken: je (jz) / jne (jnz) rel8
+                emit8(&e, jz ? 0x74 : 0x75);
+                uint8_t* skip = e.p;
+                emit8(&e, 0);
+                emit_loop_back(&e, body, start);
+                emit8(&e, 0xEB); emit8(&e, 0x05);   // jmp over the mov below
+                *skip = (uint8_t)(e.p - (skip + 1));
+                emit_mov_imm(&e, RAX, pc + 3);
+            }
+            else {
+                emit_mov_imm(&e, RAX, pc + 3);
+                emit_mov_imm(&e, RCX, d->imm);
+                emit8(&e, 0x0F); emit8(&e, jz ? 0x45 : 0x44); emit8(&e, 0xC1); // cmovne/cmove eax, ecx
+            }
+            break;
+        }
+        else if (opcode <= 0x27) { // LOAD r, [IMM16]
+            emit_load_ram(&e, r, d->imm);
+        }
+        else if (opcode <= 0x2B) { // STORE r, [IMM16]
+            emit_store_ram(&e, r, d->imm);
+        }
+        else if (opcode <= 0x31) { // PRINT/IN
+            emit_io_call(&e, m, opcode);
+        }
+        else { // HALT
+            emit_mov_imm(&e, RAX, JIT_HALT | pc);
+            break;
+        }
+        pc += d->len;
+    }
+    emit_epilogue(&e);
+
+    j->blocks[start].fn = (jit_block_fn)(void*)entry;
+    j->blocks[start].instructions = count;
+    j->buffer_used = (size_t)(e.p - j->buffer);
+    return true;
+}
+
+static bool compile(jit_state* j, uint32_t pc) {
+    if (mprotect(j->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE) != 0) return false;
+    bool ok = compile_block(j, pc);
+    if (mprotect(j->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) return false;
+    return ok;
+}
+
+jit_state* jit_create(vm* m) {
+    jit_state* j = calloc(1, sizeof(*j));
+    if (!j) return NULL;
+    j->m = m;
+    j->blocks = calloc(m->rom_size, sizeof(jit_block));
+    j->hits = calloc(m->rom_size, sizeof(uint16_t));
+    void* p = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!j->blocks || !j->hits || p == MAP_FAILED) {
+        if (p != MAP_FAILED) munmap(p, JIT_BUFFER_SIZE);
+        free(j->blocks);
+        free(j->hits);
+        free(j);
+        return NULL;
+    }
+    j->buffer = p;
+    return j;
+}
+
+uint32_t jit_enter(jit_state* j, cpu_state* cpu, uint32_t pc, uint64_t* budget) {
+    while (pc < j->m->rom_size) {
+        jit_block* b = &j->blocks[pc];
+        if (!b->fn) {
+            if (j->hits[pc] == JIT_FAILED || ++j->hits[pc] < JIT_THRESHOLD) break;
+            if (!compile(j, pc)) {
+                j->hits[pc] = JIT_FAILED;
+                break;
+            }
+        }
+        if (b->instructions > *budget) break;
+
+        uint64_t loops[2] = { 0, *budget / b->instructions - 1 };
+        pc = b->fn(cpu, loops);
+        *budget -= b->instructions * (loops[0] + 1);
+    }
+    return pc;
+}
+
+void jit_destroy(jit_state* j) {
+    if (!j) return;
+    munmap(j->buffer, JIT_BUFFER_SIZE);
+    free(j->blocks);
+    free(j->hits);
+    free(j);
+}
+
+#else // no native backend for this host
+
+jit_state* jit_create(vm* m) {
+    (void)m;
+    return NULL;
+}
+
+uint32_t jit_enter(jit_state* j, cpu_state* cpu, uint32_t pc, uint64_t* budget) {
+    (void)j;
+    (void)cpu;
+    (void)budget;
+    return pc;
+}
+
+void jit_destroy(jit_state* j) {
+    (void)j;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+// flag in jit_enter()'s result when compiled code executed HALT, or'ed with its PC
+#define JIT_HALT 0x20000u
+
+typedef struct jit_state jit_state;
+
+/*
+ * Tiered execution: the interpreter calls jit_enter() at every jump
+ * target. Blocks that start there often enough are compiled to native
+ * x86-64 and run until control reaches a PC without compiled code,
+ * which is returned (or JIT_HALT | PC, or a PC past the end of ROM).
+ * A block only runs if it fits in *budget, which is charged for every
+ * guest instruction executed. Each vm gets its own compiled code.
+ */
+jit_state* jit_create(vm* m); // NULL when the host has no backend
+uint32_t jit_enter(jit_state* j, cpu_state* cpu, uint32_t pc, uint64_t* budget);
+void jit_destroy(jit_state* j);
+
+#endif
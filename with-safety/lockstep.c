@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include "cpu.h"
+#include "lockstep.h"
+
+_Static_assert(LOCKSTEP_LANES == 8 || LOCKSTEP_LANES == 16 || LOCKSTEP_LANES == 32,
+               "LOCKSTEP_LANES must be 8, 16 or 32");
+
+/*
+ * One element per lane, as GCC/Clang vector types: plain SSE2 runs 16
+ * lanes of 16 bits as two operations, -mavx2 as one.
+ */
+typedef uint16_t lanes16 __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef uint8_t lanes8 __attribute__((vector_size(LOCKSTEP_LANES)));
+
+#define LANES_RAM_SIZE ((size_t)RAM_SIZE * LOCKSTEP_LANES)
+
+struct lockstep {
+    bool used;                     // ram needs zeroing before the next run
+    uint16_t r[4][LOCKSTEP_LANES]; // A-D as lockstep_run() left them
+    uint16_t z[LOCKSTEP_LANES];    // 0xFFFF where Z is set
+    uint32_t pc[LOCKSTEP_LANES];
+    uint64_t instructions[LOCKSTEP_LANES];
+    vm_status status[LOCKSTEP_LANES];
+    /*
+     * Byte x of lane i's RAM is ram[x * LOCKSTEP_LANES + i]. LOAD and
+     * STORE take their address from the instruction, so the lanes running
+     * one always touch a single row, one vector wide: no gathers needed.
+     */
+    uint8_t* ram;
+};
+
+lockstep* lockstep_create(void) {
+    lockstep* ls = calloc(1, sizeof(*ls));
+    if (!ls) return NULL;
+    ls->ram = mmap(NULL, LANES_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ls->ram == MAP_FAILED) {
+        free(ls);
+        return NULL;
+    }
+    return ls;
+}
+
+void lockstep_destroy(lockstep* ls) {
+    if (!ls) return;
+    munmap(ls->ram, LANES_RAM_SIZE);
+    free(ls);
+}
+
+// the lanes of mask from a, the rest from b
+#define SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+/*
+ * Vectors go by address: passed by value, one wider than the target's
+ * registers changes the calling convention (-Wpsabi).
+ */
+static inline bool none(const lanes16* v) {
+    uint64_t w[sizeof(*v) / 8];
+    uint64_t any = 0;
+    memcpy(w, v, sizeof(*v));
+    for (size_t i = 0; i < sizeof(*v) / 8; i++) any |= w[i];
+    return any == 0;
+}
+
+static inline uint32_t lane_bits(const lanes16* v) {
+    uint32_t bits = 0;
+    for (unsigned i = 0; i < LOCKSTEP_LANES; i++) bits |= (uint32_t)((*v)[i] & 1) << i;
+    return bits;
+}
+
+#define FOR_EACH_LANE(i, bits) \
+    for (unsigned i = 0; i < LOCKSTEP_LANES; i++) if ((bits) >> i & 1)
+
+void lockstep_run(lockstep* ls, const vm* m, size_t lanes, const vm_io* io) {
+    const decoded_op* const code = m->code;
+    const uint8_t* const rom = m->rom;
+    uint8_t* const ram = ls->ram;
+    lanes16 r[4] = { 0 }; // A-D
+    lanes16 z = { 0 };
+
+    if (ls->used) {
+        void* fresh = mmap(ram, LANES_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (fresh == MAP_FAILED) memset(ram, 0, LANES_RAM_SIZE); // the last group's pages are still there
+    }
+    ls->used = true;
+    if (lanes > LOCKSTEP_LANES) lanes = LOCKSTEP_LANES;
+    for (unsigned i = 0; i < LOCKSTEP_LANES; i++) {
+        ls->pc[i] = 0;
+        ls->instructions[i] = 0;
+        ls->status[i] = VM_OK;
+    }
+    uint32_t running = (uint32_t)((1ull << lanes) - 1);
+
+    while (running) {
+        /*
+         * The lanes at the lowest PC go next, as a group under `mask`. They
+         * run on until a branch splits them or they reach `next`, the
+         * lowest PC another lane waits at, where the two groups merge. So
+         * lanes that went different ways at a branch meet again where the
+         * paths join.
+         */
+        uint32_t pc = UINT32_MAX, next = UINT32_MAX, group = 0;
+        FOR_EACH_LANE(i, running) {
+            if (ls->pc[i] < pc) pc = ls->pc[i];
+        }
+        lanes16 mask = { 0 };
+        FOR_EACH_LANE(i, running) {
+            if (ls->pc[i] == pc) {
+                mask[i] = 0xFFFF;
+                group |= 1u << i;
+            }
+            else if (ls->pc[i] < next) {
+                next = ls->pc[i];
+            }
+        }
+        const lanes8 mask8 = __builtin_convertvector(mask, lanes8);
+        uint64_t executed = 0; // by every lane of the group
+        uint32_t stopping = group;
+        vm_status stop = VM_OK;
+
+        while (pc < next) {
+            const decoded_op* op = &code[pc];
+            uint8_t opcode = op->op;
+            if (is_compound(opcode)) opcode = rom[pc]; // its components
+            executed++;
+
+            switch (opcode) {
+            case 0x00: case 0x01: case 0x02: case 0x03: // ADD r, IMM8
+                r[opcode & 3] += mask & op->imm;
+                pc += 2;
+                continue;
+            case 0x15: case 0x16: case 0x17: case 0x18: // ADD r, IMM16
+                r[opcode - 0x15] += mask & op->imm;
+                pc += 3;
+                continue;
+            case 0x04: case 0x05: case 0x06: case 0x07: // SUB r, IMM8
+                r[opcode & 3] -= mask & op->imm;
+                pc += 2;
+                continue;
+            case 0x19: case 0x1A: case 0x1B: case 0x1C: // SUB r, IMM16
+                r[opcode - 0x19] -= mask & op->imm;
+                pc += 3;
+                continue;
+            case 0x08: case 0x09: case 0x0A: case 0x0B: // INC r
+                r[opcode & 3] -= mask; // a lane of mask is -1
+                pc += 1;
+                continue;
+            case 0x0C: case 0x0D: case 0x0E: case 0x0F: // DEC r
+                r[opcode & 3] += mask;
+                pc += 1;
+                continue;
+            case 0x10: case 0x11: case 0x12: case 0x13: // MOV r, IMM8
+                r[opcode & 3] = SELECT(mask, (lanes16){ 0 } + op->imm, r[opcode & 3]);
+                pc += 2;
+                continue;
+            case 0x1D: case 0x1E: case 0x1F: case 0x20: // MOV r, IMM16
+                r[opcode - 0x1D] = SELECT(mask, (lanes16){ 0 } + op->imm, r[opcode - 0x1D]);
+                pc += 3;
+                continue;
+            case 0x21: // CMP A, IMM16
+                z = SELECT(mask, (lanes16)(r[0] == op->imm), z);
+                pc += 3;
+                continue;
+            case 0x14: // JMP IMM16
+                pc = op->imm;
+                continue;
+            case 0x22: // JZ IMM16
+            case 0x23: { // JNZ IMM16
+                lanes16 taken = (opcode == 0x22 ? z : ~z) & mask;
+                if (none(&taken)) {
+                    pc += 3;
+                    continue;
+                }
+                lanes16 fallen = taken ^ mask;
+                if (none(&fallen)) {
+                    pc = op->imm;
+                    continue;
+                }
+                FOR_EACH_LANE(i, group) { // the group splits
+                    ls->pc[i] = taken[i] ? op->imm : pc + 3;
+                }
+                goto regroup;
+            }
+            case 0x24: case 0x25: case 0x26: case 0x27: { // LOAD r, [IMM16]
+                lanes16 bytes = __builtin_convertvector(*(lanes8*)(ram + op->imm * LOCKSTEP_LANES), lanes16);
+                r[opcode & 3] = SELECT(mask, bytes, r[opcode & 3]);
+                pc += 3;
+                continue;
+            }
+            case 0x28: case 0x29: case 0x2A: case 0x2B: { // STORE r, [IMM16]
+                lanes8* row = (lanes8*)(ram + op->imm * LOCKSTEP_LANES);
+                *row = SELECT(mask8, __builtin_convertvector(r[opcode & 3], lanes8), *row); // & 0xFF
+                pc += 3;
+                continue;
+            }
+            // I/O: lane by lane
+            case 0x2C: // PRINT A AS ASCII
+                FOR_EACH_LANE(i, group) io[i].print_ascii(io[i].ctx, r[0][i] & 0xFF);
+                pc += 1;
+                continue;
+            case 0x2D: // IN A
+                FOR_EACH_LANE(i, group) r[0][i] = io[i].in(io[i].ctx);
+                pc += 1;
+                continue;
+            case 0x2E: // PRINT A AS DECIMAL
+                FOR_EACH_LANE(i, group) io[i].print_decimal(io[i].ctx, r[0][i]);
+                pc += 1;
+                continue;
+            case 0x2F: // PRINT A AS BITS
+                FOR_EACH_LANE(i, group) io[i].print_bits(io[i].ctx, r[0][i] & 0xFF);
+                pc += 1;
+                continue;
+            case 0x30: // IN A (DECIMAL)
+                FOR_EACH_LANE(i, group) r[0][i] = io[i].in_decimal(io[i].ctx);
+                pc += 1;
+                continue;
+            case 0x31: // IN A (BINARY)
+                FOR_EACH_LANE(i, group) r[0][i] = io[i].in_binary(io[i].ctx);
+                pc += 1;
+                continue;
+            case 0xFF: // HALT
+                stop = VM_HALTED;
+                goto stopped;
+            case OP_TRUNCATED:
+                stop = VM_ERR_TRUNCATED;
+                goto stopped;
+            case OP_END:
+                stop = VM_END_OF_ROM;
+                goto stopped;
+            case OP_UNVERIFIED:
+                stop = VM_ERR_UNVERIFIED;
+                goto stopped;
+#if VM_SAFETY == VM_SAFETY_JUMPS
+            case OP_BAD_JMP:
+                stop = VM_ERR_BAD_JUMP;
+                goto stopped;
+            case OP_BAD_JZ:
+            case OP_BAD_JNZ: { // the lanes that take it trap, the rest fall through
+                lanes16 taken = (opcode == OP_BAD_JZ ? z : ~z) & mask;
+                if (none(&taken)) {
+                    pc += 3;
+                    continue;
+                }
+                stopping = lane_bits(&taken);
+                FOR_EACH_LANE(i, group & ~stopping) ls->pc[i] = pc + 3;
+                stop = VM_ERR_BAD_JUMP;
+                goto stopped;
+            }
+#endif
+            case OP_BREAK: // vm_set_breakpoint() on the shared vm: not run
+                executed--;
+                stop = VM_BREAKPOINT;
+                goto stopped;
+            default:
+                stop = VM_ERR_UNKNOWN_OPCODE;
+                goto stopped;
+            } // switch end
+        }
+        FOR_EACH_LANE(i, group) ls->pc[i] = pc; // merging with the lanes waiting there
+        goto regroup;
+
+    stopped:
+        FOR_EACH_LANE(i, stopping) {
+            ls->pc[i] = pc;
+            ls->status[i] = stop;
+            if (io[i].flush) io[i].flush(io[i].ctx);
+        }
+        running &= ~stopping;
+
+    regroup:
+        FOR_EACH_LANE(i, group) ls->instructions[i] += executed;
+    }
+
+    for (unsigned i = 0; i < LOCKSTEP_LANES; i++) {
+        for (unsigned k = 0; k < 4; k++) ls->r[k][i] = r[k][i];
+        ls->z[i] = z[i];
+    }
+}
+
+vm_status lockstep_status(const lockstep* ls, size_t lane) {
+    return ls->status[lane];
+}
+
+cpu_state lockstep_cpu(const lockstep* ls, size_t lane) {
+    cpu_state cpu = {
+        .A = ls->r[0][lane], .B = ls->r[1][lane], .C = ls->r[2][lane], .D = ls->r[3][lane],
+        .PC = ls->pc[lane],
+        .Z = ls->z[lane] != 0,
+    };
+    return cpu;
+}
+
+uint64_t lockstep_instructions(const lockstep* ls, size_t lane) {
+    return ls->instructions[lane];
+}
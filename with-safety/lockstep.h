@@ -0,0 +1,43 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * Lockstep execution (--batch --lockstep): up to LOCKSTEP_LANES
+ * instances of one ROM, each with its own registers, RAM and I/O, run as
+ * the lanes of vectors. The lanes at the lowest PC run the instructions
+ * from there together, with one vector operation for every ALU, CMP,
+ * LOAD and STORE; a JZ/JNZ that sends them different ways splits them,
+ * and they merge again wherever their PCs meet. The I/O opcodes run lane
+ * by lane through each lane's callbacks.
+ *
+ * Lanes start from a fresh vm's state and run until they stop; there is
+ * no step limit, no JIT and no breakpoints.
+ */
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 16
+#endif
+
+typedef struct lockstep lockstep;
+
+lockstep* lockstep_create(void); // NULL if out of memory
+void lockstep_destroy(lockstep* ls);
+
+/*
+ * Run `lanes` instances (1 to LOCKSTEP_LANES) of the ROM loaded in `rom`,
+ * instance i with io[i], from zeroed registers and RAM until every one
+ * has stopped.
+ */
+void lockstep_run(lockstep* ls, const vm* rom, size_t lanes, const vm_io* io);
+
+// after lockstep_run(): how lane i stopped, and where
+vm_status lockstep_status(const lockstep* ls, size_t lane);
+cpu_state lockstep_cpu(const lockstep* ls, size_t lane);
+uint64_t lockstep_instructions(const lockstep* ls, size_t lane);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "loops.h"
+
+// the instruction at pc, a compound entry's first component
+static uint8_t opcode_at(const vm* m, size_t pc) {
+    uint8_t op = m->code[pc].op;
+    return is_compound(op) ? m->rom[pc] : op;
+}
+
+// the location of the RAM cell at addr, added on first use; -1 past LOOP_MAX_CELLS
+static int cell(loop* l, loop_value* now, uint16_t addr) {
+    for (int i = 0; i < l->n_cells; i++) {
+        if (l->cell[i] == addr) return 4 + i;
+    }
+    if (l->n_cells == LOOP_MAX_CELLS) return -1;
+    int at = 4 + l->n_cells;
+    l->cell[l->n_cells++] = addr;
+    now[at] = (loop_value){ (uint8_t)at, false, 0 };
+    return at;
+}
+
+// ADD, SUB, INC and DEC; a value cut to 8 bits would have to wrap twice
+static bool add(loop_value* v, uint16_t n) {
+    if (n && v->from != LOOP_CONST && v->byte) return false;
+    v->add += n;
+    return true;
+}
+
+/*
+ * One iteration, head to the JNZ at branch, in terms of the locations'
+ * values at its start. false if the body holds anything but ALU, CMP,
+ * LOAD, STORE and PRINT, touches too many cells or never compares.
+ */
+static bool run_body(const vm* m, loop* l, size_t branch) {
+    loop_value now[LOOP_LOCATIONS];
+    bool compared = false;
+    size_t pc = l->head;
+
+    for (int r = 0; r < 4; r++) now[r] = (loop_value){ (uint8_t)r, false, 0 };
+    for (l->length = 0; pc < branch; l->length++) {
+        const decoded_op* d = &m->code[pc];
+        uint8_t op = opcode_at(m, pc);
+        int at;
+
+        switch (op) {
+        case 0x00: case 0x01: case 0x02: case 0x03: // ADD r, IMM8
+            if (!add(&now[op - 0x00], d->imm)) return false;
+            break;
+        case 0x15: case 0x16: case 0x17: case 0x18: // ADD r, IMM16
+            if (!add(&now[op - 0x15], d->imm)) return false;
+            break;
+        case 0x04: case 0x05: case 0x06: case 0x07: // SUB r, IMM8
+            if (!add(&now[op - 0x04], (uint16_t)-d->imm)) return false;
+            break;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: // SUB r, IMM16
+            if (!add(&now[op - 0x19], (uint16_t)-d->imm)) return false;
+            break;
+        case 0x08: case 0x09: case 0x0A: case 0x0B: // INC r
+            if (!add(&now[op - 0x08], 1)) return false;
+            break;
+        case 0x0C: case 0x0D: case 0x0E: case 0x0F: // DEC r
+            if (!add(&now[op - 0x0C], 0xFFFF)) return false;
+            break;
+        case 0x10: case 0x11: case 0x12: case 0x13: // MOV r, IMM8
+            now[op - 0x10] = (loop_value){ LOOP_CONST, false, d->imm };
+            break;
+        case 0x1D: case 0x1E: case 0x1F: case 0x20: // MOV r, IMM16
+            now[op - 0x1D] = (loop_value){ LOOP_CONST, false, d->imm };
+            break;
+        case 0x21: // CMP A, IMM16
+            l->cmp = now[0];
+            l->k = d->imm;
+            compared = true;
+            break;
+        case 0x24: case 0x25: case 0x26: case 0x27: // LOAD r, [IMM16]
+            if ((at = cell(l, now, d->imm)) < 0) return false;
+            now[op - 0x24] = now[at];
+            break;
+        case 0x28: case 0x29: case 0x2A: case 0x2B: { // STORE r, [IMM16]
+            if ((at = cell(l, now, d->imm)) < 0) return false;
+            loop_value v = now[op - 0x28];
+            now[at] = (loop_value){ v.from, v.from != LOOP_CONST, v.add & 0xFF };
+            break;
+        }
+        case 0x2C: // PRINT A AS ASCII
+        case 0x2E: // PRINT A AS DECIMAL
+        case 0x2F: // PRINT A AS BITS
+            if (l->n_prints == LOOP_MAX_PRINTS) return false;
+            l->print[l->n_prints++] = (loop_print){ op, l->length, (uint32_t)pc, now[0] };
+            break;
+        default: // branches, input, HALT and traps
+            return false;
+        } // switch end
+        pc += d->len;
+    }
+    if (pc != branch || !compared) return false;
+
+    l->length++; // the JNZ
+    l->exit = (uint32_t)(branch + m->code[branch].len);
+    memcpy(l->next, now, sizeof(now));
+    return true;
+}
+
+// a location that takes another's value from the iteration before
+static bool is_copy(const loop* l, unsigned at) {
+    return l->next[at].from != LOOP_CONST && l->next[at].from != at;
+}
+
+/*
+ * What the closed forms below can take: copies may chain, but not in a
+ * circle, and the CMP has to see a constant or a location that steps by
+ * a constant (an induction variable), not a copy.
+ */
+static bool closed_form(const loop* l) {
+    for (unsigned at = 0; at < 4u + l->n_cells; at++) {
+        unsigned from = at;
+        for (unsigned hops = 0; is_copy(l, from); hops++) {
+            if (hops == LOOP_LOCATIONS) return false;
+            from = l->next[from].from;
+        }
+    }
+    return l->cmp.from == LOOP_CONST || !is_copy(l, l->cmp.from);
+}
+
+static uint16_t wrap(loop_value v, uint32_t x) {
+    return v.byte ? x & 0xFF : x & 0xFFFF;
+}
+
+// location at after n iterations from start
+static uint16_t after(const loop* l, const uint16_t* start, unsigned at, uint32_t n) {
+    if (n == 0) return start[at];
+    loop_value v = l->next[at];
+    if (v.from == LOOP_CONST) return v.add;
+    if (v.from == at) return wrap(v, start[at] + n * v.add);
+    return wrap(v, after(l, start, v.from, n - 1) + v.add);
+}
+
+// v as seen in iteration n, counted from 1
+static uint16_t value(const loop* l, const uint16_t* start, loop_value v, uint32_t n) {
+    if (v.from == LOOP_CONST) return v.add;
+    return wrap(v, after(l, start, v.from, n - 1) + v.add);
+}
+
+/*
+ * The iteration whose CMP first matches, so the last one; 0 if none
+ * ever does. Past the first, iteration m + 1 compares a constant or
+ * ((s + m * step) mod w_s + add) mod w_c, w being 2^16, or 2^8 for
+ * values cut by a STORE, which comes down to solving m * step = r
+ * modulo a power of two.
+ */
+static uint32_t iterations(const loop* l, const uint16_t* start) {
+    const loop_value c = l->cmp;
+    if (value(l, start, c, 1) == l->k) return 1;
+    if (c.from == LOOP_CONST) return 0;
+    const loop_value source = l->next[c.from];
+    if (source.from == LOOP_CONST) return value(l, start, c, 2) == l->k ? 2 : 0;
+
+    uint32_t w_s = source.byte ? 0x100 : 0x10000;
+    uint32_t w_c = c.byte ? 0x100 : 0x10000;
+    uint32_t s = start[c.from];
+    uint32_t r;
+    if (l->k >= w_c) return 0;
+    if (w_s < w_c) {
+        // a byte widened by add: only a sum below 256 can match
+        uint32_t t = (uint16_t)(l->k - c.add);
+        if (t > 0xFF) return 0;
+        r = t - s;
+    }
+    else {
+        r = l->k - s - c.add;
+    }
+    uint32_t w = w_s < w_c ? w_s : w_c;
+    uint32_t step = source.add & (w - 1);
+    r &= w - 1;
+
+    if (step == 0) return r == 0 ? 2 : 0;
+    int shift = __builtin_ctz(step);
+    if (r & ((1u << shift) - 1)) return 0;
+    w >>= shift;
+    step >>= shift;
+    r >>= shift;
+    uint32_t inverse = step; // of an odd step, by Newton's method: 3 bits, then 6, 12, 24
+    for (int i = 0; i < 3; i++) inverse *= 2 - step * inverse;
+    uint32_t m = (r * inverse) & (w - 1);
+    return (m ? m : w) + 1;
+}
+
+uint64_t loop_run(vm* m, const loop* l, cpu_state* cpu, uint64_t budget, uint64_t io_at) {
+    uint16_t start[LOOP_LOCATIONS];
+    unsigned locations = 4u + l->n_cells;
+
+    for (unsigned r = 0; r < 4; r++) start[r] = cpu->r[r];
+    for (unsigned i = 0; i < l->n_cells; i++) start[4 + i] = m->ram[l->cell[i]];
+
+    // all iterations, or as many whole ones as the budget covers
+    uint32_t n = iterations(l, start);
+    uint64_t fit = budget / l->length + 1;
+    if (fit > LOOP_MAX_RUN) fit = LOOP_MAX_RUN;
+    bool exits = n != 0 && n <= fit;
+    if (!exits) n = (uint32_t)fit;
+
+    for (uint32_t i = 1; l->n_prints && i <= n; i++) {
+        for (unsigned p = 0; p < l->n_prints; p++) {
+            const loop_print* print = &l->print[p];
+            uint16_t a = value(l, start, print->a, i);
+            m->io_at = io_at + (uint64_t)(i - 1) * l->length + print->at;
+            m->io_pc = print->pc;
+            if (print->opcode == 0x2C) io_print_ascii(m, a);
+            else if (print->opcode == 0x2E) io_print_decimal(m, a);
+            else io_print_bits(m, a);
+        }
+    }
+
+    uint16_t end[LOOP_LOCATIONS];
+    for (unsigned at = 0; at < locations; at++) end[at] = after(l, start, at, n);
+    for (unsigned r = 0; r < 4; r++) cpu->r[r] = end[r];
+    for (unsigned i = 0; i < l->n_cells; i++) m->ram[l->cell[i]] = (uint8_t)end[4 + i];
+    cpu->Z = exits; // only the last CMP matches
+    return (uint64_t)(n - 1) * l->length;
+}
+
+static int by_head(const void* a, const void* b) {
+    const loop* x = a;
+    const loop* y = b;
+    return (x->head > y->head) - (x->head < y->head);
+}
+
+void find_loops(vm* m) {
+    decoded_op* code = m->code;
+    size_t found = 0, capacity = 0;
+    loop* loops = NULL;
+
+    for (size_t pc = 0; pc < m->rom_size; pc++) {
+        // a JNZ back to a head no other loop has taken
+        if (code[pc].op != 0x23 || code[pc].imm > pc || code[code[pc].imm].op == OP_LOOP) continue;
+        if (found == capacity) {
+            size_t more = capacity ? capacity * 2 : 16;
+            loop* bigger = realloc(loops, more * sizeof(loop));
+            if (!bigger) break; // the loops found so far still work
+            loops = bigger;
+            capacity = more;
+        }
+        loop* l = &loops[found];
+        memset(l, 0, sizeof(*l));
+        l->head = code[pc].imm;
+        if (!run_body(m, l, pc) || !closed_form(l)) continue;
+        l->op = code[l->head].op;
+        code[l->head].op = OP_LOOP;
+        found++;
+    }
+    if (found) qsort(loops, found, sizeof(loop), by_head);
+    m->loops = loops;
+    m->n_loops = found;
+}
+
+void unloop_over(vm* m, size_t pc) {
+    for (size_t i = 0; i < m->n_loops; i++) {
+        const loop* l = &m->loops[i];
+        if (l->head <= pc && pc < l->exit && m->code[l->head].op == OP_LOOP) m->code[l->head].op = l->op;
+    }
+}
+
+const loop* loop_at(const vm* m, size_t pc) {
+    size_t lo = 0, hi = m->n_loops;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->loops[mid].head <= pc) lo = mid;
+        else hi = mid;
+    }
+    return &m->loops[lo];
+}
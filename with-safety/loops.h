@@ -0,0 +1,82 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/*
+ * Counting loops. find_loops() looks for a JNZ back to the start of a
+ * straight-line body of ALU, CMP, LOAD and STORE instructions, which only
+ * ever touch A-D and the few RAM cells named by their immediates. Run
+ * once symbolically, the body gives each of those locations as a value
+ * from the start of the iteration plus a constant, so the value after
+ * any number of iterations, and the iteration at which the last CMP
+ * first matches, have a closed form. OP_LOOP at the first address then
+ * runs all iterations in one step. PRINTs in the body are replayed from
+ * the same closed forms, every iteration in turn, without dispatching
+ * the rest of the body.
+ *
+ * -DNO_LOOP_IDIOMS turns this off; the profiling builds, which have to
+ * see every instruction, always run without it.
+ */
+
+#define LOOP_MAX_CELLS 12                 // RAM cells one loop may touch
+#define LOOP_MAX_PRINTS 8
+#define LOOP_LOCATIONS (4 + LOOP_MAX_CELLS) // A-D, then the cells
+#define LOOP_CONST 0xFF                   // loop_value.from of a constant
+#define LOOP_MAX_RUN (1u << 30)           // iterations per loop_run(), so one that never exits still spins
+
+/*
+ * A location's value at the start of the iteration, plus add, wrapped
+ * to 16 bits or truncated to 8 by a STORE (byte). From LOOP_CONST it is
+ * add alone.
+ */
+typedef struct {
+    uint8_t from;
+    bool byte;
+    uint16_t add;
+} loop_value;
+
+typedef struct {
+    uint8_t opcode; // 0x2C, 0x2E or 0x2F
+    uint32_t at;    // instructions before it in the body
+    uint32_t pc;
+    loop_value a;   // what it prints
+} loop_print;
+
+typedef struct loop {
+    uint32_t head;   // first instruction, where OP_LOOP is installed
+    uint32_t exit;   // the instruction after the closing JNZ
+    uint32_t length; // instructions per iteration, the JNZ included
+    uint8_t op;      // the code[head].op OP_LOOP replaced
+    uint8_t n_cells;
+    uint8_t n_prints;
+    uint16_t cell[LOOP_MAX_CELLS];   // RAM address of each location from 4 on
+    loop_value next[LOOP_LOCATIONS]; // every location at the end of an iteration
+    loop_value cmp;                  // A at the last CMP of the body
+    uint16_t k;                      // and what it is compared with
+    loop_print print[LOOP_MAX_PRINTS];
+} loop;
+
+// after verify() and fuse(): fill m->loops and install OP_LOOP at their heads
+void find_loops(vm* m);
+
+// drop every loop whose body holds pc, so a breakpoint there is not run through
+void unloop_over(vm* m, size_t pc);
+
+const loop* loop_at(const vm* m, size_t pc); // the loop whose head is pc
+
+/*
+ * Run l from its head, its first iteration already charged, to its
+ * exit, or for as many whole iterations as budget covers and at most
+ * LOOP_MAX_RUN: print what they print (the first print numbered io_at,
+ * as MARK_IO would), update cpu and RAM, and return the instructions to
+ * charge on top. cpu->Z tells which it was: the loop is left if set, and
+ * goes on at the head, with budget for less than an iteration unless
+ * LOOP_MAX_RUN cut it short, if not.
+ */
+uint64_t loop_run(vm* m, const loop* l, cpu_state* cpu, uint64_t budget, uint64_t io_at);
+
+#endif
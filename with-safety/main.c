@@ -3,423 +3,421 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#ifdef VM_STATS
+#include <time.h>
+#endif
 
-#define ROM_SIZE 32768
-#define RAM_SIZE 65536
-#define OK 0
-#define ERROR 1
+#include "vm.h"
+#include "verify.h"
+#include "input.h"
+#include "output.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "asm.h"
+#include "aot.h"
+#include "trace.h"
+#include "exectrace.h"
+#if defined(VM_PROFILE_NGRAMS) || defined(VM_PROFILE)
+#include "profile.h"
+#endif
 
-// rom check helper
-static inline bool can_read(size_t pc, size_t n) {
-    return pc + n <= ROM_SIZE;
-}
-
-// ensure read is within bounds
-#define CHECK_ROM(n) do { \
-    if (!can_read(cpu.PC, (n))) { \
-        fprintf(stderr, "Truncated instruction at PC=%zu\n", (size_t)cpu.PC); \
-        return EXIT_FAILURE; \
-    } \
-} while (0)
-
-// ensure read is within bounds
-#define CHECK_RAM(addr) do { \
-    if ((addr) >= RAM_SIZE) { \
-        fprintf(stderr, "RAM out of bounds: 0x%04X at PC=%zu\n", (unsigned)(addr), (size_t)cpu.PC); \
-        return EXIT_FAILURE; \
-    } \
-} while (0)
-
-uint8_t rom[ROM_SIZE];
-uint8_t ram[RAM_SIZE];
-
-typedef struct {
-    uint16_t A, B, C, D;
-    size_t PC; // unsigned and large capacity
-    bool Z; // zero flag
-} cpu_state;
-
-int load_rom(const char* filename) {
-    memset(rom, 0, ROM_SIZE);
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        perror("Couldn't open ROM file.");
-        return ERROR;
-    }
+// command-line front end: everything else goes through the vm.h API
 
-    size_t bytes_read = fread(rom, 1, ROM_SIZE, file);
-    fclose(file);
+#ifdef VM_STATS
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
 
-    printf("Loaded %zu bytes\n", bytes_read);
-    return OK;
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--verify] [--flush line|block|unbuffered] [--rom-size n] <romfile|file.asm>\n", prog);
+    fprintf(stderr, "       %s --snapshot-at <pc:addr|count> [--snapshot file] [options] <romfile>\n", prog);
+    fprintf(stderr, "       %s --record|--replay <trace> [options] <romfile>\n", prog);
+    fprintf(stderr, "       %s --exec-trace <file> [options] <romfile>\n", prog);
+    fprintf(stderr, "       %s --dump-trace <file> [--seek n] [--count n]\n", prog);
+    fprintf(stderr, "       %s --assemble <out.rom> [--rom-size n] <file.asm>\n", prog);
+    fprintf(stderr, "       %s --compile <out.c> [--rom-size n] <romfile|file.asm>\n", prog);
+    fprintf(stderr, "       %s --batch <manifest> [-j threads] [--lockstep] [--rom-size n]\n", prog);
+    fprintf(stderr, "  --verify    print what the load-time verifier proved and exit\n");
+    fprintf(stderr, "  --flush     when program output is written out (default: line on a\n");
+    fprintf(stderr, "              terminal, block otherwise)\n");
+    fprintf(stderr, "  --rom-size  ROM size in bytes, 1-%d (default: the image size, at least %d)\n",
+            ROM_MAX_SIZE, ROM_DEFAULT_SIZE);
+    fprintf(stderr, "  --snapshot-at  run until PC reaches addr, or until count instructions have\n");
+    fprintf(stderr, "              run, then save the VM state and exit\n");
+    fprintf(stderr, "  --snapshot  where --snapshot-at saves it (default: vm.snap)\n");
+    fprintf(stderr, "  --restore   start from a snapshot taken with the same ROM\n");
+    fprintf(stderr, "  --record    log every IN result and PRINT, with instruction counts, to a trace\n");
+    fprintf(stderr, "  --replay    run against a recorded trace instead of stdin/stdout and report\n");
+    fprintf(stderr, "              the first point where the run diverges from it\n");
+    fprintf(stderr, "  --exec-trace  write every instruction run, with its effect, to a compressed\n");
+    fprintf(stderr, "              execution trace\n");
+    fprintf(stderr, "  --dump-trace  print an execution trace, from instruction --seek n on (default:\n");
+    fprintf(stderr, "              0) and for --count n instructions (default: all)\n");
+    fprintf(stderr, "  --assemble  write the assembled ROM image to a file instead of running it\n");
+    fprintf(stderr, "  --compile   translate the ROM to a standalone C program instead of running it\n");
+    fprintf(stderr, "  --batch     run every `rom [input [output]]` line of the manifest\n");
+    fprintf(stderr, "  -j          worker threads for --batch (default: one per CPU)\n");
+    fprintf(stderr, "  --lockstep  run the --batch jobs of each ROM %d at a time as SIMD lanes\n", LOCKSTEP_LANES);
+#ifdef VM_PROFILE
+    fprintf(stderr, "  --folded    where the profile's folded stacks go (default: profile.folded)\n");
+#endif
 }
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s <romfile>\n", argv[0]);
-        return EXIT_FAILURE; // expands to 1
-    }
+    const char* rom_file = NULL;
+    const char* manifest = NULL;
+    const char* assemble_to = NULL;
+    const char* compile_to = NULL;
+    const char* snapshot_file = "vm.snap";
+    const char* restore_file = NULL;
+    const char* trace_file = NULL;
+    trace_mode tracing = TRACE_RECORD;
+    const char* exec_trace_file = NULL;
+    const char* dump_file = NULL;
+    uint64_t seek = 0, count = 0; // --dump-trace, count 0 for all
+    bool dump_range = false;
+    bool snapshot = false;
+    bool snapshot_by_pc = false;
+    uint64_t snapshot_point = 0; // PC, or instructions since the start
+#ifdef VM_PROFILE
+    const char* folded_file = "profile.folded";
+#endif
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool lockstep = false;
+    size_t rom_size = 0; // fit to the image
+    bool verify_only = false;
+    out_policy policy = isatty(STDOUT_FILENO) ? OUT_LINE : OUT_BLOCK;
 
-    if (load_rom(argv[1]) != OK) {
-        fprintf(stderr, "Error loading ROM.\n");
-        return EXIT_FAILURE;
-    }
-
-    cpu_state cpu;
-    cpu.A = 0;
-    cpu.B = 0;
-    cpu.C = 0;
-    cpu.D = 0;
-    cpu.PC = 0;
-    cpu.Z = false;
-
-    short instr_len = 0;
-    bool running = true;
-
-    while (cpu.PC < ROM_SIZE && running) {
-        uint8_t opcode = rom[cpu.PC];
-
-        switch (opcode) {
-        case 0x00: { // ADD A, IMM8
-            CHECK_ROM(2);
-            cpu.A += rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x01: { // ADD B, IMM8
-            CHECK_ROM(2);
-            cpu.B += rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x02: { // ADD C, IMM8
-            CHECK_ROM(2);
-            cpu.C += rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x03: { // ADD D, IMM8
-            CHECK_ROM(2);
-            cpu.D += rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x04: { // SUB A, IMM8
-            CHECK_ROM(2);
-            cpu.A -= rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x05: { // SUB B, IMM8
-            CHECK_ROM(2);
-            cpu.B -= rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x06: { // SUB C, IMM8
-            CHECK_ROM(2);
-            cpu.C -= rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x07: { // SUB D, IMM8
-            CHECK_ROM(2);
-            cpu.D -= rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x08: { // INC A
-            cpu.A += 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x09: { // INC B
-            cpu.B += 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0A: { // INC C
-            cpu.C += 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0B: { // INC D
-            cpu.D += 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0C: { // DEC A
-            cpu.A -= 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0D: { // DEC B
-            cpu.B -= 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0E: { // DEC C
-            cpu.C -= 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x0F: { // DEC D
-            cpu.D -= 1;
-            instr_len = 1;
-            break;
-        }
-        case 0x10: { // MOV A, IMM8
-            CHECK_ROM(2);
-            cpu.A = rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x11: { // MOV B, IMM8
-            CHECK_ROM(2);
-            cpu.B = rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x12: { // MOV C, IMM8
-            CHECK_ROM(2);
-            cpu.C = rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x13: { // MOV D, IMM8
-            CHECK_ROM(2);
-            cpu.D = rom[cpu.PC + 1];
-            instr_len = 2;
-            break;
-        }
-        case 0x14: { // JMP IMM16
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            cpu.PC = addr;
-            continue; // skip PC increment entirely
-        }
-        case 0x15: { // ADD A, IMM16
-            CHECK_ROM(3);
-            cpu.A += rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x16: { // ADD B, IMM16
-            CHECK_ROM(3);
-            cpu.B += rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x17: { // ADD C, IMM16
-            CHECK_ROM(3);
-            cpu.C += rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x18: { // ADD D, IMM16
-            CHECK_ROM(3);
-            cpu.D += rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x19: { // SUB A, IMM16
-            CHECK_ROM(3);
-            cpu.A -= rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1A: { // SUB B, IMM16
-            CHECK_ROM(3);
-            cpu.B -= rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1B: { // SUB C, IMM16
-            CHECK_ROM(3);
-            cpu.C -= rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1C: { // SUB D, IMM16
-            CHECK_ROM(3);
-            cpu.D -= rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1D: { // MOV A, IMM16
-            CHECK_ROM(3);
-            cpu.A = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1E: { // MOV B, IMM16
-            CHECK_ROM(3);
-            cpu.B = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x1F: { // MOV C, IMM16
-            CHECK_ROM(3);
-            cpu.C = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x20: { // MOV D, IMM16
-            CHECK_ROM(3);
-            cpu.D = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            instr_len = 3;
-            break;
-        }
-        case 0x21: { // CMP A, IMM16
-            CHECK_ROM(3);
-            if (cpu.A == (rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8))) {
-                cpu.Z = true;
-            }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verify") == 0) {
+            verify_only = true;
+        }
+        else if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "line") == 0) policy = OUT_LINE;
+            else if (strcmp(mode, "block") == 0) policy = OUT_BLOCK;
+            else if (strcmp(mode, "unbuffered") == 0) policy = OUT_UNBUFFERED;
             else {
-                cpu.Z = false;
+                usage(argv[0]);
+                return EXIT_FAILURE;
             }
-            instr_len = 3;
-            break;
         }
-        case 0x22: { // JZ IMM16
-            CHECK_ROM(3);
-            if (cpu.Z) {
-                cpu.PC = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-                continue; // skip PC += instr_len
+        else if (strcmp(argv[i], "--rom-size") == 0 && i + 1 < argc) {
+            char* end;
+            unsigned long n = strtoul(argv[++i], &end, 0);
+            if (*end || n == 0 || n > ROM_MAX_SIZE) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
             }
-            instr_len = 3;
-            break;
-        }
-        case 0x23: { // JNZ IMM16
-            CHECK_ROM(3);
-            if (!cpu.Z) {
-                cpu.PC = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-                continue;
+            rom_size = n;
+        }
+        else if (strcmp(argv[i], "--snapshot-at") == 0 && i + 1 < argc) {
+            const char* spec = argv[++i];
+            char* end;
+            snapshot_by_pc = strncmp(spec, "pc:", 3) == 0;
+            snapshot_point = strtoull(snapshot_by_pc ? spec + 3 : spec, &end, 0);
+            if (*end || end == spec || (snapshot_by_pc && snapshot_point >= ROM_MAX_SIZE)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
             }
-            instr_len = 3;
-            break;
+            snapshot = true;
         }
-        case 0x24: { // LOAD A, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            cpu.A = ram[addr];
-            instr_len = 3;
-            break;
+        else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_file = argv[++i];
         }
-        case 0x25: { // LOAD B, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            cpu.B = ram[addr];
-            instr_len = 3;
-            break;
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_file = argv[++i];
         }
-        case 0x26: { // LOAD C, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            cpu.C = ram[addr];
-            instr_len = 3;
-            break;
+        else if ((strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0)
+                 && i + 1 < argc && !trace_file) {
+            tracing = strcmp(argv[i], "--record") == 0 ? TRACE_RECORD : TRACE_REPLAY;
+            trace_file = argv[++i];
         }
-        case 0x27: { // LOAD D, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            cpu.D = ram[addr];
-            instr_len = 3;
-            break;
+        else if (strcmp(argv[i], "--exec-trace") == 0 && i + 1 < argc) {
+            exec_trace_file = argv[++i];
         }
-        case 0x28: { // STORE A, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            ram[addr] = cpu.A & 0xFF;
-            instr_len = 3;
-            break;
+        else if (strcmp(argv[i], "--dump-trace") == 0 && i + 1 < argc) {
+            dump_file = argv[++i];
         }
-        case 0x29: { // STORE B, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            ram[addr] = cpu.B & 0xFF;
-            instr_len = 3;
-            break;
-        }
-        case 0x2A: { // STORE C, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            ram[addr] = cpu.C & 0xFF;
-            instr_len = 3;
-            break;
+        else if ((strcmp(argv[i], "--seek") == 0 || strcmp(argv[i], "--count") == 0) && i + 1 < argc) {
+            char* end;
+            const char* arg = argv[i + 1];
+            uint64_t n = strtoull(arg, &end, 0);
+            if (*end || end == arg) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (strcmp(argv[i], "--seek") == 0) seek = n;
+            else count = n;
+            dump_range = true;
+            i++;
+        }
+        else if (strcmp(argv[i], "--assemble") == 0 && i + 1 < argc) {
+            assemble_to = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            compile_to = argv[++i];
+        }
+#ifdef VM_PROFILE
+        else if (strcmp(argv[i], "--folded") == 0 && i + 1 < argc) {
+            folded_file = argv[++i];
+        }
+#endif
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        }
+        else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char* end;
+            threads = strtol(argv[++i], &end, 10);
+            if (*end || threads < 1 || threads > 1024) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
         }
-        case 0x2B: { // STORE D, [IMM16]
-            CHECK_ROM(3);
-            uint16_t addr = rom[cpu.PC + 1] | (rom[cpu.PC + 2] << 8);
-            CHECK_RAM(addr);
-            ram[addr] = cpu.D & 0xFF;
-            instr_len = 3;
-            break;
+        else if (argv[i][0] == '-' || rom_file) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
         }
-        case 0x2C: { // PRINT A AS ASCII
-            putchar(cpu.A & 0xFF);
-            instr_len = 1;
-            break;
+        else {
+            rom_file = argv[i];
         }
-        case 0x2D: { // IN A
-            int c = getchar();
-            /*
-             * Convert EOF (-1) to 0 to prevent passing invalid data to the CPU.
-             * This allows input loops to treat 0x00 as end-of-input.
-             */
-            if (c == EOF) c = 0;
-            cpu.A = c & 0xFF;
-            instr_len = 1;
-            break;
+    }
+    if ((lockstep && !manifest) || (dump_range && !dump_file)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (dump_file) {
+        if (rom_file || manifest || exec_trace_file) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
         }
-        case 0x2E: { // PRINT A AS DECIMAL
-            printf("%u", cpu.A);
-            instr_len = 1;
-            break;
+        const char* error;
+        if (!exectrace_dump(dump_file, seek, count, stdout, &error)) {
+            fprintf(stderr, "%s: %s\n", dump_file, error);
+            return EXIT_FAILURE;
         }
-        case 0x2F: { // PRINT A AS BITS
-            for (int i = 7; i >= 0; i--)
-                putchar((cpu.A & (1 << i)) ? '1' : '0');
-            putchar('\n');
-            instr_len = 1;
-            break;
+        return EXIT_SUCCESS;
+    }
+    if (manifest) {
+        if (rom_file || verify_only || exec_trace_file) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
         }
-        case 0x30: { // IN A (DECIMAL)
-            int value = 0;
-            int c;
-            while ((c = getchar()) != EOF && c >= '0' && c <= '9') {
-                value = value * 10 + (c - '0');
-            }
-            cpu.A = value & 0xFF;
-            instr_len = 1;
-            break;
+        return batch_run(manifest, threads > 0 ? (int)threads : 1, rom_size, lockstep);
+    }
+    if (!rom_file || (assemble_to && (verify_only || !asm_source_path(rom_file)))
+        || (compile_to && (assemble_to || verify_only || snapshot || restore_file || trace_file))
+        || (trace_file && (assemble_to || verify_only || snapshot))
+        || (exec_trace_file && (assemble_to || compile_to || verify_only))) {
+        usage(argv[0]);
+        return EXIT_FAILURE; // expands to 1
+    }
+
+    vm* m = vm_create();
+    if (!m) {
+        perror("Couldn't create VM.");
+        return EXIT_FAILURE;
+    }
+
+    vm_load_info info;
+    asm_error asm_err;
+    vm_status status;
+#ifdef VM_STATS
+    double load_time = now_seconds();
+#endif
+    if (asm_source_path(rom_file)) status = vm_load_asm(m, rom_file, rom_size, &info, &asm_err);
+    else status = vm_load(m, rom_file, rom_size, &info);
+#ifdef VM_STATS
+    load_time = now_seconds() - load_time;
+#endif
+    if (status != VM_OK) {
+        if (status == VM_ERR_OPEN) perror("Couldn't open ROM file.");
+        else if (status == VM_ERR_ASSEMBLY) fprintf(stderr, "%s:%zu: %s\n", rom_file, asm_err.line, asm_err.message);
+        else fprintf(stderr, "%s\n", vm_status_string(status));
+        fprintf(stderr, "Error loading ROM.\n");
+        vm_destroy(m);
+        return EXIT_FAILURE;
+    }
+    const uint8_t* rom = vm_rom(m, &rom_size);
+    if (info.truncated) {
+        fprintf(stderr, "Warning: ROM image is larger than %zu bytes, the rest was not loaded "
+                "(--rom-size, at most %d)\n", rom_size, ROM_MAX_SIZE);
+    }
+    if (assemble_to) {
+        FILE* out = fopen(assemble_to, "wb");
+        bool written = out && fwrite(rom, 1, info.loaded, out) == info.loaded;
+        if (out && fclose(out) != 0) written = false;
+        if (!written) perror("Couldn't write ROM file.");
+#ifdef VM_STATS
+        else fprintf(stderr, "assembled %zu bytes in %.3f ms\n", info.loaded, load_time * 1e3);
+#endif
+        vm_destroy(m);
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (compile_to) {
+        FILE* out = fopen(compile_to, "w");
+        bool written = out && aot_compile(m, rom_file, out);
+        if (out && fclose(out) != 0) written = false;
+        if (!written) perror("Couldn't write C file.");
+        vm_destroy(m);
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    printf("Loaded %zu bytes\n", info.loaded);
+
+    if (verify_only) {
+        const verify_report* report = vm_verify_report(m);
+        verify_print(report, stdout);
+        int failed = report->truncated || report->unknown;
+        vm_destroy(m);
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (restore_file) {
+#ifdef VM_STATS
+        double restore_time = now_seconds();
+#endif
+        status = vm_restore(m, restore_file);
+#ifdef VM_STATS
+        if (status == VM_OK)
+            fprintf(stderr, "restored %s in %.1f us\n", restore_file, (now_seconds() - restore_time) * 1e6);
+#endif
+        if (status != VM_OK) {
+            if (status == VM_ERR_OPEN) perror("Couldn't read snapshot file.");
+            else fprintf(stderr, "%s: %s\n", restore_file, vm_status_string(status));
+            vm_destroy(m);
+            return EXIT_FAILURE;
         }
-        case 0x31: { // IN A (BINARY)
-            int value = 0;
-            int c;
-            while ((c = getchar()) != EOF && (c == '0' || c == '1')) {
-                value = (value << 1) | (c - '0');
-            }
-            cpu.A = value & 0xFF;
-            instr_len = 1;
-            break;
+    }
+
+    // --snapshot-at: a breakpoint for a PC, a step budget for a count
+    bool taking_snapshot = snapshot && (snapshot_by_pc || snapshot_point > vm_instructions(m));
+    uint64_t n_steps = 0;
+    if (taking_snapshot && snapshot_by_pc) {
+        if (vm_set_breakpoint(m, snapshot_point) != VM_OK) {
+            fprintf(stderr, "Snapshot PC %llu is outside the ROM.\n", (unsigned long long)snapshot_point);
+            vm_destroy(m);
+            return EXIT_FAILURE;
         }
-        case 0xFF: { // HALT
-            return EXIT_SUCCESS;
+    }
+    else if (taking_snapshot) {
+        n_steps = snapshot_point - vm_instructions(m);
+    }
+
+    trace* t = NULL;
+    if (trace_file) {
+        const char* error;
+        t = trace_open(m, trace_file, tracing, &error);
+        if (!t) {
+            if (error) fprintf(stderr, "%s: %s\n", trace_file, error);
+            else perror("Couldn't open trace file.");
+            vm_destroy(m);
+            return EXIT_FAILURE;
         }
-        default: {
-            printf("Unknown opcode: 0x%02X at PC=%zu\n", opcode, cpu.PC);
+    }
+    exectrace* x = NULL;
+    if (exec_trace_file) {
+        const char* error;
+        x = exectrace_open(m, exec_trace_file, &error);
+        if (!x) {
+            if (error) fprintf(stderr, "%s: %s\n", exec_trace_file, error);
+            else perror("Couldn't open execution trace file.");
+            vm_destroy(m);
             return EXIT_FAILURE;
         }
-        } // switch end
+    }
+
+    // the VM writes to the fd directly, so nothing may still sit in stdio
+    fflush(stdout);
+    out_init(STDOUT_FILENO, policy);
+    in_init(STDIN_FILENO);
+
+#ifdef VM_STATS
+    double start_time = now_seconds();
+#endif
+    // a count already reached needs no run at all
+    if (t) status = trace_run(t);
+    else status = snapshot && !taking_snapshot ? VM_STEP_LIMIT : vm_run(m, n_steps);
+#ifdef VM_STATS
+    double elapsed = now_seconds() - start_time;
+#endif
+    bool trace_ok = true;
+    if (t) {
+        trace_ok = trace_close(t, status, stderr);
+        if (!trace_ok && tracing == TRACE_RECORD) perror("Couldn't write trace file.");
+    }
+    if (x && !exectrace_close(x)) {
+        perror("Couldn't write execution trace file.");
+        trace_ok = false;
+    }
+
+    if (snapshot && (status == VM_BREAKPOINT || status == VM_STEP_LIMIT)) {
+        vm_flush(m);
+        vm_clear_breakpoint(m);
+        status = vm_snapshot(m, snapshot_file);
+        if (status == VM_OK) {
+            fprintf(stderr, "Snapshot written to %s at PC=%zu after %llu instructions\n",
+                    snapshot_file, (size_t)vm_cpu(m)->PC, (unsigned long long)vm_instructions(m));
+        }
+        else {
+            perror("Couldn't write snapshot file.");
+        }
+        vm_destroy(m);
+        return status == VM_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        cpu.PC += instr_len;
+    size_t pc = vm_cpu(m)->PC;
+    int exit_status = EXIT_FAILURE;
+    switch (status) {
+    case VM_HALTED:
+    case VM_END_OF_ROM:
+        exit_status = EXIT_SUCCESS;
+        break;
+    case VM_ERR_UNKNOWN_OPCODE:
+        printf("Unknown opcode: 0x%02X at PC=%zu\n", rom[pc], pc);
+        break;
+    case VM_ERR_TRUNCATED:
+        fprintf(stderr, "Truncated instruction at PC=%zu\n", pc);
+        break;
+    case VM_ERR_UNVERIFIED:
+        fprintf(stderr, "Unverified code reached at PC=%zu\n", pc);
+        break;
+    case VM_ERR_BAD_JUMP:
+        fprintf(stderr, "Jump outside code at PC=%zu\n", pc);
+        break;
+    default:
+        fprintf(stderr, "%s at PC=%zu\n", vm_status_string(status), pc);
+        break;
+    }
+    if (snapshot) {
+        fprintf(stderr, "Program stopped before the snapshot point, no snapshot written.\n");
+        exit_status = EXIT_FAILURE;
     }
+    if (!trace_ok) exit_status = EXIT_FAILURE;
+
+#ifdef VM_STATS
+    uint64_t instr_count = vm_instructions(m);
+    fprintf(stderr, "%s: %llu instructions in %.3f s (%.2f M instr/s)\n",
+            vm_engine(), (unsigned long long)instr_count, elapsed,
+            elapsed > 0 ? instr_count / elapsed / 1e6 : 0.0);
+#endif
+#ifdef VM_PROFILE_NGRAMS
+    ngram_report(stderr, 10);
+#endif
+#ifdef VM_PROFILE
+    profile_report(m, stderr, 10);
+    FILE* folded = fopen(folded_file, "w");
+    const char* name = strrchr(rom_file, '/');
+    if (!folded || !profile_folded(m, name ? name + 1 : rom_file, folded))
+        perror("Couldn't write folded stacks.");
+    if (folded) fclose(folded);
+#endif
+    vm_destroy(m);
+    return exit_status;
 }
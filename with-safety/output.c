@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "cpu.h"
+#include "output.h"
+
+#ifndef NO_OUTPUT_BUFFER
+
+#define RING_MASK (OUT_RING_SIZE - 1)
+
+_Static_assert((OUT_RING_SIZE & RING_MASK) == 0, "OUT_RING_SIZE must be a power of two");
+
+// set once before any vm runs, only read after that
+static int out_fd = STDOUT_FILENO;
+static out_policy policy = OUT_BLOCK;
+
+void out_init(int fd, out_policy p) {
+    out_fd = fd;
+    policy = p;
+}
+
+int out_flush(out_writer* w) {
+    while (w->head != w->tail) {
+        uint32_t used = w->head - w->tail;
+        uint32_t start = w->tail & RING_MASK;
+        uint32_t first = OUT_RING_SIZE - start;
+        ssize_t n;
+
+        if (used <= first) {
+            n = write(out_fd, w->ring + start, used);
+        }
+        else {
+            // the pending bytes wrap around the end of the ring
+            struct iovec iov[2] = {
+                { w->ring + start, first },
+                { w->ring, used - first },
+            };
+            n = writev(out_fd, iov, 2);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->tail = w->head; // drop what cannot be written, like a failed stdio flush
+            return ERROR;
+        }
+        w->tail += (uint32_t)n;
+    }
+    return OK;
+}
+
+// make room for n more bytes
+static inline void reserve(out_writer* w, uint32_t n) {
+    if (OUT_RING_SIZE - (w->head - w->tail) < n) out_flush(w);
+}
+
+static inline void put(out_writer* w, uint8_t c) {
+    w->ring[w->head++ & RING_MASK] = c;
+}
+
+void out_char(out_writer* w, uint8_t c) {
+    reserve(w, 1);
+    put(w, c);
+    if (policy == OUT_UNBUFFERED || (policy == OUT_LINE && c == '\n')) out_flush(w);
+}
+
+void out_decimal(out_writer* w, uint16_t value) {
+    char digits[5]; // 65535
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    reserve(w, n);
+    while (n) put(w, digits[--n]);
+    if (policy == OUT_UNBUFFERED) out_flush(w);
+}
+
+void out_bits(out_writer* w, uint8_t value) {
+    reserve(w, 9);
+    for (int i = 7; i >= 0; i--)
+        put(w, (value >> i) & 1 ? '1' : '0');
+    put(w, '\n');
+    if (policy != OUT_BLOCK) out_flush(w);
+}
+
+#else // NO_OUTPUT_BUFFER: the original stdio path, kept for comparison
+
+void out_init(int fd, out_policy p) {
+    (void)fd;
+    (void)p;
+}
+
+int out_flush(out_writer* w) {
+    (void)w;
+    return fflush(stdout) == 0 ? OK : ERROR;
+}
+
+void out_char(out_writer* w, uint8_t c) {
+    (void)w;
+    putchar(c);
+}
+
+void out_decimal(out_writer* w, uint16_t value) {
+    (void)w;
+    printf("%u", value);
+}
+
+void out_bits(out_writer* w, uint8_t value) {
+    (void)w;
+    for (int i = 7; i >= 0; i--)
+        putchar((value & (1 << i)) ? '1' : '0');
+    putchar('\n');
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+#define OUT_RING_SIZE 65536 // power of two
+
+typedef enum {
+    OUT_UNBUFFERED, // flush after every PRINT opcode
+    OUT_LINE,       // flush after every '\n'
+    OUT_BLOCK,      // flush only when the ring is full
+} out_policy;
+
+/*
+ * VM output sink for the PRINT opcodes. Bytes are formatted straight into
+ * a ring buffer and handed to the fd with write()/writev() according to
+ * the policy, when the ring fills up, and whenever out_flush() is called
+ * (when vm_run() stops and before every IN opcode). Every vm without
+ * vm_set_io() has an out_writer of its own, so vms on different threads
+ * share nothing but the fd. Build with -DNO_OUTPUT_BUFFER to go through
+ * stdio instead.
+ */
+typedef struct {
+    uint32_t head; // next byte to fill, free-running
+    uint32_t tail; // next byte to write, free-running
+    uint8_t ring[OUT_RING_SIZE];
+} out_writer; // all zero to start
+
+// where every out_writer writes and when it flushes; stdout and OUT_BLOCK until called
+void out_init(int fd, out_policy policy);
+void out_char(out_writer* w, uint8_t c);
+void out_decimal(out_writer* w, uint16_t value);
+void out_bits(out_writer* w, uint8_t value);
+int out_flush(out_writer* w);
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "profile.h"
+
+#define NGRAM_SLOTS (1u << 16) // open addressing, power of two
+
+// key: opcodes packed one per byte, most recent lowest, with n in bits 56+
+typedef struct {
+    uint64_t key;
+    uint64_t count;
+} ngram_slot;
+
+static ngram_slot table[NGRAM_SLOTS];
+static uint64_t history;   // last NGRAM_MAX opcodes, most recent in the low byte
+static unsigned depth;     // how many of them are valid
+static uint64_t dropped;   // n-grams lost because the table was full
+
+static const char* const mnemonics[256] = {
+    [0x00] = "ADD A,i8", [0x01] = "ADD B,i8", [0x02] = "ADD C,i8", [0x03] = "ADD D,i8",
+    [0x04] = "SUB A,i8", [0x05] = "SUB B,i8", [0x06] = "SUB C,i8", [0x07] = "SUB D,i8",
+    [0x08] = "INC A", [0x09] = "INC B", [0x0A] = "INC C", [0x0B] = "INC D",
+    [0x0C] = "DEC A", [0x0D] = "DEC B", [0x0E] = "DEC C", [0x0F] = "DEC D",
+    [0x10] = "MOV A,i8", [0x11] = "MOV B,i8", [0x12] = "MOV C,i8", [0x13] = "MOV D,i8",
+    [0x14] = "JMP",
+    [0x15] = "ADD A,i16", [0x16] = "ADD B,i16", [0x17] = "ADD C,i16", [0x18] = "ADD D,i16",
+    [0x19] = "SUB A,i16", [0x1A] = "SUB B,i16", [0x1B] = "SUB C,i16", [0x1C] = "SUB D,i16",
+    [0x1D] = "MOV A,i16", [0x1E] = "MOV B,i16", [0x1F] = "MOV C,i16", [0x20] = "MOV D,i16",
+    [0x21] = "CMP A", [0x22] = "JZ", [0x23] = "JNZ",
+    [0x24] = "LOAD A", [0x25] = "LOAD B", [0x26] = "LOAD C", [0x27] = "LOAD D",
+    [0x28] = "STORE A", [0x29] = "STORE B", [0x2A] = "STORE C", [0x2B] = "STORE D",
+    [0x2C] = "PRINT_ASCII", [0x2D] = "IN", [0x2E] = "PRINT_DECIMAL", [0x2F] = "PRINT_BITS",
+    [0x30] = "IN_DECIMAL", [0x31] = "IN_BINARY", [0xFF] = "HALT",
+};
+
+const char* opcode_mnemonic(uint8_t opcode) {
+    return mnemonics[opcode];
+}
+
+static void count(uint64_t key) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    for (uint32_t i = (uint32_t)(h >> 48), probes = 0; probes < NGRAM_SLOTS; i++, probes++) {
+        ngram_slot* s = &table[i & (NGRAM_SLOTS - 1)];
+        if (s->key == key) {
+            s->count++;
+            return;
+        }
+        if (s->count == 0) {
+            s->key = key;
+            s->count = 1;
+            return;
+        }
+    }
+    dropped++;
+}
+
+void ngram_record(uint8_t opcode) {
+    history = (history << 8) | opcode;
+    if (depth < NGRAM_MAX) depth++;
+    for (unsigned n = 2; n <= depth; n++) {
+        uint64_t mask = (1ull << (8 * n)) - 1;
+        count((history & mask) | ((uint64_t)n << 56));
+    }
+}
+
+static int by_count(const void* a, const void* b) {
+    const ngram_slot* x = a;
+    const ngram_slot* y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+void ngram_report(FILE* out, int top) {
+    static ngram_slot sorted[NGRAM_SLOTS];
+    size_t used = 0;
+
+    for (size_t i = 0; i < NGRAM_SLOTS; i++) {
+        if (table[i].count) sorted[used++] = table[i];
+    }
+    qsort(sorted, used, sizeof(sorted[0]), by_count);
+
+    for (unsigned n = 2; n <= NGRAM_MAX; n++) {
+        fprintf(out, "hottest %u-grams:\n", n);
+        int shown = 0;
+        for (size_t i = 0; i < used && shown < top; i++) {
+            if (sorted[i].key >> 56 != n) continue;
+            fprintf(out, "%12llu ", (unsigned long long)sorted[i].count);
+            // oldest opcode sits in the highest byte
+            for (int k = n - 1; k >= 0; k--)
+                fprintf(out, " %02X", (unsigned)(sorted[i].key >> (8 * k)) & 0xFF);
+            fprintf(out, "  ");
+            for (int k = n - 1; k >= 0; k--) {
+                const char* m = mnemonics[(sorted[i].key >> (8 * k)) & 0xFF];
+                fprintf(out, "%s%s", m ? m : "?", k ? "; " : "\n");
+            }
+            shown++;
+        }
+    }
+    if (dropped) fprintf(out, "(%llu n-grams dropped, table full)\n", (unsigned long long)dropped);
+}
+
+#ifdef VM_PROFILE
+
+/*
+ * Host time source for the per-class costs: the TSC where there is one,
+ * scaled to ns with the wall clock over the whole run, CLOCK_MONOTONIC
+ * elsewhere.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t ticks(void) {
+    return __rdtsc();
+}
+#else
+static inline uint64_t ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+typedef enum {
+    CLASS_ARITH,   // ADD, SUB, INC, DEC
+    CLASS_MOV,     // MOV r, imm
+    CLASS_COMPARE, // CMP
+    CLASS_BRANCH,  // JMP, JZ, JNZ
+    CLASS_MEMORY,  // LOAD, STORE
+    CLASS_OUTPUT,  // PRINT_*
+    CLASS_INPUT,   // IN*
+    CLASS_OTHER,   // HALT and traps
+    N_CLASSES,
+} opcode_class;
+
+static const char* const class_names[N_CLASSES] = {
+    "arithmetic", "mov", "compare", "branch", "memory", "output", "input", "other",
+};
+
+static opcode_class class_of(uint8_t op) {
+    if (op <= 0x0F || (op >= 0x15 && op <= 0x1C)) return CLASS_ARITH;
+    if ((op >= 0x10 && op <= 0x13) || (op >= 0x1D && op <= 0x20)) return CLASS_MOV;
+    if (op == 0x21) return CLASS_COMPARE;
+    if (op == 0x14 || op == 0x22 || op == 0x23) return CLASS_BRANCH;
+    if (op >= OP_BAD_JMP && op <= OP_BAD_JNZ) return CLASS_BRANCH;
+    if (op >= 0x24 && op <= 0x2B) return CLASS_MEMORY;
+    if (op == 0x2C || op == 0x2E || op == 0x2F) return CLASS_OUTPUT;
+    if (op == 0x2D || op == 0x30 || op == 0x31) return CLASS_INPUT;
+    return CLASS_OTHER;
+}
+
+static uint64_t op_count[256];
+static uint64_t op_ticks[256];
+static uint64_t pc_count[ROM_MAX_SIZE + CODE_TAIL]; // + the OP_END entries
+static uint64_t pc_taken[ROM_MAX_SIZE];     // JZ/JNZ sites only
+static uint64_t last_ticks;            // 0 before the first instruction
+static uint8_t last_op;
+static uint64_t start_ticks, start_ns;
+
+void profile_record(uint32_t pc, uint8_t opcode, bool z) {
+    uint64_t now = ticks();
+    if (last_ticks) {
+        op_ticks[last_op] += now - last_ticks;
+    }
+    else {
+        start_ticks = now;
+        start_ns = wall_ns();
+    }
+    last_ticks = now;
+    last_op = opcode;
+
+    op_count[opcode]++;
+    pc_count[pc]++;
+    // the flag is already set, so the outcome is known on entry
+    if ((opcode == 0x22 && z) || (opcode == 0x23 && !z)) pc_taken[pc]++;
+}
+
+/*
+ * ns per tick over the run. The last instruction (HALT, or whatever
+ * stopped the program) is left uncharged: its interval would only
+ * measure the shutdown.
+ */
+static double ns_per_tick(void) {
+    uint64_t elapsed = ticks() - start_ticks;
+    return last_ticks && elapsed ? (double)(wall_ns() - start_ns) / elapsed : 0;
+}
+
+static bool is_jump(uint8_t op) {
+    return op == 0x14 || op == 0x22 || op == 0x23;
+}
+
+// every instruction after which control does not simply fall through
+static bool ends_block(uint8_t op) {
+    return is_jump(op) || op == 0xFF || op > 0x31;
+}
+
+/*
+ * Basic block leaders of the verified code: PC 0, jump targets and the
+ * instruction after a jump. Instructions with no decoded entry are
+ * skipped, so each block runs from a leader to its first terminator or
+ * the next leader.
+ */
+static void find_leaders(const vm* m, uint8_t* leader) {
+    memset(leader, 0, m->rom_size);
+    leader[0] = 1;
+    for (size_t pc = 0; pc < m->rom_size; pc++) {
+        const decoded_op* d = &m->code[pc];
+        if (d->op == OP_UNVERIFIED) continue;
+        if (is_jump(d->op) && d->imm < m->rom_size) leader[d->imm] = 1;
+        if (ends_block(d->op) && pc + d->len < m->rom_size) leader[pc + d->len] = 1;
+    }
+}
+
+typedef struct {
+    uint16_t start, end; // [start, end)
+    uint64_t instructions;
+    uint64_t entries;
+} block;
+
+// executed blocks in address order; returns how many, NULL on no memory
+static block* collect_blocks(const vm* m, size_t* n) {
+    uint8_t* leader = malloc(m->rom_size);
+    block* blocks = malloc(m->rom_size * sizeof(block));
+    *n = 0;
+    if (!leader || !blocks) {
+        free(leader);
+        free(blocks);
+        return NULL;
+    }
+    find_leaders(m, leader);
+    for (size_t pc = 0; pc < m->rom_size; pc++) {
+        if (!leader[pc] || m->code[pc].op == OP_UNVERIFIED || !pc_count[pc]) continue;
+        block* b = &blocks[(*n)++];
+        b->start = (uint16_t)pc;
+        b->entries = pc_count[pc];
+        b->instructions = 0;
+        size_t at = pc;
+        for (;;) {
+            const decoded_op* d = &m->code[at];
+            b->instructions += pc_count[at];
+            at += d->len ? d->len : 1;
+            if (ends_block(d->op) || at >= m->rom_size || leader[at]
+                || m->code[at].op == OP_UNVERIFIED)
+                break;
+        }
+        b->end = at > UINT16_MAX ? UINT16_MAX : (uint16_t)at;
+    }
+    free(leader);
+    return blocks;
+}
+
+static int by_instructions(const void* a, const void* b) {
+    const block* x = a;
+    const block* y = b;
+    if (x->instructions != y->instructions) return x->instructions < y->instructions ? 1 : -1;
+    return x->start - y->start;
+}
+
+// indices 0..n-1 ordered by counts[], highest first
+static const uint64_t* sort_key;
+
+static int by_key(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    if (sort_key[x] != sort_key[y]) return sort_key[x] < sort_key[y] ? 1 : -1;
+    return x < y ? -1 : x > y;
+}
+
+static size_t sorted_nonzero(const uint64_t* counts, size_t n, uint32_t* order) {
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (counts[i]) order[used++] = (uint32_t)i;
+    }
+    sort_key = counts;
+    qsort(order, used, sizeof(order[0]), by_key);
+    return used;
+}
+
+static const char* name_of(uint8_t op) {
+    switch (op) {
+    case OP_UNKNOWN: return "(unknown opcode)";
+    case OP_TRUNCATED: return "(truncated)";
+    case OP_END: return "(end of ROM)";
+    case OP_UNVERIFIED: return "(unverified)";
+    case OP_BAD_JMP: return "JMP (outside code)";
+    case OP_BAD_JZ: return "JZ (outside code)";
+    case OP_BAD_JNZ: return "JNZ (outside code)";
+    } // switch end
+    return mnemonics[op] ? mnemonics[op] : "?";
+}
+
+void profile_report(const vm* m, FILE* out, int top) {
+    static uint32_t order[ROM_MAX_SIZE + CODE_TAIL];
+    double scale = ns_per_tick();
+    uint64_t total = 0, total_ticks = 0;
+    for (int op = 0; op < 256; op++) {
+        total += op_count[op];
+        total_ticks += op_ticks[op];
+    }
+    if (!total) return;
+
+    fprintf(out, "profile: %llu instructions, %.3f ms host time\n",
+            (unsigned long long)total, total_ticks * scale / 1e6);
+
+    fprintf(out, "opcodes:\n");
+    size_t used = sorted_nonzero(op_count, 256, order);
+    for (size_t i = 0; i < used; i++) {
+        uint32_t op = order[i];
+        fprintf(out, "%14llu %6.2f%% %8.2f ns  %02X %s\n", (unsigned long long)op_count[op],
+                100.0 * op_count[op] / total, op_ticks[op] * scale / op_count[op],
+                op, name_of(op));
+    }
+
+    uint64_t class_count[N_CLASSES] = { 0 }, class_ticks[N_CLASSES] = { 0 };
+    for (int op = 0; op < 256; op++) {
+        class_count[class_of(op)] += op_count[op];
+        class_ticks[class_of(op)] += op_ticks[op];
+    }
+    used = sorted_nonzero(class_ticks, N_CLASSES, order);
+    fprintf(out, "host time by opcode class:\n");
+    for (size_t i = 0; i < used; i++) {
+        uint32_t c = order[i];
+        if (!class_count[c]) continue;
+        fprintf(out, "%14llu %6.2f%% %8.2f ns  %s\n", (unsigned long long)class_count[c],
+                100.0 * class_ticks[c] / total_ticks, class_ticks[c] * scale / class_count[c],
+                class_names[c]);
+    }
+
+    fprintf(out, "branches:\n");
+    for (int op = 0x22; op <= 0x23; op++) {
+        uint64_t taken = 0;
+        for (size_t pc = 0; pc < m->rom_size; pc++) {
+            if (m->code[pc].op == op) taken += pc_taken[pc];
+        }
+        if (op_count[op])
+            fprintf(out, "  %-4s %llu executed, %.1f%% taken\n", name_of(op),
+                    (unsigned long long)op_count[op], 100.0 * taken / op_count[op]);
+    }
+
+    used = sorted_nonzero(pc_count, m->rom_size + CODE_TAIL, order);
+    fprintf(out, "hottest instructions:\n");
+    for (size_t i = 0; i < used && i < (size_t)top; i++) {
+        uint32_t pc = order[i];
+        uint8_t op = m->code[pc].op;
+        fprintf(out, "%14llu %6.2f%%  0x%04X %s", (unsigned long long)pc_count[pc],
+                100.0 * pc_count[pc] / total, pc, name_of(op));
+        if (op == 0x22 || op == 0x23)
+            fprintf(out, " 0x%04X, %.1f%% taken", m->code[pc].imm, 100.0 * pc_taken[pc] / pc_count[pc]);
+        fprintf(out, "\n");
+    }
+
+    size_t n;
+    block* blocks = collect_blocks(m, &n);
+    if (!blocks) return;
+    qsort(blocks, n, sizeof(block), by_instructions);
+    fprintf(out, "hottest basic blocks:\n");
+    for (size_t i = 0; i < n && i < (size_t)top; i++) {
+        fprintf(out, "%14llu %6.2f%%  0x%04X-0x%04X, entered %llu times\n",
+                (unsigned long long)blocks[i].instructions, 100.0 * blocks[i].instructions / total,
+                blocks[i].start, blocks[i].end - 1, (unsigned long long)blocks[i].entries);
+    }
+    free(blocks);
+}
+
+bool profile_folded(const vm* m, const char* name, FILE* out) {
+    size_t n;
+    block* blocks = collect_blocks(m, &n);
+    if (!blocks) return false;
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%s;block_0x%04X %llu\n", name, blocks[i].start,
+                (unsigned long long)blocks[i].instructions);
+    }
+    free(blocks);
+    return !ferror(out);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define NGRAM_MAX 5 // longest opcode sequence counted
+
+// "ADD A,i8", "JNZ", ...; NULL outside the instruction set. In every build.
+const char* opcode_mnemonic(uint8_t opcode);
+
+/*
+ * Opcode n-gram profiler (-DVM_PROFILE_NGRAMS). ngram_record() is fed
+ * every executed opcode and counts each run of 2..NGRAM_MAX consecutive
+ * opcodes; ngram_report() prints the hottest ones, which is what the
+ * fusion table in fuse() should be tuned from.
+ */
+void ngram_record(uint8_t opcode);
+void ngram_report(FILE* out, int top);
+
+/*
+ * Hot-path profiler (-DVM_PROFILE). profile_record() is called on entry
+ * to every executed instruction with its PC, decoded opcode (traps as
+ * their OP_* index) and the zero flag;
+ * it counts executions per opcode and per PC, JZ/JNZ taken/not taken,
+ * and charges the host time since the previous call to the previous
+ * opcode. Times therefore include dispatch and the profiler's own
+ * overhead, so they are for comparing opcode classes and builds with
+ * each other, not for absolute costs.
+ *
+ * profile_report() prints the sorted report (hottest opcodes, classes,
+ * branch sites, instructions and basic blocks), and profile_folded() writes
+ * one `name;block_0xXXXX count` line per basic block of m's ROM, counting
+ * guest instructions executed in the block, for flamegraph.pl. Both
+ * describe a single vm: the counters are process-wide.
+ */
+void profile_record(uint32_t pc, uint8_t opcode, bool z);
+void profile_report(const vm* m, FILE* out, int top);
+bool profile_folded(const vm* m, const char* name, FILE* out); // false on a write error
+
+#endif
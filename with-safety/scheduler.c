@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+typedef struct {
+    vm* m;
+    void* ctx;
+    uint64_t left; // instructions of its quota still to run
+} sched_entry;
+
+// the run queue is a ring of entries, its capacity a power of two
+struct vm_sched {
+    uint64_t slice;
+    vm_sched_done done;
+    sched_entry* ring;
+    size_t cap;
+    size_t head;
+    size_t count;
+};
+
+vm_sched* vm_sched_create(uint64_t slice, vm_sched_done done) {
+    vm_sched* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->slice = slice ? slice : 1;
+    s->done = done;
+    return s;
+}
+
+void vm_sched_destroy(vm_sched* s) {
+    if (!s) return;
+    free(s->ring);
+    free(s);
+}
+
+static bool push(vm_sched* s, sched_entry e) {
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        sched_entry* ring = malloc(cap * sizeof(*ring));
+        if (!ring) return false;
+        for (size_t i = 0; i < s->count; i++) ring[i] = s->ring[(s->head + i) & (s->cap - 1)];
+        free(s->ring);
+        s->ring = ring;
+        s->cap = cap;
+        s->head = 0;
+    }
+    s->ring[(s->head + s->count) & (s->cap - 1)] = e;
+    s->count++;
+    return true;
+}
+
+bool vm_sched_add(vm_sched* s, vm* m, uint64_t quota, void* ctx) {
+    sched_entry e = { m, ctx, quota ? quota : UINT64_MAX };
+    return push(s, e);
+}
+
+size_t vm_sched_run(vm_sched* s, uint64_t rounds) {
+    for (uint64_t round = 0; s->count && (rounds == 0 || round < rounds); round++) {
+        // one turn each for the vms queued now; ones added by done() wait a round
+        for (size_t n = s->count; n > 0; n--) {
+            sched_entry e = s->ring[s->head];
+            s->head = (s->head + 1) & (s->cap - 1);
+            s->count--;
+
+            uint64_t before = vm_instructions(e.m);
+            vm_status status = vm_run(e.m, e.left < s->slice ? e.left : s->slice);
+            e.left -= vm_instructions(e.m) - before;
+
+            // a slot was just freed, so this push never allocates
+            if (status == VM_STEP_LIMIT && e.left > 0) push(s, e);
+            else if (s->done) s->done(e.ctx, e.m, status);
+        }
+    }
+    return s->count;
+}
@@ -0,0 +1,33 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * Round-robin time slicing of many vms on the calling thread. Every turn
+ * runs one vm for at most `slice` instructions and puts it at the back
+ * of the queue, so a guest that never halts costs the others one slice
+ * per round rather than the whole thread. A vm leaves the queue when
+ * vm_run() stops for any reason but VM_STEP_LIMIT, or when it has used
+ * up its own instruction quota (reported as VM_STEP_LIMIT); `done` is
+ * then called with it and may add more vms. The scheduler never creates
+ * or destroys vms itself.
+ */
+typedef struct vm_sched vm_sched;
+
+typedef void (*vm_sched_done)(void* ctx, vm* m, vm_status status);
+
+vm_sched* vm_sched_create(uint64_t slice, vm_sched_done done); // NULL if out of memory
+void vm_sched_destroy(vm_sched* s);
+
+// queue a loaded vm; quota 0 means no limit. false if out of memory
+bool vm_sched_add(vm_sched* s, vm* m, uint64_t quota, void* ctx);
+
+// run `rounds` rounds, 0 for until the queue is empty; returns the vms still queued
+size_t vm_sched_run(vm_sched* s, uint64_t rounds);
+
+#endif
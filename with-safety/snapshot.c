@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+
+/*
+ * Snapshot file layout: the saved RAM pages back to back from offset 0,
+ * each SNAPSHOT_PAGE bytes so that restore can map them straight into
+ * RAM, followed by the trailer below. All-zero pages are left out; the
+ * trailer's page mask says which pages are present, in address order.
+ */
+#define SNAPSHOT_PAGE 4096
+#define SNAPSHOT_PAGES (RAM_SIZE / SNAPSHOT_PAGE)
+#define SNAPSHOT_VERSION 1
+
+_Static_assert(SNAPSHOT_PAGES <= 32, "page mask is 32 bits");
+
+typedef struct {
+    char magic[8];         // "SCPUSNAP"
+    uint32_t version;
+    uint32_t page_size;    // SNAPSHOT_PAGE
+    uint32_t page_mask;    // bit n: RAM page n is in the file
+    uint32_t rom_size;
+    uint64_t rom_hash;
+    uint64_t instructions;
+    uint32_t pc;
+    uint16_t a, b, c, d;
+    uint8_t z;
+    uint8_t reserved[7];
+} snapshot_trailer;
+
+static const char magic[8] = { 'S', 'C', 'P', 'U', 'S', 'N', 'A', 'P' };
+
+// 8 bytes per step, so hashing a full ROM takes microseconds
+uint64_t rom_hash(const vm* m) {
+    uint64_t h = 0xCBF29CE484222325ull ^ m->rom_size;
+    size_t i = 0;
+    for (; i + 8 <= m->rom_size; i += 8) {
+        uint64_t w;
+        memcpy(&w, m->rom + i, 8);
+        h = (h ^ w) * 0x100000001B3ull;
+        h ^= h >> 29;
+    }
+    for (; i < m->rom_size; i++) h = (h ^ m->rom[i]) * 0x100000001B3ull;
+    return h;
+}
+
+static bool page_is_zero(const uint8_t* p) {
+    const uint64_t* w = (const uint64_t*)p;
+    for (size_t i = 0; i < SNAPSHOT_PAGE / 8; i++) {
+        if (w[i]) return false;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* buf, size_t n) {
+    const uint8_t* p = buf;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+// pages, then the trailer, from the current file offset
+static bool save_to(const vm* m, int fd) {
+    snapshot_trailer t = {
+        .version = SNAPSHOT_VERSION,
+        .page_size = SNAPSHOT_PAGE,
+        .rom_size = (uint32_t)m->rom_size,
+        .rom_hash = rom_hash(m),
+        .instructions = m->instructions,
+        .pc = (uint32_t)m->cpu.PC,
+        .a = m->cpu.A, .b = m->cpu.B, .c = m->cpu.C, .d = m->cpu.D,
+        .z = m->cpu.Z,
+    };
+    memcpy(t.magic, magic, sizeof(magic));
+
+    for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++) {
+        const uint8_t* p = m->ram + page * SNAPSHOT_PAGE;
+        if (page_is_zero(p)) continue;
+        t.page_mask |= 1u << page;
+        if (!write_all(fd, p, SNAPSHOT_PAGE)) return false;
+    }
+    return write_all(fd, &t, sizeof(t));
+}
+
+/*
+ * Fresh zero RAM, then every run of consecutive saved pages mapped
+ * private from the file, so nothing is copied until the program writes.
+ * RAM keeps its address, which compiled code relies on. Hosts whose page
+ * size is not SNAPSHOT_PAGE read the pages in instead.
+ */
+static vm_status restore_from(vm* m, int fd) {
+    struct stat st;
+    snapshot_trailer t;
+
+    if (fstat(fd, &st) != 0) return VM_ERR_OPEN;
+    if (st.st_size < (off_t)sizeof(t)
+        || pread(fd, &t, sizeof(t), st.st_size - sizeof(t)) != (ssize_t)sizeof(t)
+        || memcmp(t.magic, magic, sizeof(magic)) != 0 || t.version != SNAPSHOT_VERSION
+        || t.page_size != SNAPSHOT_PAGE
+        || (uint64_t)st.st_size != __builtin_popcount(t.page_mask) * (uint64_t)SNAPSHOT_PAGE + sizeof(t)
+        || t.pc > t.rom_size) {
+        return VM_ERR_BAD_SNAPSHOT;
+    }
+    if (t.rom_size != m->rom_size || t.rom_hash != rom_hash(m)) return VM_ERR_ROM_MISMATCH;
+
+    void* ram = mmap(m->ram, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (ram == MAP_FAILED) memset(m->ram, 0, RAM_SIZE); // pages missing from the snapshot are zero
+    bool map = sysconf(_SC_PAGESIZE) == SNAPSHOT_PAGE;
+    off_t offset = 0;
+    for (uint32_t page = 0; page < SNAPSHOT_PAGES; ) {
+        if (!(t.page_mask & (1u << page))) {
+            page++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (page + run < SNAPSHOT_PAGES && (t.page_mask & (1u << (page + run)))) run++;
+
+        uint8_t* at = m->ram + page * SNAPSHOT_PAGE;
+        size_t len = (size_t)run * SNAPSHOT_PAGE;
+        bool ok = map ? mmap(at, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED
+                      : pread(fd, at, len, offset) == (ssize_t)len;
+        if (!ok) {
+            vm_reset(m); // never leave half a snapshot behind
+            return VM_ERR_OPEN;
+        }
+        offset += len;
+        page += run;
+    }
+
+    m->cpu.A = t.a;
+    m->cpu.B = t.b;
+    m->cpu.C = t.c;
+    m->cpu.D = t.d;
+    m->cpu.PC = t.pc;
+    m->cpu.Z = t.z != 0;
+    m->instructions = t.instructions;
+    return VM_OK;
+}
+
+vm_status vm_snapshot(const vm* m, const char* path) {
+    if (!m->code) return VM_ERR_NO_ROM;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return VM_ERR_OPEN;
+    bool ok = save_to(m, fd);
+    int err = errno;
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    errno = err;
+    return ok ? VM_OK : VM_ERR_OPEN;
+}
+
+vm_status vm_restore(vm* m, const char* path) {
+    if (!m->code) return VM_ERR_NO_ROM;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return VM_ERR_OPEN;
+    vm_status status = restore_from(m, fd);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return status;
+}
+
+/*
+ * An image is a snapshot kept in an anonymous in-memory file (memfd on
+ * Linux, an unlinked temporary file elsewhere), sealed against writes.
+ * Forked vms map its pages MAP_PRIVATE, so the kernel shares them until
+ * a STORE writes one, and only that 4 KB page gets copied.
+ */
+struct vm_image {
+    int fd;
+    const vm* rom; // whose ROM and decoded code the forks share
+};
+
+static int anonymous_file(void) {
+    int fd = -1;
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+    fd = memfd_create("simple-cpu-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+    if (fd < 0) {
+        FILE* f = tmpfile();
+        if (!f) return -1;
+        fd = dup(fileno(f));
+        fclose(f);
+    }
+    return fd;
+}
+
+vm_image* vm_capture(const vm* m) {
+    if (!m->code || m->has_breakpoint) return NULL;
+
+    vm_image* image = malloc(sizeof(*image));
+    int fd = anonymous_file();
+    if (!image || fd < 0 || !save_to(m, fd)) {
+        int err = errno;
+        if (fd >= 0) close(fd);
+        free(image);
+        errno = err;
+        return NULL;
+    }
+#if defined(__linux__) && defined(F_ADD_SEALS)
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    image->fd = fd;
+    image->rom = m;
+    return image;
+}
+
+void vm_image_destroy(vm_image* image) {
+    if (!image) return;
+    close(image->fd);
+    free(image);
+}
+
+vm* vm_fork(const vm_image* image) {
+    vm* m = vm_create();
+    if (!m) return NULL;
+    vm_status status = vm_load_shared(m, image->rom);
+    if (status == VM_OK) status = restore_from(m, image->fd);
+    if (status != VM_OK) {
+        vm_destroy(m);
+        return NULL;
+    }
+    return m;
+}
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+/*
+ * Trace file layout: the header, the events, the end record. An event
+ * is a varint tag, (instructions since the previous event << 3) | kind,
+ * then its value: one byte, except the 16-bit PRINT_DECIMAL value, which
+ * is a varint. A tight PRINT or IN loop costs two or three bytes per op.
+ */
+#define TRACE_VERSION 1
+#define TRACE_BUFFER 65536
+#define TRACE_EVENT_MAX 13      // 10-byte tag and 3-byte value
+#define TRACE_SLICE (1u << 24) // replay steps between divergence checks
+
+typedef struct {
+    char magic[8];     // "SCPUTRAC"
+    uint32_t version;
+    uint32_t rom_size;
+    uint64_t rom_hash;
+    uint64_t start;    // the vm's instruction count when recording began
+} trace_header;
+
+typedef struct {
+    uint64_t events;
+    uint64_t instructions;
+    uint32_t pc;
+    uint16_t a, b, c, d;
+    uint8_t status;    // vm_status trace_run() returned
+    uint8_t z;
+    uint8_t reserved[2];
+} trace_end;
+
+// event kinds are the opcode minus 0x2C
+enum { EV_PRINT_ASCII, EV_IN, EV_PRINT_DECIMAL, EV_PRINT_BITS, EV_IN_DECIMAL, EV_IN_BINARY };
+
+static const char* const event_names[] = {
+    "PRINT_ASCII", "IN", "PRINT_DECIMAL", "PRINT_BITS", "IN_DECIMAL", "IN_BINARY",
+};
+
+static const char magic[8] = { 'S', 'C', 'P', 'U', 'T', 'R', 'A', 'C' };
+
+struct trace {
+    vm* m;
+    trace_mode mode;
+    vm_io inner;        // m's I/O before the trace took over
+    uint64_t last_at;   // instruction count of the previous event
+    uint64_t events;    // recorded, or replayed so far
+
+    // recording
+    int fd;
+    uint8_t buffer[TRACE_BUFFER];
+    size_t used;
+    int error;          // errno of the first failed write, or 0
+
+    // replay
+    uint8_t* data;      // the mapped file
+    size_t size;
+    const uint8_t* p;   // next event
+    const uint8_t* events_end;
+    trace_end end;
+    bool diverged;
+    char divergence[256];
+};
+
+static bool write_all(int fd, const void* buf, size_t n) {
+    const uint8_t* p = buf;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static void flush_buffer(trace* t) {
+    if (!t->error && !write_all(t->fd, t->buffer, t->used)) t->error = errno;
+    t->used = 0;
+}
+
+static void put_varint(trace* t, uint64_t v) {
+    while (v >= 0x80) {
+        t->buffer[t->used++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    t->buffer[t->used++] = (uint8_t)v;
+}
+
+static void record(trace* t, int kind, uint16_t value) {
+    if (TRACE_BUFFER - t->used < TRACE_EVENT_MAX) flush_buffer(t);
+    uint64_t at = t->m->io_at;
+    put_varint(t, (at - t->last_at) << 3 | kind);
+    if (kind == EV_PRINT_DECIMAL) put_varint(t, value);
+    else t->buffer[t->used++] = (uint8_t)value;
+    t->last_at = at;
+    t->events++;
+}
+
+// recording: log, then pass through to the wrapped I/O
+static void record_print_ascii(void* ctx, uint8_t c) {
+    trace* t = ctx;
+    record(t, EV_PRINT_ASCII, c);
+    t->inner.print_ascii(t->inner.ctx, c);
+}
+
+static void record_print_decimal(void* ctx, uint16_t value) {
+    trace* t = ctx;
+    record(t, EV_PRINT_DECIMAL, value);
+    t->inner.print_decimal(t->inner.ctx, value);
+}
+
+static void record_print_bits(void* ctx, uint8_t value) {
+    trace* t = ctx;
+    record(t, EV_PRINT_BITS, value);
+    t->inner.print_bits(t->inner.ctx, value);
+}
+
+static uint8_t record_in(void* ctx) {
+    trace* t = ctx;
+    uint8_t value = t->inner.in(t->inner.ctx);
+    record(t, EV_IN, value);
+    return value;
+}
+
+static uint8_t record_in_decimal(void* ctx) {
+    trace* t = ctx;
+    uint8_t value = t->inner.in_decimal(t->inner.ctx);
+    record(t, EV_IN_DECIMAL, value);
+    return value;
+}
+
+static uint8_t record_in_binary(void* ctx) {
+    trace* t = ctx;
+    uint8_t value = t->inner.in_binary(t->inner.ctx);
+    record(t, EV_IN_BINARY, value);
+    return value;
+}
+
+static void record_flush(void* ctx) {
+    trace* t = ctx;
+    if (t->inner.flush) t->inner.flush(t->inner.ctx);
+}
+
+static void diverge(trace* t, const char* format, ...) {
+    if (t->diverged) return;
+    t->diverged = true;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(t->divergence, sizeof(t->divergence), format, args);
+    va_end(args);
+}
+
+static bool get_varint(trace* t, uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; t->p < t->events_end && shift < 64; shift += 7) {
+        uint8_t b = *t->p++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    int kind;
+    uint64_t at;
+    uint16_t value;
+} event;
+
+static bool next_event(trace* t, event* e) {
+    uint64_t tag, value;
+    if (!get_varint(t, &tag) || (tag & 7) > EV_IN_BINARY) return false;
+    e->kind = tag & 7;
+    e->at = t->last_at + (tag >> 3);
+    if (e->kind == EV_PRINT_DECIMAL) {
+        if (!get_varint(t, &value) || value > UINT16_MAX) return false;
+    }
+    else {
+        if (t->p == t->events_end) return false;
+        value = *t->p++;
+    }
+    e->value = (uint16_t)value;
+    return true;
+}
+
+static bool is_input(int kind) {
+    return kind == EV_IN || kind == EV_IN_DECIMAL || kind == EV_IN_BINARY;
+}
+
+// what the I/O op in progress is, for a divergence report
+static void describe_io(char* out, size_t size, int kind, uint16_t value) {
+    if (is_input(kind)) snprintf(out, size, "%s", event_names[kind]);
+    else snprintf(out, size, "%s %u", event_names[kind], value);
+}
+
+/*
+ * The I/O op in progress against the next recorded event: same kind,
+ * same instruction count and, for a PRINT, the same value. On a match
+ * *value gets the recorded one, which for an IN is what to return.
+ */
+static bool replay(trace* t, int kind, uint16_t* value) {
+    if (t->diverged) return false;
+
+    const vm* m = t->m;
+    char got[64];
+    event e;
+    if (t->p == t->events_end) {
+        describe_io(got, sizeof(got), kind, *value);
+        diverge(t, "at instruction %llu (PC=%zu): recorded no more I/O, replay ran %s",
+                (unsigned long long)m->io_at, m->io_pc, got);
+        return false;
+    }
+    if (!next_event(t, &e)) {
+        diverge(t, "at event %llu: the trace is damaged", (unsigned long long)t->events + 1);
+        return false;
+    }
+    if (e.kind != kind || e.at != m->io_at || (!is_input(kind) && e.value != *value)) {
+        describe_io(got, sizeof(got), kind, *value);
+        diverge(t, "at event %llu (PC=%zu): recorded %s %u at instruction %llu, "
+                "replay ran %s at instruction %llu",
+                (unsigned long long)t->events + 1, m->io_pc, event_names[e.kind], e.value,
+                (unsigned long long)e.at, got, (unsigned long long)m->io_at);
+        return false;
+    }
+    t->last_at = e.at;
+    t->events++;
+    *value = e.value;
+    return true;
+}
+
+// replay: check output instead of writing it, and answer IN from the trace
+static void replay_print_ascii(void* ctx, uint8_t c) {
+    uint16_t value = c;
+    replay(ctx, EV_PRINT_ASCII, &value);
+}
+
+static void replay_print_decimal(void* ctx, uint16_t value) {
+    replay(ctx, EV_PRINT_DECIMAL, &value);
+}
+
+static void replay_print_bits(void* ctx, uint8_t bits) {
+    uint16_t value = bits;
+    replay(ctx, EV_PRINT_BITS, &value);
+}
+
+// once diverged, input reads as end of input
+static uint8_t replay_input(trace* t, int kind) {
+    uint16_t value = 0;
+    return replay(t, kind, &value) ? (uint8_t)value : 0;
+}
+
+static uint8_t replay_in(void* ctx) {
+    return replay_input(ctx, EV_IN);
+}
+
+static uint8_t replay_in_decimal(void* ctx) {
+    return replay_input(ctx, EV_IN_DECIMAL);
+}
+
+static uint8_t replay_in_binary(void* ctx) {
+    return replay_input(ctx, EV_IN_BINARY);
+}
+
+static bool open_replay(trace* t, const char* path, const char** error) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        int err = errno;
+        if (fd >= 0) close(fd);
+        errno = err;
+        return false;
+    }
+    if (st.st_size < (off_t)(sizeof(trace_header) + sizeof(trace_end))) {
+        close(fd);
+        *error = "not a trace file";
+        return false;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        errno = err;
+        return false;
+    }
+    t->data = p;
+    t->size = (size_t)st.st_size;
+
+    trace_header h;
+    memcpy(&h, t->data, sizeof(h));
+    memcpy(&t->end, t->data + t->size - sizeof(t->end), sizeof(t->end));
+    if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != TRACE_VERSION) {
+        *error = "not a trace file";
+        return false;
+    }
+    // a recording that never finished has no end record
+    if (t->end.status >= VM_STATUS_COUNT || t->end.instructions < h.start
+        || t->end.events > t->size) {
+        *error = "trace is damaged or incomplete";
+        return false;
+    }
+    if (h.rom_size != t->m->rom_size || h.rom_hash != rom_hash(t->m)) {
+        *error = "trace was recorded with a different ROM";
+        return false;
+    }
+    if (h.start != vm_instructions(t->m)) {
+        *error = "trace was recorded from a different starting point (--restore)";
+        return false;
+    }
+    t->p = t->data + sizeof(h);
+    t->events_end = t->data + t->size - sizeof(t->end);
+    t->last_at = h.start;
+    return true;
+}
+
+trace* trace_open(vm* m, const char* path, trace_mode mode, const char** error) {
+    *error = NULL;
+    if (!m->code) {
+        *error = vm_status_string(VM_ERR_NO_ROM);
+        return NULL;
+    }
+
+    trace* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->m = m;
+    t->mode = mode;
+    t->inner = m->io;
+    t->fd = -1;
+
+    vm_io io;
+    if (mode == TRACE_RECORD) {
+        trace_header h = {
+            .version = TRACE_VERSION,
+            .rom_size = (uint32_t)m->rom_size,
+            .rom_hash = rom_hash(m),
+            .start = vm_instructions(m),
+        };
+        memcpy(h.magic, magic, sizeof(magic));
+        t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (t->fd < 0) {
+            free(t);
+            return NULL;
+        }
+        memcpy(t->buffer, &h, sizeof(h));
+        t->used = sizeof(h);
+        t->last_at = h.start;
+        io = (vm_io){
+            t, record_print_ascii, record_print_decimal, record_print_bits,
+            record_in, record_in_decimal, record_in_binary, record_flush,
+        };
+    }
+    else {
+        if (!open_replay(t, path, error)) {
+            int err = errno;
+            if (t->data) munmap(t->data, t->size);
+            free(t);
+            errno = err;
+            return NULL;
+        }
+        io = (vm_io){
+            t, replay_print_ascii, replay_print_decimal, replay_print_bits,
+            replay_in, replay_in_decimal, replay_in_binary, NULL,
+        };
+    }
+    vm_interpret_only(m);
+    vm_set_io(m, &io);
+    return t;
+}
+
+vm_status trace_run(trace* t) {
+    vm* m = t->m;
+    if (t->mode == TRACE_RECORD) return vm_run(m, 0);
+
+    // one step past the recorded end, so a replay that would run on stops
+    uint64_t stop = t->end.instructions + (t->end.status != VM_STEP_LIMIT);
+    for (;;) {
+        uint64_t done = vm_instructions(m);
+        if (t->diverged || done >= stop) return VM_STEP_LIMIT;
+        uint64_t left = stop - done;
+        vm_status status = vm_run(m, left < TRACE_SLICE ? left : TRACE_SLICE);
+        if (status != VM_STEP_LIMIT) return status;
+    }
+}
+
+static void describe_end(char* out, size_t size, vm_status status, uint64_t instructions,
+                         size_t pc, uint16_t a, uint16_t b, uint16_t c, uint16_t d, bool z) {
+    snprintf(out, size, "%s at instruction %llu, PC=%zu A=%u B=%u C=%u D=%u Z=%d",
+             vm_status_string(status), (unsigned long long)instructions, pc, a, b, c, d, z);
+}
+
+// the replay has stopped with status: the trace must be used up and the end state match
+static void check_end(trace* t, vm_status status) {
+    const vm* m = t->m;
+    const trace_end* e = &t->end;
+    char got[128], want[128];
+
+    describe_end(got, sizeof(got), status, m->instructions, m->cpu.PC,
+                 m->cpu.A, m->cpu.B, m->cpu.C, m->cpu.D, m->cpu.Z);
+    if (t->p != t->events_end) {
+        event next;
+        if (!next_event(t, &next)) {
+            diverge(t, "at event %llu: the trace is damaged", (unsigned long long)t->events + 1);
+            return;
+        }
+        diverge(t, "at event %llu: recorded %s %u at instruction %llu, replay stopped: %s",
+                (unsigned long long)t->events + 1, event_names[next.kind], next.value,
+                (unsigned long long)next.at, got);
+        return;
+    }
+    if (e->status != status || e->instructions != m->instructions || e->pc != m->cpu.PC
+        || e->a != m->cpu.A || e->b != m->cpu.B || e->c != m->cpu.C || e->d != m->cpu.D
+        || e->z != m->cpu.Z) {
+        describe_end(want, sizeof(want), (vm_status)e->status, e->instructions, e->pc,
+                     e->a, e->b, e->c, e->d, e->z);
+        diverge(t, "at the end: recorded %s; replay %s", want, got);
+    }
+}
+
+bool trace_close(trace* t, vm_status status, FILE* report) {
+    vm* m = t->m;
+    bool ok;
+
+    vm_set_io(m, &t->inner);
+    if (t->mode == TRACE_RECORD) {
+        trace_end e = {
+            .events = t->events,
+            .instructions = m->instructions,
+            .pc = (uint32_t)m->cpu.PC,
+            .a = m->cpu.A, .b = m->cpu.B, .c = m->cpu.C, .d = m->cpu.D,
+            .status = (uint8_t)status,
+            .z = m->cpu.Z,
+        };
+        flush_buffer(t);
+        if (!t->error && !write_all(t->fd, &e, sizeof(e))) t->error = errno;
+        if (close(t->fd) != 0 && !t->error) t->error = errno;
+        ok = !t->error;
+        if (!ok) errno = t->error;
+    }
+    else {
+        if (!t->diverged) check_end(t, status);
+        ok = !t->diverged;
+        if (ok) {
+            fprintf(report, "replay matched: %llu I/O events, %llu instructions\n",
+                    (unsigned long long)t->events, (unsigned long long)m->instructions);
+        }
+        else {
+            fprintf(report, "replay diverged %s\n", t->divergence);
+        }
+        munmap(t->data, t->size);
+    }
+    free(t);
+    return ok;
+}
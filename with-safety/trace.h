@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+/*
+ * I/O record/replay (--record, --replay). Recording wraps a vm's I/O and
+ * logs every value an IN opcode returned and every PRINT, each tagged
+ * with the instruction count at which it ran, then the final status,
+ * PC and registers. Replaying feeds the recorded input back without
+ * touching stdin or stdout and checks every PRINT, IN and the final
+ * state against the trace; the first difference is the divergence.
+ *
+ * A trace belongs to the ROM and starting instruction count it was
+ * recorded with (a --restore'd run must be replayed from the same
+ * snapshot). Either mode drops m's compiled code, since only the
+ * interpreter can tell an I/O callback where it is.
+ */
+typedef struct trace trace;
+
+typedef enum {
+    TRACE_RECORD,
+    TRACE_REPLAY,
+} trace_mode;
+
+/*
+ * Start recording to or replaying from path; m must be loaded. NULL on
+ * failure, with *error describing it, or NULL in *error to mean errno.
+ */
+trace* trace_open(vm* m, const char* path, trace_mode mode, const char** error);
+
+// run m to the end; a replay stops early once it has diverged
+vm_status trace_run(trace* t);
+
+/*
+ * Finish with the status trace_run() returned: a recording writes its
+ * end record, a replay checks it and reports the outcome to `report`.
+ * Frees t. false if the trace couldn't be written or the replay diverged.
+ */
+bool trace_close(trace* t, vm_status status, FILE* report);
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "verify.h"
+
+// rom check helper
+static inline bool can_read(const vm* m, size_t pc, size_t n) {
+    return pc + n <= m->rom_size;
+}
+
+// operand byte; the ROM mapping is zero from the end of the image to ROM_MAX_SIZE
+static inline uint8_t rom_byte(const vm* m, size_t at) {
+    return at < ROM_MAX_SIZE ? m->rom[at] : 0;
+}
+
+// instruction length by opcode, 0 for opcodes outside the instruction set
+static uint8_t opcode_length(uint8_t opcode) {
+    if (opcode <= 0x07) return 2; // ADD/SUB r, IMM8
+    if (opcode <= 0x0F) return 1; // INC/DEC r
+    if (opcode <= 0x13) return 2; // MOV r, IMM8
+    if (opcode <= 0x2B) return 3; // JMP, IMM16 forms, CMP, JZ/JNZ, LOAD/STORE
+    if (opcode <= 0x31) return 1; // PRINT/IN
+    if (opcode == 0xFF) return 1; // HALT
+    return 0;
+}
+
+static bool is_jump(uint8_t op) {
+    return op == 0x14 || op == 0x22 || op == 0x23;
+}
+
+// every decoded entry gets a real opcode or a trap
+static inline bool decoded(const vm* m, size_t pc) {
+    return m->code[pc].op != OP_UNVERIFIED;
+}
+
+static void decode(vm* m, size_t pc, verify_report* report) {
+    decoded_op* d = &m->code[pc];
+    uint8_t opcode = m->rom[pc];
+    uint8_t len = opcode_length(opcode);
+
+    report->instructions++;
+    d->len = len;
+    d->imm = 0;
+    if (len == 0) {
+        d->op = OP_UNKNOWN;
+        report->unknown++;
+        return;
+    }
+#if VM_SAFETY == VM_SAFETY_NONE
+    if (can_read(m, pc, len) && len > 1) report->rom_checks_proven++;
+#else
+    if (!can_read(m, pc, len)) {
+        d->op = OP_TRUNCATED;
+        report->truncated++;
+        return;
+    }
+    if (len > 1) report->rom_checks_proven++;
+#endif
+
+    d->op = opcode;
+    if (len == 2) d->imm = rom_byte(m, pc + 1);
+    if (len == 3) d->imm = rom_byte(m, pc + 1) | (rom_byte(m, pc + 2) << 8);
+    if (opcode >= 0x24 && opcode <= 0x2B) report->ram_checks_proven++;
+    if (is_jump(opcode)) {
+        if (d->imm < m->rom_size) {
+            report->jumps_proven++;
+        }
+        else {
+            d->imm = m->rom_size; // only reached when rom_size < ROM_MAX_SIZE, so it fits
+#if VM_SAFETY != VM_SAFETY_JUMPS
+            report->jumps_out++;
+#endif
+        }
+    }
+}
+
+#if VM_SAFETY == VM_SAFETY_JUMPS
+// the trapping form of a jump whose target is not code
+static uint8_t bad_jump(uint8_t op) {
+    if (op == 0x14) return OP_BAD_JMP;
+    return op == 0x22 ? OP_BAD_JZ : OP_BAD_JNZ;
+}
+#endif
+
+void verify(vm* m, verify_report* report) {
+    decoded_op* code = m->code;
+    size_t rom_size = m->rom_size;
+
+    memset(report, 0, sizeof(*report));
+    for (size_t pc = 0; pc < rom_size; pc++) {
+        code[pc].op = OP_UNVERIFIED;
+        code[pc].len = 1;
+        code[pc].imm = 0;
+    }
+    for (size_t pc = rom_size; pc < rom_size + CODE_TAIL; pc++) {
+        code[pc].op = OP_END;
+        code[pc].len = 0;
+        code[pc].imm = 0;
+    }
+
+#if VM_SAFETY < VM_SAFETY_FULL
+    // no walk: every address is an instruction start, reachable or not
+    for (size_t pc = 0; pc < rom_size; pc++) decode(m, pc, report);
+#else
+    // scratch in m->runs, which count_runs() fills in afterwards: 4 bytes
+    // per address hold the work list and the bitmap with room to spare
+    uint16_t* work = (uint16_t*)m->runs;
+    uint8_t* operand = (uint8_t*)(work + rom_size); // bit set = operand byte of a reachable instruction
+    size_t pending = 0;
+
+    memset(operand, 0, (rom_size + 7) / 8);
+    work[pending++] = 0;
+    while (pending) {
+        size_t pc = work[--pending];
+
+        // follow straight-line code until it ends or meets decoded code
+        while (pc < rom_size && !decoded(m, pc)) {
+            decode(m, pc, report);
+
+            const decoded_op* d = &code[pc];
+            if (d->op == OP_UNKNOWN || d->op == OP_TRUNCATED || d->op == 0xFF) break;
+            for (size_t i = 1; i < d->len; i++) operand[(pc + i) / 8] |= 1 << ((pc + i) % 8);
+            if (is_jump(d->op) && d->imm < rom_size && !decoded(m, d->imm)) {
+                work[pending++] = d->imm;
+            }
+            if (d->op == 0x14) break;
+            pc += d->len;
+            if (pc == rom_size) report->runs_off_end = true;
+        }
+    }
+
+    for (size_t pc = 0; pc < rom_size; pc++) {
+        if (!decoded(m, pc) || !is_jump(code[pc].op)) continue;
+        uint16_t target = code[pc].imm;
+        bool inside = target < rom_size && (operand[target / 8] >> (target % 8) & 1);
+        if (inside) report->misaligned++;
+#if VM_SAFETY == VM_SAFETY_JUMPS
+        // the code decoded from such a target stays; only the jump traps
+        if (inside || target >= rom_size) {
+            code[pc].op = bad_jump(code[pc].op);
+            if (inside) report->jumps_proven--;
+            report->bad_jumps++;
+        }
+#endif
+    }
+#endif
+}
+
+void verify_print(const verify_report* r, FILE* out) {
+    size_t removed = r->rom_checks_proven + r->ram_checks_proven + r->jumps_proven + r->jumps_out;
+    size_t kept = r->truncated + r->unknown + r->bad_jumps;
+
+    static const char* const levels[] = { "none", "ROM bounds", "full", "full + jumps" };
+
+    fprintf(out, "safety level: %s\n", levels[VM_SAFETY]);
+    fprintf(out, "%zu %s instructions\n", r->instructions, VM_SAFETY < VM_SAFETY_FULL ? "decoded" : "reachable");
+    fprintf(out, "%zu runtime checks removed:\n", removed);
+    fprintf(out, "  %zu ROM operand bounds checks\n", r->rom_checks_proven);
+    fprintf(out, "  %zu RAM address checks\n", r->ram_checks_proven);
+    fprintf(out, "  %zu jump range checks (%zu jumps leave ROM)\n", r->jumps_proven + r->jumps_out, r->jumps_out);
+    fprintf(out, "%zu traps kept: %zu truncated, %zu unknown opcode", kept, r->truncated, r->unknown);
+    if (VM_SAFETY == VM_SAFETY_JUMPS) fprintf(out, ", %zu jumps outside code", r->bad_jumps);
+    fprintf(out, "\n");
+    if (r->misaligned) fprintf(out, "%zu jump targets land inside another instruction\n", r->misaligned);
+    if (r->runs_off_end) fprintf(out, "execution can run off the end of ROM\n");
+}
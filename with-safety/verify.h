@@ -0,0 +1,24 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/*
+ * Walk every path from PC 0 through fall-through and JMP/JZ/JNZ targets
+ * and decode what is reachable into m->code. Operand bounds are proven
+ * here once; an instruction that cannot be proven is decoded as a trap
+ * (OP_TRUNCATED, OP_UNKNOWN), addresses never reached are left as
+ * OP_UNVERIFIED, and out-of-ROM jump targets are rewritten to rom_size.
+ * This is the VM_SAFETY_FULL policy; see cpu.h for what the other
+ * levels decode instead. Uses m->runs as scratch, so it has to be set
+ * up, and counted again afterwards; keeps no state of its own, so vms
+ * can load on several threads at once.
+ */
+void verify(vm* m, verify_report* report);
+void verify_print(const verify_report* report, FILE* out);
+
+#endif
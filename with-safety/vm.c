@@ -0,0 +1,1145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "verify.h"
+#include "asm.h"
+#include "input.h"
+#include "output.h"
+#include "loops.h"
+#include "exectrace.h"
+
+/*
+ * The profilers have to see every opcode, so they run on the unfused
+ * instruction stream and without compiled code.
+ */
+#if defined(VM_PROFILE_NGRAMS) || defined(VM_PROFILE)
+#include "profile.h"
+#ifndef NO_FUSION
+#define NO_FUSION 1
+#endif
+#ifndef NO_LOOP_IDIOMS
+#define NO_LOOP_IDIOMS 1
+#endif
+#undef VM_JIT
+#endif
+
+#ifdef VM_JIT
+#include "jit.h"
+#endif
+
+/*
+ * Dispatch selection. GCC and Clang support labels as values, so every
+ * handler ends with its own indirect jump through dispatch_table
+ * (direct threading) instead of funnelling through the one indirect
+ * branch of the switch. Build with -DNO_THREADED_DISPATCH to get the
+ * portable switch loop back.
+ */
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH 1
+#endif
+
+// interpret() stopped at OP_LOOP; vm_run() itself never returns VM_OK
+#define VM_AT_LOOP VM_OK
+
+// leave the dispatch loop through the single exit path
+#define VM_EXIT(s) do { \
+    status = (s); \
+    goto vm_exit; \
+} while (0)
+
+#if defined(VM_PROFILE_NGRAMS) && defined(VM_PROFILE)
+#define COUNT_INSTRUCTION() do { \
+    ngram_record(rom[pc]); \
+    profile_record((uint32_t)pc, op->op, cpu.Z); \
+} while (0)
+#elif defined(VM_PROFILE_NGRAMS)
+#define COUNT_INSTRUCTION() ngram_record(rom[pc])
+#elif defined(VM_PROFILE)
+#define COUNT_INSTRUCTION() profile_record((uint32_t)pc, op->op, cpu.Z)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
+
+/*
+ * The vm_run() budget is charged a whole run (see runs[] in cpu.h) at a
+ * time, on entry to it: at the start and after every branch. When the
+ * run does not fit, the vm steps instead, charging every instruction and
+ * running superinstructions as their components, until the budget is
+ * gone; it stops in front of the next instruction, so vm_run() can pick
+ * up there. In the threaded build stepping swaps in step_table, whose
+ * every entry leads to the charging stub in front of the real handler.
+ *
+ * Execution tracing (exectrace.h) only needs the value of every LOAD
+ * and IN. trace_table is dispatch_table with LOAD and IN sent to copies
+ * of their handlers that also append the record, and superinstructions
+ * holding a LOAD, and loops, sent to op_trace to run as their components.
+ * trace_step_table leads every instruction through the charging stub
+ * and then trace_table. Which of the two step tables applies is picked
+ * on entry, so that starting to step stays a single move on every
+ * branch. The switch build keeps both as bits of `mode`, which it tests
+ * once per instruction as it tested for stepping alone, so an untraced
+ * vm runs as before.
+ */
+#ifdef THREADED_DISPATCH
+#define STEPPING() (table == stepping)
+#define START_STEPPING() (table = stepping)
+#define TRACING() (m->exectrace != NULL)
+#else
+#define STEPPING_MODE 1
+#define TRACING_MODE 2
+#define STEPPING() (mode & STEPPING_MODE)
+#define START_STEPPING() (mode |= STEPPING_MODE)
+#define TRACING() (mode & TRACING_MODE)
+#endif
+
+#define ENTER_RUN() do { \
+    uint32_t run = runs[pc]; \
+    if (budget < run) START_STEPPING(); \
+    else budget -= run; \
+} while (0)
+
+#define STEP() do { \
+    if (budget == 0) VM_EXIT(VM_STEP_LIMIT); \
+    budget--; \
+} while (0)
+
+// the handler to step through: a superinstruction's or a loop's first component
+#define STEP_HANDLER() (is_compound(op->op) ? rom[pc] : op->op)
+
+// the record of the instruction at pc; trace_at reaches a chunk boundary once per EXEC_CHUNK
+#define TRACE_RECORD(delta) do { \
+    *trace_at++ = (exec_record){ (uint16_t)pc, (uint16_t)(delta) }; \
+    if (((uintptr_t)trace_at & (EXEC_CHUNK_BYTES - 1)) == 0) trace_at = exectrace_next_chunk(m, trace_at); \
+} while (0)
+
+// LOAD into r, before it runs
+#define TRACE_LOAD(r) TRACE_RECORD(ram[op->imm] - (r))
+
+// a LOAD a trace_table stub runs itself, recording it on the way
+#define RUN_TRACED_LOAD(r) do { \
+    COUNT_INSTRUCTION(); \
+    uint16_t value = ram[op->imm]; \
+    TRACE_RECORD(value - (r)); \
+    (r) = value; \
+    NEXT(3); \
+} while (0)
+
+// TRACE_LOAD for whichever LOAD opcode is, naming each register by a constant, as OP4 does
+#define TRACE_ANY_LOAD() do { \
+    switch (opcode) { \
+    case 0x24: TRACE_LOAD(cpu.r[0]); break; \
+    case 0x25: TRACE_LOAD(cpu.r[1]); break; \
+    case 0x26: TRACE_LOAD(cpu.r[2]); break; \
+    case 0x27: TRACE_LOAD(cpu.r[3]); break; \
+    } \
+} while (0)
+
+// IN: value into A, appending its record after the IO
+#define TRACE_INPUT(value) do { \
+    uint16_t was = cpu.A; \
+    cpu.A = (value); \
+    TRACE_RECORD(cpu.A - was); \
+} while (0)
+
+// the threaded build sends a traced IN to a stub of its own, as it does LOAD
+#ifdef THREADED_DISPATCH
+#define INPUT(value) (cpu.A = (value))
+#else
+#define INPUT(value) do { \
+    if (TRACING()) TRACE_INPUT(value); \
+    else cpu.A = (value); \
+} while (0)
+#endif
+
+// instructions of the current run, counted from pc + at, not executed yet
+#define RUN_LEFT(at) (STEPPING() ? 0 : runs[pc + (at)] - 1)
+
+/*
+ * Handler plumbing shared by both dispatch strategies. A handler is
+ * written once as OP(opcode) { ... NEXT(len); } and expands either to a
+ * switch case or to a label reached through dispatch_table. `op` always
+ * points at the decoded instruction for pc and `opcode` is the
+ * handler it was dispatched to (a component, when stepping through a
+ * superinstruction).
+ *
+ * The families of four opcodes that differ only in the register they
+ * name (ADD r, LOAD r, ...) are written once as OP4(first, { ... }),
+ * with REG for the register, cpu.r[opcode - first]. By default that is
+ * expanded into a handler per register with a constant index, so A-D
+ * stay in host registers. -DCOMPACT_HANDLERS keeps one handler per
+ * family that indexes cpu.r[] at run time instead: a quarter of the
+ * handlers and a smaller dispatch loop, but the register file then lives
+ * in memory.
+ */
+#ifdef THREADED_DISPATCH
+#define OP(n) op_##n: COUNT_INSTRUCTION();
+#define OP_DEFAULT op_unknown: COUNT_INSTRUCTION();
+#define DISPATCH() do { \
+    op = &code[pc]; \
+    opcode = op->op; \
+    goto *table[opcode]; \
+} while (0)
+#ifdef COMPACT_HANDLERS
+#define OP4(n, ...) op_##n: COUNT_INSTRUCTION(); { const unsigned reg = opcode - (n); __VA_ARGS__ }
+#define FAMILY(n) [n ... (n) + 3] = &&op_##n
+#define TRACE_FAMILY(n) [n ... (n) + 3] = &&op_trace_##n
+#else
+#define OP_REG(n, k, ...) op_##n##_##k: COUNT_INSTRUCTION(); { const unsigned reg = k; __VA_ARGS__ }
+// through a second macro, so that n is expanded before pasting, as in OP4
+#define FAMILY(n) FAMILY_REGS(n)
+#define FAMILY_REGS(n) [n] = &&op_##n##_0, [(n) + 1] = &&op_##n##_1, \
+    [(n) + 2] = &&op_##n##_2, [(n) + 3] = &&op_##n##_3
+#define TRACE_FAMILY(n) [n] = &&op_trace_##n##_0, [(n) + 1] = &&op_trace_##n##_1, \
+    [(n) + 2] = &&op_trace_##n##_2, [(n) + 3] = &&op_trace_##n##_3
+#endif
+#else
+#define OP(n) case n: COUNT_INSTRUCTION();
+#define OP_DEFAULT default: COUNT_INSTRUCTION();
+#define DISPATCH() goto dispatch_next
+#ifdef COMPACT_HANDLERS
+#define OP4(n, ...) case n: case (n) + 1: case (n) + 2: case (n) + 3: COUNT_INSTRUCTION(); \
+    { const unsigned reg = opcode - (n); __VA_ARGS__ }
+#else
+#define OP_REG(n, k, ...) case (n) + k: COUNT_INSTRUCTION(); { const unsigned reg = k; __VA_ARGS__ }
+#endif
+#endif
+
+#ifndef COMPACT_HANDLERS
+#define OP4(n, ...) OP_REG(n, 0, __VA_ARGS__) OP_REG(n, 1, __VA_ARGS__) \
+    OP_REG(n, 2, __VA_ARGS__) OP_REG(n, 3, __VA_ARGS__)
+#endif
+
+#define REG cpu.r[reg]
+
+#define NEXT(len) do { \
+    pc += (len); \
+    DISPATCH(); \
+} while (0)
+
+// a branch not taken: the next run starts right after it
+#define NEXT_RUN(len) do { \
+    pc += (len); \
+    ENTER_RUN(); \
+    DISPATCH(); \
+} while (0)
+
+/*
+ * Jump targets start basic blocks. With -DVM_JIT the JIT counts them and
+ * runs any compiled code from there that fits in the budget, handing
+ * back the first PC it could not run natively.
+ */
+#ifdef VM_JIT
+#define JIT_ENTER() do { \
+    if (jit) { \
+        cpu_state native = cpu; \
+        uint64_t left = budget; \
+        pc = jit_enter(jit, &native, (uint32_t)pc, &left); \
+        cpu = native; \
+        budget = left; \
+        if (pc & JIT_HALT) { \
+            pc &= ~(size_t)JIT_HALT; \
+            VM_EXIT(VM_HALTED); \
+        } \
+    } \
+} while (0)
+#else
+#define JIT_ENTER() ((void)0)
+#endif
+
+/*
+ * Let the I/O callbacks see where they are (io_at, io_pc) for trace.c;
+ * compiled code does not, so tracing drops it. `at` is the PC offset of
+ * the I/O component in a superinstruction.
+ */
+#define MARK_IO(at) do { \
+    m->io_at = m->instructions + (limit - budget) - RUN_LEFT(at); \
+    m->io_pc = pc + (at); \
+} while (0)
+
+// verify() already sent targets past the end of ROM to the OP_END entry, or
+// made the jump trap (VM_SAFETY_JUMPS)
+#define JUMP(addr) do { \
+    pc = (addr); \
+    JIT_ENTER(); \
+    ENTER_RUN(); \
+    DISPATCH(); \
+} while (0)
+
+#ifndef NO_FUSION
+/*
+ * Superinstruction patterns, tried in order at every address. Operands
+ * stay in the component entries, so handlers read them as op[offset].imm
+ * with offset the byte distance from the first instruction.
+ */
+typedef struct {
+    uint8_t op;      // OP_* superinstruction
+    uint8_t n;       // instructions in the sequence
+    uint8_t seq[5];  // their opcodes
+} fusion;
+
+static const fusion fusions[] = {
+    { OP_DECM_JNZ, 5, { 0x24, 0x0C, 0x28, 0x21, 0x23 } },
+    { OP_CMP_JNZ, 2, { 0x21, 0x23 } },
+    { OP_CMP_JZ, 2, { 0x21, 0x22 } },
+    { OP_LOAD_PRINT_DEC, 2, { 0x24, 0x2E } },
+    { OP_LOAD_PRINT_ASCII, 2, { 0x24, 0x2C } },
+    { OP_MOV_STORE_A, 2, { 0x10, 0x28 } },
+    { OP_MOV_STORE_B, 2, { 0x11, 0x29 } },
+    { OP_MOV_STORE_C, 2, { 0x12, 0x2A } },
+    { OP_MOV_STORE_D, 2, { 0x13, 0x2B } },
+};
+
+static bool fusion_matches(const vm* m, const fusion* f, size_t pc) {
+    const decoded_op* code = m->code;
+    size_t at = pc;
+    for (int i = 0; i < f->n; i++) {
+        if (at >= m->rom_size || code[at].op != f->seq[i]) return false;
+        at += code[at].len;
+    }
+    // decrement-and-branch must store back to the cell it loaded
+    if (f->op == OP_DECM_JNZ && code[pc].imm != code[pc + 4].imm) return false;
+    return true;
+}
+
+// runs after verify(), lowest address first, so patterns only ever see plain opcodes
+static void fuse(vm* m) {
+    decoded_op* code = m->code;
+    for (size_t pc = 0; pc < m->rom_size; pc++) {
+        if (code[pc].op > 0x31) continue; // unreached, HALT or a trap
+        for (size_t i = 0; i < sizeof(fusions) / sizeof(fusions[0]); i++) {
+            if (fusion_matches(m, &fusions[i], pc)) {
+                code[pc].op = fusions[i].op;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Put back the plain opcode of any superinstruction that would run the
+ * instruction at pc as one of its later components. The longest pattern
+ * spans 13 bytes, so only the few addresses before pc can hold one.
+ */
+static void unfuse_over(vm* m, size_t pc) {
+    decoded_op* code = m->code;
+    for (size_t q = pc > 12 ? pc - 12 : 0; q < pc; q++) {
+        if (code[q].op < OP_FUSED_FIRST || code[q].op > OP_FUSED_LAST) continue;
+        for (size_t i = 0; i < sizeof(fusions) / sizeof(fusions[0]); i++) {
+            if (fusions[i].op != code[q].op) continue;
+            size_t at = q;
+            for (int k = 1; k < fusions[i].n && at < pc; k++) at += code[at].len;
+            if (at == pc) code[q].op = m->rom[q];
+            break;
+        }
+    }
+}
+#endif
+
+void io_print_ascii(vm* m, uint16_t a) {
+    m->io.print_ascii(m->io.ctx, a & 0xFF);
+}
+
+uint16_t io_in(vm* m) {
+    return m->io.in(m->io.ctx);
+}
+
+void io_print_decimal(vm* m, uint16_t a) {
+    m->io.print_decimal(m->io.ctx, a);
+}
+
+void io_print_bits(vm* m, uint16_t a) {
+    m->io.print_bits(m->io.ctx, a & 0xFF);
+}
+
+uint16_t io_in_decimal(vm* m) {
+    return m->io.in_decimal(m->io.ctx);
+}
+
+uint16_t io_in_binary(vm* m) {
+    return m->io.in_binary(m->io.ctx);
+}
+
+/*
+ * Default I/O: the process's stdout and stdin through output.c and
+ * input.c, with an output ring and a reader of each vm's own as ctx.
+ */
+typedef struct vm_stdio {
+    out_writer out;
+    in_reader in;
+} vm_stdio;
+
+static void stdio_print_ascii(void* ctx, uint8_t c) {
+    out_char(&((vm_stdio*)ctx)->out, c);
+}
+
+static void stdio_print_decimal(void* ctx, uint16_t value) {
+    out_decimal(&((vm_stdio*)ctx)->out, value);
+}
+
+static void stdio_print_bits(void* ctx, uint8_t value) {
+    out_bits(&((vm_stdio*)ctx)->out, value);
+}
+
+// every IN flushes pending output first, so prompts appear before the read
+static uint8_t stdio_in(void* ctx) {
+    vm_stdio* s = ctx;
+    out_flush(&s->out);
+    return in_byte(&s->in);
+}
+
+static uint8_t stdio_in_decimal(void* ctx) {
+    vm_stdio* s = ctx;
+    out_flush(&s->out);
+    return in_decimal(&s->in);
+}
+
+static uint8_t stdio_in_binary(void* ctx) {
+    vm_stdio* s = ctx;
+    out_flush(&s->out);
+    return in_binary(&s->in);
+}
+
+static void stdio_flush(void* ctx) {
+    out_flush(&((vm_stdio*)ctx)->out);
+}
+
+static const vm_io stdio_io = {
+    NULL, stdio_print_ascii, stdio_print_decimal, stdio_print_bits,
+    stdio_in, stdio_in_decimal, stdio_in_binary, stdio_flush,
+};
+
+vm* vm_create(void) {
+    vm* m = aligned_alloc(VM_CACHE_LINE, sizeof(*m)); // sizeof is a multiple of the alignment
+    if (!m) return NULL;
+    memset(m, 0, sizeof(*m));
+    m->ram = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m->ram == MAP_FAILED) {
+        free(m);
+        return NULL;
+    }
+    // zero pages too, so a vm that never prints or reads costs no ring
+    m->stdio = mmap(NULL, sizeof(vm_stdio), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m->stdio == MAP_FAILED) {
+        munmap(m->ram, RAM_SIZE);
+        free(m);
+        return NULL;
+    }
+    m->io = stdio_io;
+    m->io.ctx = m->stdio;
+    return m;
+}
+
+// decoded code and runs[] for every ROM address plus the OP_END entries
+static size_t code_size(size_t rom_size) {
+    return (rom_size + CODE_TAIL) * (sizeof(decoded_op) + sizeof(uint32_t));
+}
+
+// highest address first, so the rest of a run is always counted already
+static void count_runs(vm* m) {
+    const decoded_op* code = m->code;
+    uint32_t* runs = m->runs;
+    for (size_t pc = m->rom_size + CODE_TAIL; pc-- > 0; ) {
+        runs[pc] = ends_run(code[pc].op) ? 1 : 1 + runs[pc + code[pc].len];
+    }
+}
+
+// drop the loaded ROM, its decoded code and compiled code
+static void unload(vm* m) {
+#ifdef VM_JIT
+    jit_destroy(m->jit);
+    m->jit = NULL;
+#endif
+    if (!m->shared) {
+        if (m->code) munmap(m->code, code_size(m->rom_size));
+        if (m->rom) munmap((void*)m->rom, ROM_MAX_SIZE);
+        free(m->loops);
+    }
+    m->code = NULL;
+    m->loops = NULL;
+    m->n_loops = 0;
+    m->runs = NULL;
+    m->rom = NULL;
+    m->rom_size = 0;
+    m->shared = false;
+    m->has_breakpoint = false;
+    m->interpret_only = false;
+}
+
+void vm_destroy(vm* m) {
+    if (!m) return;
+    unload(m);
+    out_flush(&m->stdio->out);
+    if (m->stdio->in.opened) in_close(&m->stdio->in);
+    munmap(m->stdio, sizeof(vm_stdio));
+    munmap(m->ram, RAM_SIZE);
+    free(m);
+}
+
+void vm_reset(vm* m) {
+    memset(&m->cpu, 0, sizeof(m->cpu));
+    m->instructions = 0;
+    // fresh zero pages at the same address, which compiled code has baked in
+    void* ram = mmap(m->ram, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (ram == MAP_FAILED) memset(m->ram, 0, RAM_SIZE); // the old pages are still there
+}
+
+// read() up to n bytes, fewer only at end of file
+static size_t read_full(int fd, uint8_t* buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r > 0) got += r;
+        else if (r < 0 && errno == EINTR) continue;
+        else break;
+    }
+    return got;
+}
+
+// ROM_MAX_SIZE of zero pages for an image to go in
+static uint8_t* map_rom(void) {
+    void* p = mmap(NULL, ROM_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * Make base (from map_rom(), loaded bytes filled in) the vm's ROM:
+ * decode and verify it, fuse superinstructions, find counting loops and
+ * reset the vm.
+ */
+static vm_status install_rom(vm* m, uint8_t* base, size_t loaded, bool truncated,
+                             size_t rom_size, vm_load_info* info) {
+    unload(m);
+    mprotect(base, ROM_MAX_SIZE, PROT_READ);
+    m->rom = base;
+    if (rom_size) m->rom_size = rom_size;
+    else if (loaded < ROM_DEFAULT_SIZE) m->rom_size = ROM_DEFAULT_SIZE;
+    else m->rom_size = loaded;
+
+    // verify() writes every entry, so fault the pages in with one call
+    void* code = mmap(NULL, code_size(m->rom_size), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (code == MAP_FAILED) {
+        unload(m);
+        return VM_ERR_NO_MEMORY;
+    }
+    m->code = code;
+    m->runs = (uint32_t*)(m->code + m->rom_size + CODE_TAIL);
+    verify(m, &m->report);
+    count_runs(m);
+#ifndef NO_FUSION
+    fuse(m);
+#endif
+#ifndef NO_LOOP_IDIOMS
+    find_loops(m);
+#endif
+#ifdef VM_JIT
+    m->jit = jit_create(m);
+#endif
+    vm_reset(m);
+
+    if (info) {
+        info->loaded = loaded;
+        info->truncated = truncated;
+    }
+    return VM_OK;
+}
+
+/*
+ * The file is mapped over the zero pages, so everything past the end of
+ * the image reads as 0 without being copied or cleared. Pipes and other
+ * files that cannot be mapped (and -DNO_ROM_MMAP builds) are read.
+ */
+vm_status vm_load(vm* m, const char* path, size_t rom_size, vm_load_info* info) {
+    if (rom_size > ROM_MAX_SIZE) return VM_ERR_ARGUMENT;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        int err = errno;
+        if (fd >= 0) close(fd);
+        errno = err;
+        return VM_ERR_OPEN;
+    }
+    uint8_t* base = map_rom();
+    if (!base) {
+        close(fd);
+        return VM_ERR_NO_MEMORY;
+    }
+
+    size_t limit = rom_size ? rom_size : ROM_MAX_SIZE;
+    size_t loaded;
+    bool truncated;
+#ifndef NO_ROM_MMAP
+    if (S_ISREG(st.st_mode)) {
+        loaded = (size_t)st.st_size < limit ? (size_t)st.st_size : limit;
+        truncated = (size_t)st.st_size > limit;
+        if (loaded && mmap(base, loaded, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            int err = errno;
+            munmap(base, ROM_MAX_SIZE);
+            close(fd);
+            errno = err;
+            return VM_ERR_OPEN;
+        }
+    }
+    else
+#endif
+    {
+        uint8_t probe;
+        loaded = read_full(fd, base, limit);
+        truncated = loaded == limit && read_full(fd, &probe, 1) == 1;
+    }
+    close(fd);
+    return install_rom(m, base, loaded, truncated, rom_size, info);
+}
+
+vm_status vm_load_image(vm* m, const uint8_t* image, size_t size, size_t rom_size,
+                        vm_load_info* info) {
+    if (rom_size > ROM_MAX_SIZE) return VM_ERR_ARGUMENT;
+
+    uint8_t* base = map_rom();
+    if (!base) return VM_ERR_NO_MEMORY;
+    size_t limit = rom_size ? rom_size : ROM_MAX_SIZE;
+    size_t loaded = size < limit ? size : limit;
+    memcpy(base, image, loaded);
+    return install_rom(m, base, loaded, size > limit, rom_size, info);
+}
+
+vm_status vm_load_asm_source(vm* m, const char* src, size_t len, size_t rom_size,
+                             vm_load_info* info, asm_error* err) {
+    asm_error ignored;
+    if (!err) err = &ignored;
+    if (rom_size > ROM_MAX_SIZE) return VM_ERR_ARGUMENT;
+
+    uint8_t* base = map_rom();
+    if (!base) return VM_ERR_NO_MEMORY;
+    size_t size;
+    if (assemble(src, len, base, rom_size ? rom_size : ROM_MAX_SIZE, &size, err) != OK) {
+        munmap(base, ROM_MAX_SIZE);
+        return VM_ERR_ASSEMBLY;
+    }
+    return install_rom(m, base, size, false, rom_size, info);
+}
+
+// the source is mapped when it can be and read whole otherwise
+vm_status vm_load_asm(vm* m, const char* path, size_t rom_size, vm_load_info* info,
+                      asm_error* err) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        int err_no = errno;
+        if (fd >= 0) close(fd);
+        errno = err_no;
+        return VM_ERR_OPEN;
+    }
+
+    vm_status status;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* src = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (src == MAP_FAILED) return VM_ERR_OPEN;
+        status = vm_load_asm_source(m, src, (size_t)st.st_size, rom_size, info, err);
+        munmap(src, (size_t)st.st_size);
+        return status;
+    }
+
+    size_t len = 0, cap = 65536;
+    char* src = malloc(cap);
+    while (src) {
+        len += read_full(fd, (uint8_t*)src + len, cap - len);
+        if (len < cap) break;
+        cap *= 2;
+        char* bigger = realloc(src, cap);
+        if (!bigger) free(src);
+        src = bigger;
+    }
+    close(fd);
+    if (!src) return VM_ERR_NO_MEMORY;
+    status = vm_load_asm_source(m, src, len, rom_size, info, err);
+    free(src);
+    return status;
+}
+
+/*
+ * ROM, decoded code and verifier report are read-only once loaded, so
+ * they can be borrowed as they are; only RAM, registers and compiled
+ * code (which has this vm's RAM and I/O baked in) are per instance.
+ */
+vm_status vm_load_shared(vm* m, const vm* from) {
+    if (m == from || from->has_breakpoint) return VM_ERR_ARGUMENT;
+    if (!from->code) return VM_ERR_NO_ROM;
+
+    unload(m);
+    m->rom = from->rom;
+    m->rom_size = from->rom_size;
+    m->code = from->code;
+    m->runs = from->runs;
+    m->loops = from->loops;
+    m->n_loops = from->n_loops;
+    m->report = from->report;
+    m->shared = true;
+#ifdef VM_JIT
+    m->jit = jit_create(m);
+#endif
+    vm_reset(m);
+    return VM_OK;
+}
+
+vm_status vm_set_breakpoint(vm* m, size_t pc) {
+    if (!m->code) return VM_ERR_NO_ROM;
+    if (m->shared || pc >= m->rom_size) return VM_ERR_ARGUMENT;
+
+    vm_clear_breakpoint(m);
+#ifndef NO_LOOP_IDIOMS
+    unloop_over(m, pc); // first, it may put a superinstruction back
+#endif
+#ifndef NO_FUSION
+    unfuse_over(m, pc); // for good: the breakpoint must not be run through
+#endif
+#ifdef VM_JIT
+    jit_destroy(m->jit);
+    m->jit = NULL;
+#endif
+    m->breakpoint = pc;
+    m->breakpoint_op = m->code[pc].op;
+    m->code[pc].op = OP_BREAK;
+    m->has_breakpoint = true;
+    return VM_OK;
+}
+
+void vm_clear_breakpoint(vm* m) {
+    if (!m->has_breakpoint) return;
+    m->code[m->breakpoint].op = m->breakpoint_op;
+    m->has_breakpoint = false;
+#ifdef VM_JIT
+    if (!m->interpret_only) m->jit = jit_create(m);
+#endif
+}
+
+void vm_interpret_only(vm* m) {
+#ifdef VM_JIT
+    jit_destroy(m->jit);
+    m->jit = NULL;
+#endif
+    m->interpret_only = true;
+}
+
+void vm_set_io(vm* m, const vm_io* io) {
+    m->io = *io;
+}
+
+void vm_flush(vm* m) {
+    if (m->io.flush) m->io.flush(m->io.ctx);
+}
+
+const cpu_state* vm_cpu(const vm* m) {
+    return &m->cpu;
+}
+
+uint8_t* vm_ram(vm* m) {
+    return m->ram;
+}
+
+const uint8_t* vm_rom(const vm* m, size_t* rom_size) {
+    if (rom_size) *rom_size = m->rom_size;
+    return m->rom;
+}
+
+const verify_report* vm_verify_report(const vm* m) {
+    return &m->report;
+}
+
+uint64_t vm_instructions(const vm* m) {
+    return m->instructions;
+}
+
+const char* vm_status_string(vm_status status) {
+    switch (status) {
+    case VM_OK: return "ok";
+    case VM_HALTED: return "halted";
+    case VM_END_OF_ROM: return "ran past the end of ROM";
+    case VM_STEP_LIMIT: return "step limit reached";
+    case VM_BREAKPOINT: return "breakpoint reached";
+    case VM_ERR_UNKNOWN_OPCODE: return "unknown opcode";
+    case VM_ERR_TRUNCATED: return "truncated instruction";
+    case VM_ERR_UNVERIFIED: return "unverified code reached";
+    case VM_ERR_NO_ROM: return "no ROM loaded";
+    case VM_ERR_OPEN: return "couldn't open file";
+    case VM_ERR_NO_MEMORY: return "out of memory";
+    case VM_ERR_ARGUMENT: return "invalid argument";
+    case VM_ERR_ASSEMBLY: return "assembly error";
+    case VM_ERR_BAD_SNAPSHOT: return "not a valid snapshot";
+    case VM_ERR_ROM_MISMATCH: return "snapshot is for a different ROM";
+    case VM_ERR_BAD_JUMP: return "jump outside code";
+    case VM_STATUS_COUNT: break;
+    }
+    return "unknown status";
+}
+
+const char* vm_engine(void) {
+#if defined(THREADED_DISPATCH) && defined(VM_JIT)
+    return "threaded dispatch + jit";
+#elif defined(THREADED_DISPATCH)
+    return "threaded dispatch";
+#elif defined(VM_JIT)
+    return "switch dispatch + jit";
+#else
+    return "switch dispatch";
+#endif
+}
+
+/*
+ * The dispatch loop: run from cpu.PC until a trap, HALT, OP_LOOP or the
+ * end of limit instructions, charged to m->instructions.
+ */
+static vm_status interpret(vm* m, uint64_t limit) {
+    /*
+     * locals, so the register file and these pointers can live in registers;
+     * PC gets a full-width one, which indexes code[] without a zero-extend
+     */
+    cpu_state cpu = m->cpu;
+    size_t pc = cpu.PC;
+    const decoded_op* const code = m->code;
+    const uint32_t* const runs = m->runs;
+    const uint8_t* const rom = m->rom;
+    uint8_t* const ram = m->ram;
+#ifdef VM_JIT
+    jit_state* const jit = m->jit;
+#endif
+    uint64_t budget = limit;
+    exec_record* trace_at = m->trace_at;
+
+    const decoded_op* op;
+    uint8_t opcode;
+    vm_status status;
+
+#ifdef THREADED_DISPATCH
+    // what dispatch_table and trace_table share: all but LOAD, IN and what holds a LOAD
+#if VM_SAFETY == VM_SAFETY_JUMPS
+#define BAD_JUMP_HANDLERS [OP_BAD_JMP] = &&op_OP_BAD_JMP, [OP_BAD_JZ] = &&op_OP_BAD_JZ, \
+        [OP_BAD_JNZ] = &&op_OP_BAD_JNZ
+#else
+#define BAD_JUMP_HANDLERS [OP_BAD_JMP ... OP_BAD_JNZ] = &&op_unknown
+#endif
+#define SHARED_HANDLERS \
+        FAMILY(0x00), FAMILY(0x04), FAMILY(0x08), FAMILY(0x0C), FAMILY(0x10), \
+        [0x14] = &&op_0x14, FAMILY(0x15), FAMILY(0x19), FAMILY(0x1D), \
+        [0x21] = &&op_0x21, [0x22] = &&op_0x22, [0x23] = &&op_0x23, \
+        FAMILY(0x28), \
+        [0x2C] = &&op_0x2C, [0x2E] = &&op_0x2E, [0x2F] = &&op_0x2F, \
+        [OP_TRUNCATED] = &&op_OP_TRUNCATED, [OP_END] = &&op_OP_END, \
+        [OP_CMP_JNZ] = &&op_OP_CMP_JNZ, [OP_CMP_JZ] = &&op_OP_CMP_JZ, \
+        FAMILY(OP_MOV_STORE_A), \
+        [OP_UNVERIFIED] = &&op_OP_UNVERIFIED, [OP_BREAK] = &&op_OP_BREAK, \
+        BAD_JUMP_HANDLERS, \
+        [OP_LOOP + 1 ... 0xFE] = &&op_unknown, \
+        [OP_UNKNOWN] = &&op_unknown, \
+        [0xFF] = &&op_0xFF
+    static const void* const dispatch_table[256] = {
+        SHARED_HANDLERS,
+        FAMILY(0x24),
+        [0x2D] = &&op_0x2D, [0x30] = &&op_0x30, [0x31] = &&op_0x31,
+        [OP_DECM_JNZ] = &&op_OP_DECM_JNZ, [OP_LOAD_PRINT_DEC] = &&op_OP_LOAD_PRINT_DEC,
+        [OP_LOAD_PRINT_ASCII] = &&op_OP_LOAD_PRINT_ASCII,
+#ifndef NO_LOOP_IDIOMS
+        [OP_LOOP] = &&op_OP_LOOP,
+#else
+        [OP_LOOP] = &&op_unknown,
+#endif
+    };
+    static const void* const step_table[256] = { [0 ... 255] = &&op_step };
+    static const void* const trace_table[256] = {
+        SHARED_HANDLERS,
+        TRACE_FAMILY(0x24),
+        [0x2D] = &&op_trace_0x2D, [0x30] = &&op_trace_0x30, [0x31] = &&op_trace_0x31,
+        [OP_DECM_JNZ] = &&op_trace, [OP_LOAD_PRINT_DEC] = &&op_trace,
+        [OP_LOAD_PRINT_ASCII] = &&op_trace, [OP_LOOP] = &&op_trace,
+    };
+    static const void* const trace_step_table[256] = { [0 ... 255] = &&op_trace_step };
+    const void* const* table = m->exectrace ? trace_table : dispatch_table;
+    const void* const* const stepping = m->exectrace ? trace_step_table : step_table;
+
+    ENTER_RUN();
+    DISPATCH();
+    {
+#else
+    unsigned mode = m->exectrace ? TRACING_MODE : 0;
+    ENTER_RUN();
+    for (;;) {
+        op = &code[pc];
+        opcode = op->op;
+        if (mode) {
+            if (mode & STEPPING_MODE) STEP();
+            opcode = STEP_HANDLER();
+            if (mode & TRACING_MODE) TRACE_ANY_LOAD();
+        }
+        switch (opcode) {
+#endif
+        OP4(0x00, { // ADD r, IMM8
+            REG += op->imm;
+            NEXT(2);
+        })
+        OP4(0x04, { // SUB r, IMM8
+            REG -= op->imm;
+            NEXT(2);
+        })
+        OP4(0x08, { // INC r
+            REG += 1;
+            NEXT(1);
+        })
+        OP4(0x0C, { // DEC r
+            REG -= 1;
+            NEXT(1);
+        })
+        OP4(0x10, { // MOV r, IMM8
+            REG = op->imm;
+            NEXT(2);
+        })
+        OP(0x14) { // JMP IMM16
+            JUMP(op->imm); // skip PC increment entirely
+        }
+        OP4(0x15, { // ADD r, IMM16
+            REG += op->imm;
+            NEXT(3);
+        })
+        OP4(0x19, { // SUB r, IMM16
+            REG -= op->imm;
+            NEXT(3);
+        })
+        OP4(0x1D, { // MOV r, IMM16
+            REG = op->imm;
+            NEXT(3);
+        })
+        OP(0x21) { // CMP A, IMM16
+            if (cpu.A == (op->imm)) {
+                cpu.Z = true;
+            }
+            else {
+                cpu.Z = false;
+            }
+            NEXT(3);
+        }
+        OP(0x22) { // JZ IMM16
+            if (cpu.Z) {
+                JUMP(op->imm); // skip PC += len
+            }
+            NEXT_RUN(3);
+        }
+        OP(0x23) { // JNZ IMM16
+            if (!cpu.Z) {
+                JUMP(op->imm);
+            }
+            NEXT_RUN(3);
+        }
+        OP4(0x24, { // LOAD r, [IMM16]
+            REG = ram[op->imm];
+            NEXT(3);
+        })
+        OP4(0x28, { // STORE r, [IMM16]
+            ram[op->imm] = REG & 0xFF;
+            NEXT(3);
+        })
+        OP(0x2C) { // PRINT A AS ASCII
+            MARK_IO(0);
+            io_print_ascii(m, cpu.A);
+            NEXT(1);
+        }
+        OP(0x2D) { // IN A
+            MARK_IO(0);
+            INPUT(io_in(m));
+            NEXT(1);
+        }
+        OP(0x2E) { // PRINT A AS DECIMAL
+            MARK_IO(0);
+            io_print_decimal(m, cpu.A);
+            NEXT(1);
+        }
+        OP(0x2F) { // PRINT A AS BITS
+            MARK_IO(0);
+            io_print_bits(m, cpu.A);
+            NEXT(1);
+        }
+        OP(0x30) { // IN A (DECIMAL)
+            MARK_IO(0);
+            INPUT(io_in_decimal(m));
+            NEXT(1);
+        }
+        OP(0x31) { // IN A (BINARY)
+            MARK_IO(0);
+            INPUT(io_in_binary(m));
+            NEXT(1);
+        }
+        OP(0xFF) { // HALT
+            VM_EXIT(VM_HALTED);
+        }
+        OP(OP_TRUNCATED) {
+            VM_EXIT(VM_ERR_TRUNCATED);
+        }
+        OP(OP_END) {
+            VM_EXIT(VM_END_OF_ROM);
+        }
+        OP(OP_UNVERIFIED) { // only reachable if verify() missed a path
+            VM_EXIT(VM_ERR_UNVERIFIED);
+        }
+#if VM_SAFETY == VM_SAFETY_JUMPS
+        OP(OP_BAD_JMP) { // JMP to an address that is not code
+            VM_EXIT(VM_ERR_BAD_JUMP);
+        }
+        OP(OP_BAD_JZ) {
+            if (cpu.Z) {
+                VM_EXIT(VM_ERR_BAD_JUMP);
+            }
+            NEXT_RUN(3);
+        }
+        OP(OP_BAD_JNZ) {
+            if (!cpu.Z) {
+                VM_EXIT(VM_ERR_BAD_JUMP);
+            }
+            NEXT_RUN(3);
+        }
+#endif
+        OP(OP_BREAK) { // vm_set_breakpoint()
+            budget += STEPPING() ? 1 : runs[pc]; // nothing from here on has run
+            VM_EXIT(VM_BREAKPOINT);
+        }
+        OP(OP_DECM_JNZ) { // LOAD A,[x]; DEC A; STORE A,[x]; CMP A,k; JNZ t
+            cpu.A = ram[op->imm] - 1;
+            ram[op->imm] = cpu.A & 0xFF;
+            cpu.Z = cpu.A == op[7].imm;
+            if (!cpu.Z) {
+                JUMP(op[10].imm);
+            }
+            NEXT_RUN(13);
+        }
+        OP(OP_CMP_JNZ) { // CMP A,k; JNZ t
+            cpu.Z = cpu.A == op->imm;
+            if (!cpu.Z) {
+                JUMP(op[3].imm);
+            }
+            NEXT_RUN(6);
+        }
+        OP(OP_CMP_JZ) { // CMP A,k; JZ t
+            cpu.Z = cpu.A == op->imm;
+            if (cpu.Z) {
+                JUMP(op[3].imm);
+            }
+            NEXT_RUN(6);
+        }
+        OP(OP_LOAD_PRINT_DEC) { // LOAD A,[x]; PRINT_DECIMAL A
+            cpu.A = ram[op->imm];
+            MARK_IO(3);
+            io_print_decimal(m, cpu.A);
+            NEXT(4);
+        }
+        OP(OP_LOAD_PRINT_ASCII) { // LOAD A,[x]; PRINT_ASCII A
+            cpu.A = ram[op->imm];
+            MARK_IO(3);
+            io_print_ascii(m, cpu.A);
+            NEXT(4);
+        }
+        OP4(OP_MOV_STORE_A, { // MOV r,imm8; STORE r,[x]
+            REG = op->imm;
+            ram[op[2].imm] = REG & 0xFF;
+            NEXT(5);
+        })
+#ifndef NO_LOOP_IDIOMS
+        OP(OP_LOOP) { // for vm_run() to run in closed form; stepping runs rom[pc] instead
+            VM_EXIT(VM_AT_LOOP);
+        }
+#endif
+        OP_DEFAULT {
+            VM_EXIT(VM_ERR_UNKNOWN_OPCODE);
+        }
+        } // switch end
+#ifdef THREADED_DISPATCH
+op_step:
+    STEP();
+    opcode = STEP_HANDLER();
+    goto *dispatch_table[opcode];
+op_trace_step:
+    STEP();
+op_trace:
+    opcode = STEP_HANDLER();
+    goto *trace_table[opcode];
+#ifdef COMPACT_HANDLERS
+op_trace_0x24:
+    RUN_TRACED_LOAD(cpu.r[opcode - 0x24]);
+#else
+op_trace_0x24_0:
+    RUN_TRACED_LOAD(cpu.r[0]);
+op_trace_0x24_1:
+    RUN_TRACED_LOAD(cpu.r[1]);
+op_trace_0x24_2:
+    RUN_TRACED_LOAD(cpu.r[2]);
+op_trace_0x24_3:
+    RUN_TRACED_LOAD(cpu.r[3]);
+#endif
+op_trace_0x2D:
+    COUNT_INSTRUCTION();
+    MARK_IO(0);
+    TRACE_INPUT(io_in(m));
+    NEXT(1);
+op_trace_0x30:
+    COUNT_INSTRUCTION();
+    MARK_IO(0);
+    TRACE_INPUT(io_in_decimal(m));
+    NEXT(1);
+op_trace_0x31:
+    COUNT_INSTRUCTION();
+    MARK_IO(0);
+    TRACE_INPUT(io_in_binary(m));
+    NEXT(1);
+#else
+    dispatch_next:;
+    }
+#endif
+
+vm_exit:
+    cpu.PC = (uint32_t)pc;
+    m->cpu = cpu;
+    m->trace_at = trace_at;
+    m->instructions += limit - budget;
+    return status;
+}
+
+// what interpret() may run of left: a traced vm stops at every checkpoint
+static uint64_t run_budget(vm* m, uint64_t left) {
+    return m->exectrace ? exectrace_budget(m, left) : left;
+}
+
+/*
+ * A loop is run outside interpret(), which keeps its handlers' register
+ * allocation to themselves. It stops with the loop's first iteration
+ * charged, as on entry to any run, and goes on from the exit or, when
+ * the budget runs out before it, from the head.
+ */
+vm_status vm_run(vm* m, uint64_t n_steps) {
+    if (!m->code) return VM_ERR_NO_ROM;
+
+    const uint64_t limit = n_steps ? n_steps : UINT64_MAX;
+    const uint64_t start = m->instructions;
+    vm_status status;
+    if (m->exectrace) exectrace_resume(m);
+    while ((status = interpret(m, run_budget(m, limit - (m->instructions - start)))) == VM_AT_LOOP
+           || (status == VM_STEP_LIMIT && m->instructions - start < limit)) {
+        if (status == VM_STEP_LIMIT) continue; // a traced vm at a checkpoint
+#ifndef NO_LOOP_IDIOMS
+        const loop* l = loop_at(m, m->cpu.PC);
+        uint64_t left = limit - (m->instructions - start);
+        uint64_t io_at = m->instructions - (l->length - 1); // its head's, as MARK_IO(0) has it
+        m->instructions += loop_run(m, l, &m->cpu, left, io_at);
+        m->cpu.PC = m->cpu.Z ? l->exit : l->head;
+#endif
+    }
+    if (m->exectrace) exectrace_pause(m);
+    if (status != VM_STEP_LIMIT && m->io.flush) m->io.flush(m->io.ctx);
+    return status;
+}
@@ -0,0 +1,200 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Embedding API. A vm owns its ROM, decoded code and RAM, so any number
+ * of them can live in one process; the interpreter itself keeps no
+ * global state. Typical use:
+ *
+ *     vm* m = vm_create();
+ *     if (vm_load(m, "program.rom", 0, NULL) == VM_OK) {
+ *         while (vm_run(m, 100000) == VM_STEP_LIMIT) { ... }
+ *     }
+ *     vm_destroy(m);
+ */
+
+#define ROM_DEFAULT_SIZE 32768
+#define ROM_MAX_SIZE 65536 // JMP/JZ/JNZ take a 16-bit target
+#define RAM_SIZE 65536
+
+typedef struct vm vm;
+
+/*
+ * 16 bytes. A-D are also r[0..3], in the order the opcodes number them,
+ * so one handler serves a whole opcode family. PC holds a 16-bit guest
+ * address, or the end of ROM, which is 65536 for a full-size ROM.
+ */
+typedef struct {
+    union {
+        struct {
+            uint16_t A, B, C, D;
+        };
+        uint16_t r[4];
+    };
+    uint32_t PC;
+    bool Z; // zero flag
+} cpu_state;
+
+typedef enum {
+    VM_OK = 0,             // vm_create/vm_load succeeded
+    VM_HALTED,             // executed HALT; PC stays on it
+    VM_END_OF_ROM,         // ran or jumped past the end of ROM
+    VM_STEP_LIMIT,         // the vm_run() budget ran out; call vm_run() again
+    VM_BREAKPOINT,         // PC reached the breakpoint, which has not run yet
+    VM_ERR_UNKNOWN_OPCODE, // PC is on an opcode outside the instruction set
+    VM_ERR_TRUNCATED,      // PC is on an instruction cut off by the end of ROM
+    VM_ERR_UNVERIFIED,     // PC is on code the verifier never reached
+    VM_ERR_NO_ROM,         // vm_run() before a successful vm_load()
+    VM_ERR_OPEN,           // a ROM or snapshot file could not be opened, read or written; see errno
+    VM_ERR_NO_MEMORY,      // a mapping or allocation failed; see errno
+    VM_ERR_ARGUMENT,       // rom_size outside 1..ROM_MAX_SIZE, or sharing a vm with itself
+    VM_ERR_ASSEMBLY,       // the assembler rejected the source; see asm_error
+    VM_ERR_BAD_SNAPSHOT,   // not a snapshot file, or a damaged one
+    VM_ERR_ROM_MISMATCH,   // the snapshot was taken with a different ROM
+    VM_ERR_BAD_JUMP,       // PC is on a jump whose target is not code (-DVM_SAFETY=3)
+    VM_STATUS_COUNT        // not a status: one past the last, for range checks
+} vm_status;
+
+/*
+ * I/O for opcodes 0x2C-0x31. Every callback gets ctx first. The IN
+ * callbacks return the byte to put in A and 0 at end of input. flush,
+ * which may be NULL, is called whenever vm_run() stops for any reason
+ * other than VM_STEP_LIMIT. Without vm_set_io() a vm uses stdout and
+ * stdin through output.c and input.c, with an output ring and a reader
+ * of its own: vms on different threads share no I/O state, their output
+ * interleaves at flushes, and vms reading one pipe split its bytes.
+ * vm_flush() calls flush on demand; vm_destroy() flushes the default
+ * output.
+ */
+typedef struct {
+    void* ctx;
+    void (*print_ascii)(void* ctx, uint8_t c);
+    void (*print_decimal)(void* ctx, uint16_t value);
+    void (*print_bits)(void* ctx, uint8_t value);
+    uint8_t (*in)(void* ctx);
+    uint8_t (*in_decimal)(void* ctx);
+    uint8_t (*in_binary)(void* ctx);
+    void (*flush)(void* ctx);
+} vm_io;
+
+typedef struct {
+    size_t loaded;  // image bytes that went into ROM
+    bool truncated; // the image was longer than the ROM
+} vm_load_info;
+
+/*
+ * What the load-time verifier proved about the ROM. Every counter refers
+ * to instructions reachable from PC 0; nothing else is decoded. Builds
+ * below -DVM_SAFETY=2 decode every ROM address and count them all.
+ */
+typedef struct {
+    size_t instructions;      // reachable instructions
+    size_t rom_checks_proven; // multi-byte instructions proven to fit in ROM
+    size_t ram_checks_proven; // LOAD/STORE sites, 16-bit addresses always fit in RAM
+    size_t jumps_proven;      // JMP/JZ/JNZ proven to target an address inside ROM
+    size_t jumps_out;         // jumps proven to leave ROM, sent to the OP_END entry
+    size_t misaligned;        // jump targets that land inside another instruction
+    size_t bad_jumps;         // jumps that leave ROM or land inside another instruction (trap kept)
+    size_t truncated;         // reachable instructions cut off by the end of ROM (trap kept)
+    size_t unknown;           // reachable opcodes outside the instruction set (trap kept)
+    bool runs_off_end;        // straight-line code reaches the end of ROM
+} verify_report;
+
+// where and why vm_load_asm() rejected a source
+typedef struct {
+    size_t line; // 1-based, 0 if not tied to a line
+    char message[96];
+} asm_error;
+
+// NULL if out of memory
+vm* vm_create(void);
+void vm_destroy(vm* m);
+
+/*
+ * Load a ROM image from a file (mapped read-only, not copied) or from
+ * memory (copied), verify and decode it, and reset the vm. rom_size 0
+ * fits the ROM to the image, between ROM_DEFAULT_SIZE and ROM_MAX_SIZE;
+ * shorter images are zero-padded. info may be NULL.
+ */
+vm_status vm_load(vm* m, const char* path, size_t rom_size, vm_load_info* info);
+vm_status vm_load_image(vm* m, const uint8_t* image, size_t size, size_t rom_size,
+                        vm_load_info* info);
+
+/*
+ * Assemble a .asm source (see asm.h) straight into the ROM and load it
+ * as vm_load() would. rom_size 0 fits the ROM to the code. On
+ * VM_ERR_ASSEMBLY err says what was wrong; err may be NULL.
+ */
+vm_status vm_load_asm(vm* m, const char* path, size_t rom_size, vm_load_info* info,
+                      asm_error* err);
+vm_status vm_load_asm_source(vm* m, const char* src, size_t len, size_t rom_size,
+                             vm_load_info* info, asm_error* err);
+
+/*
+ * Run the ROM already loaded into `from` without loading or decoding it
+ * again; m gets its own RAM and registers. `from` must stay loaded, and
+ * alive, for as long as m uses its ROM.
+ */
+vm_status vm_load_shared(vm* m, const vm* from);
+
+/*
+ * Execute at most n_steps instructions (0: no limit) and report why it
+ * stopped. The vm keeps its state between calls, so a program can be run
+ * in slices (scheduler.h time-slices many vms this way). The budget is exact
+ * but checked once per basic block, not per instruction.
+ */
+vm_status vm_run(vm* m, uint64_t n_steps);
+
+// zero the CPU and RAM, keeping the loaded ROM
+void vm_reset(vm* m);
+
+/*
+ * Make vm_run() stop with VM_BREAKPOINT before it executes the
+ * instruction at pc, until vm_clear_breakpoint(). One breakpoint per vm,
+ * not on a vm that shares its ROM, and compiled code is dropped while it
+ * is set so every instruction goes through the interpreter.
+ */
+vm_status vm_set_breakpoint(vm* m, size_t pc);
+void vm_clear_breakpoint(vm* m);
+
+/*
+ * Save the registers, instruction count and non-zero RAM pages, tagged
+ * with the identity (size and hash) of the loaded ROM; I/O streams are
+ * not part of it. vm_restore() needs the same ROM loaded and maps the
+ * saved pages copy-on-write into RAM, so any number of vms can start
+ * from one snapshot file cheaply.
+ */
+vm_status vm_snapshot(const vm* m, const char* path);
+vm_status vm_restore(vm* m, const char* path);
+
+/*
+ * Fan-out: vm_capture() freezes m's state into an in-memory snapshot,
+ * and every vm_fork() of it is a new vm that shares m's ROM and maps the
+ * image's RAM pages copy-on-write, so a fork costs memory only for the
+ * 4 KB pages its STOREs dirty. m must stay loaded and alive while the
+ * image or its forks are in use and have no breakpoint set when captured;
+ * m itself may keep running.
+ */
+typedef struct vm_image vm_image;
+
+vm_image* vm_capture(const vm* m); // NULL on failure, see errno
+vm* vm_fork(const vm_image* image); // NULL on failure
+void vm_image_destroy(vm_image* image);
+
+void vm_set_io(vm* m, const vm_io* io);
+void vm_flush(vm* m);
+
+const cpu_state* vm_cpu(const vm* m);
+uint8_t* vm_ram(vm* m);
+const uint8_t* vm_rom(const vm* m, size_t* rom_size);
+const verify_report* vm_verify_report(const vm* m);
+uint64_t vm_instructions(const vm* m); // executed since the last load or reset
+
+const char* vm_status_string(vm_status status);
+const char* vm_engine(void); // how this build executes code, e.g. "threaded dispatch + jit"
+
+#endif